@@ -0,0 +1,29 @@
+#!/bin/sh
+# Compares running a large script with a cold parse (--no-cache), a cache
+# miss (parse and save) and a cache hit. Every line is a cheap builtin, so
+# parsing is a large share of the run.
+#
+# Usage: bench/script_cache.sh [lines]   (run from the repo root after make)
+
+lines=${1:-200000}
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+export XDG_CACHE_HOME="$dir/cache"
+mkdir -p "$XDG_CACHE_HOME"
+
+i=0
+while [ $i -lt "$lines" ]; do
+    echo "cd . line $i with quite a few words to tokenize alpha beta gamma delta epsilon zeta eta theta"
+    i=$((i + 1))
+done > "$dir/script.sh"
+
+time_run() {
+    start=$(date +%s%N)
+    ./bshell "$@" "$dir/script.sh" > /dev/null
+    end=$(date +%s%N)
+    echo "$(( (end - start) / 1000000 )) ms"
+}
+
+echo "cold parse:  $(time_run --no-cache)"
+echo "cache miss:  $(time_run)"
+echo "cache hit:   $(time_run)"
@@ -0,0 +1,246 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/wait.h>
+#include "shell.h"
+
+#define BATCH_HEADROOM 2048     // Slack below ARG_MAX, as xargs keeps
+
+extern char **environ;
+
+struct batch_source {
+    char **words;               // Words left to hand out
+    int deferred;               // Words still need brace and glob expansion
+    struct brace_gen *brace;    // Brace word being streamed, NULL if none
+    struct buffer item;         // Current brace item
+    char **matches;             // Glob matches of the current item
+    int match_count;
+    int match_next;
+    int match_cap;
+};
+
+static char *batch_next(struct batch_source *src);
+static size_t arg_size(const char *arg);
+static int batch_wait(int *failed);
+
+/**
+ * Built-in: batch [-P n] command [args...]
+ *
+ * Runs command as many times as needed to pass every argument without
+ * hitting E2BIG, like xargs: the words before the first expanded one
+ * (a glob, brace or substitution result) are repeated in every
+ * invocation and the rest are packed in as tightly as the kernel's limit
+ * allows. The limit is sysconf(_SC_ARG_MAX) minus the environment, so
+ * e.g. `batch rm -f *.o` never fails for size. -P runs up to n
+ * invocations at once, otherwise they run one after another.
+ *
+ * Flagged BUILTIN_LAZY_ARGS, so brace and glob words come in unexpanded
+ * and are streamed through batch_next(): `batch touch f{1..1000000}`
+ * only holds one invocation's worth of names at a time. Words expanded
+ * by the shell are passed by pointer, never copied.
+ *
+ * Note: Flagged BUILTIN_FORKED, so it reaps its invocations with
+ * waitpid(-1). Returns 0 if all succeeded, 127/126 if the command
+ * couldn't run, 123 if any invocation failed.
+ */
+int builtin_batch(char **argv) {
+    long parallel = 1;
+    int i = 1;
+
+    for (; argv[i] != NULL && argv[i][0] == '-' && argv[i][1] != '\0'; i++) {
+        if (strcmp(argv[i], "--") == 0) {
+            i++;
+            break;
+        }
+        const char *value = NULL;
+        if (strcmp(argv[i], "-P") == 0) value = argv[++i];
+        else if (strncmp(argv[i], "-P", 2) == 0) value = argv[i] + 2;
+
+        char *end;
+        if (value != NULL) parallel = strtol(value, &end, 10);
+        if (value == NULL || *value == '\0' || *end != '\0' || parallel < 1) {
+            fprintf(stderr, "batch: usage: batch [-P n] command [args...]\n");
+            return 2;
+        }
+    }
+    if (argv[i] == NULL) {
+        fprintf(stderr, "batch: usage: batch [-P n] command [args...]\n");
+        return 2;
+    }
+
+    // Leading words go in every invocation, expanded ones are split up
+    int command = i;
+    if (command_deferred && command_expanded_at <= command) {
+        fprintf(stderr, "batch: the command name can't be a brace or glob pattern\n");
+        return 2;
+    }
+    int split = command_expanded_at > command ? command_expanded_at : command + 1;
+    int argc = split;
+    while (argv[argc] != NULL) argc++;
+    if (split > argc) split = argc;
+    int fixed = split - command;
+
+    long arg_max = sysconf(_SC_ARG_MAX);
+    if (arg_max <= 0) arg_max = 131072;
+    size_t budget = arg_max - BATCH_HEADROOM - sizeof(char *);
+    for (char **env = environ; *env != NULL; env++) {
+        budget -= arg_size(*env);
+    }
+    for (int j = command; j < split; j++) {
+        budget -= arg_size(argv[j]);
+    }
+    if ((ssize_t) budget <= 0) {
+        fprintf(stderr, "batch: environment and leading arguments leave no room: %s\n", strerror(E2BIG));
+        return 1;
+    }
+
+    int capacity = fixed + INIT_CMD_CAP;
+    char **args = malloc(capacity * sizeof(char *));
+    if (args == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed for batch arguments: %s\n", strerror(errno));
+        exit(1);
+    }
+    memcpy(args, argv + command, fixed * sizeof(char *));
+
+    struct batch_source src = { .words = argv + split, .deferred = command_deferred && command_expanded_at == split };
+    buffer_init(&src.item);
+
+    int failed = 0;
+    int running = 0;
+    char *next = batch_next(&src);
+    do {
+        while (running >= parallel && batch_wait(&failed) == 0) running--;
+        if (failed >= 126) break;
+
+        int count = fixed;
+        size_t size = 0;
+        while (next != NULL && (count == fixed || size + arg_size(next) <= budget)) {
+            if (count >= capacity - 1) {
+                capacity *= 2;
+                char **temp = realloc(args, capacity * sizeof(char *));
+                if (temp == NULL) {
+                    fprintf(stderr, "Error: Memory reallocation failed for batch arguments: %s\n", strerror(errno));
+                    exit(1);
+                }
+                args = temp;
+            }
+            size += arg_size(next);
+            args[count++] = next;
+            next = batch_next(&src);
+        }
+        args[count] = NULL;
+
+        fflush(stdout);
+        pid_t pid = fork();
+        if (pid == 0) {
+            execvp(args[0], args);
+            fprintf(stderr, "Error: Command not found or failed to execute '%s': %s\n", args[0], strerror(errno));
+            exit(errno == ENOENT ? 127 : 126);
+        }
+
+        if (src.deferred) {
+            for (int j = fixed; j < count; j++) free(args[j]);
+        }
+        if (pid < 0) {
+            fprintf(stderr, "Error: Failed to create child process: %s\n", strerror(errno));
+            failed = 1;
+            break;
+        }
+        running++;
+    } while (next != NULL);
+
+    while (running > 0 && batch_wait(&failed) == 0) running--;
+    if (src.deferred) free(next);
+    for (int j = src.match_next; j < src.match_count; j++) free(src.matches[j]);
+    free(src.matches);
+    brace_close(src.brace);
+    buffer_free(&src.item);
+    free(args);
+    if (failed >= 126) return failed;
+    return failed ? 123 : 0;
+}
+
+/**
+ * Hands out batch's next argument. Words the shell already expanded are
+ * returned as they are; deferred ones are brace-expanded one item at a
+ * time and each item globbed, and the results are malloc'd for the
+ * caller to free. Empty brace items are dropped, like the shell does.
+ *
+ * Note:
+ * - Returns NULL once every word is used up
+ * - Calls exit(1) on allocation failure
+ */
+static char *batch_next(struct batch_source *src) {
+    while (1) {
+        if (src->match_next < src->match_count) return src->matches[src->match_next++];
+        src->match_count = src->match_next = 0;
+
+        const char *word;
+        if (src->brace != NULL) {
+            if (!brace_next(src->brace, &src->item)) {
+                brace_close(src->brace);
+                src->brace = NULL;
+                continue;
+            }
+            if (src->item.len == 0) continue;
+            word = src->item.data;
+        } else {
+            if (*src->words == NULL) return NULL;
+            word = *src->words++;
+            if (!src->deferred) return (char *) word;
+            if ((src->brace = brace_open(word)) != NULL) continue;
+        }
+
+        if (has_glob(word)) {
+            if (src->matches == NULL) {
+                src->match_cap = INIT_CMD_CAP;
+                src->matches = malloc(src->match_cap * sizeof(char *));
+                if (src->matches == NULL) {
+                    fprintf(stderr, "Error: Memory allocation failed for batch arguments: %s\n", strerror(errno));
+                    exit(1);
+                }
+            }
+            if (glob_word(word, &src->matches, &src->match_count, &src->match_cap) > 0) continue;
+        }
+
+        char *arg = strdup(word);
+        if (arg == NULL) {
+            fprintf(stderr, "Error: Memory allocation failed for batch arguments: %s\n", strerror(errno));
+            exit(1);
+        }
+        return arg;
+    }
+}
+
+/**
+ * Bytes an argument or environment string takes in the exec image: the
+ * string, its terminator and its pointer.
+ */
+static size_t arg_size(const char *arg) {
+    return strlen(arg) + 1 + sizeof(char *);
+}
+
+/**
+ * Reaps one finished invocation and folds its status into failed: 126
+ * or 127 when the command couldn't run (which stops further batches),
+ * 1 for any other failure.
+ *
+ * Note: Returns 0 once a child was reaped, -1 if none are left
+ */
+static int batch_wait(int *failed) {
+    int status;
+    pid_t pid;
+    while ((pid = waitpid(-1, &status, 0)) == -1 && errno == EINTR);
+    if (pid == -1) return -1;
+
+    int code = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    if (code == 126 || code == 127) {
+        *failed = code;
+    } else if (code != 0 && *failed == 0) {
+        *failed = 1;
+    }
+    return 0;
+}
@@ -0,0 +1,411 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+#include "shell.h"
+
+enum brace_kind {
+    BRACE_TEXT,         // Literal run of the word
+    BRACE_SEQ,          // Parts produced side by side, the last one varying fastest
+    BRACE_LIST,         // {a,b,c}, one alternative at a time
+    BRACE_RANGE         // {x..y[..step]} over integers or characters
+};
+
+struct brace_node {
+    enum brace_kind kind;
+    const char *text;           // BRACE_TEXT: points into the generator's word
+    size_t len;
+    struct brace_node **parts;  // BRACE_SEQ and BRACE_LIST children
+    int count;
+    int current;                // BRACE_LIST: alternative being produced
+    long long first;            // BRACE_RANGE: bounds, step and current value
+    long long last;
+    long long step;
+    long long value;
+    int width;                  // Zero-padded width, 0 if not padded
+    int chars;                  // Range over characters rather than numbers
+};
+
+struct brace_gen {
+    char *word;
+    struct brace_node *root;
+    int done;
+};
+
+static struct brace_node *parse_seq(const char *p, const char *end);
+static struct brace_node *parse_group(const char *p, const char *end);
+static int parse_range(struct brace_node *node, const char *p, const char *end);
+static int parse_bound(const char *p, const char *end, long long *value, int *is_char);
+static const char *skip_substitution(const char *p, const char *end);
+static const char *matching_brace(const char *p, const char *end);
+static struct brace_node *new_node(enum brace_kind kind);
+static void add_part(struct brace_node *parent, struct brace_node *part);
+static void free_node(struct brace_node *node);
+static void emit(struct brace_node *node, struct buffer *out);
+static int advance(struct brace_node *node);
+
+/**
+ * Sets up a lazy brace expansion of word, or returns NULL if word has no
+ * {a,b} list or {x..y[..step]} range to expand. brace_next() then
+ * produces the results one at a time, in the order bash lists them, so
+ * even `{1..10000000}` only ever holds the current item. Malformed braces
+ * stay literal, and braces inside substitutions are left for the command
+ * that runs them.
+ *
+ * Note: Calls exit(1) on allocation failure
+ */
+struct brace_gen *brace_open(const char *word) {
+    if (strchr(word, '{') == NULL || strchr(word, '}') == NULL) return NULL;
+
+    struct brace_gen *gen = malloc(sizeof(struct brace_gen));
+    char *copy = strdup(word);
+    if (gen == NULL || copy == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed while expanding '%s': %s\n", word, strerror(errno));
+        exit(1);
+    }
+    gen->word = copy;
+    gen->root = parse_seq(copy, copy + strlen(copy));
+    gen->done = 0;
+
+    // Nothing but literal text, the word is not a brace expansion
+    int groups = 0;
+    for (int i = 0; i < gen->root->count; i++) {
+        if (gen->root->parts[i]->kind != BRACE_TEXT) groups++;
+    }
+    if (groups == 0) {
+        brace_close(gen);
+        return NULL;
+    }
+    return gen;
+}
+
+/**
+ * Writes the next expansion of gen into out, replacing its contents.
+ *
+ * Note: Returns 1 if an item was produced, 0 once all have been
+ */
+int brace_next(struct brace_gen *gen, struct buffer *out) {
+    if (gen->done) return 0;
+
+    out->len = 0;
+    buffer_reserve(out, 0);
+    out->data[0] = '\0';
+    emit(gen->root, out);
+    if (advance(gen->root)) gen->done = 1;
+    return 1;
+}
+
+/**
+ * Frees a generator from brace_open(), finished or not.
+ */
+void brace_close(struct brace_gen *gen) {
+    if (gen == NULL) return;
+    free_node(gen->root);
+    free(gen->word);
+    free(gen);
+}
+
+/**
+ * Parses the text between p and end into a sequence of literal runs and
+ * brace groups. A '{' that doesn't open a valid group is kept as text.
+ */
+static struct brace_node *parse_seq(const char *p, const char *end) {
+    struct brace_node *seq = new_node(BRACE_SEQ);
+    const char *text = p;
+
+    while (p < end) {
+        const char *skip = skip_substitution(p, end);
+        if (skip != p) {
+            p = skip;
+            continue;
+        }
+        if (*p == '{') {
+            const char *close = matching_brace(p, end);
+            struct brace_node *group = close ? parse_group(p + 1, close) : NULL;
+            if (group != NULL) {
+                if (p > text) {
+                    struct brace_node *literal = new_node(BRACE_TEXT);
+                    literal->text = text;
+                    literal->len = p - text;
+                    add_part(seq, literal);
+                }
+                add_part(seq, group);
+                p = close + 1;
+                text = p;
+                continue;
+            }
+        }
+        p++;
+    }
+
+    if (p > text || seq->count == 0) {
+        struct brace_node *literal = new_node(BRACE_TEXT);
+        literal->text = text;
+        literal->len = p - text;
+        add_part(seq, literal);
+    }
+    return seq;
+}
+
+/**
+ * Parses the inside of a brace pair: a comma-separated list (each
+ * alternative a sequence of its own, so lists nest) or a range.
+ *
+ * Note: Returns NULL if it's neither, the braces are then literal
+ */
+static struct brace_node *parse_group(const char *p, const char *end) {
+    struct brace_node *group = new_node(BRACE_LIST);
+    const char *item = p;
+    int depth = 0;
+
+    while (p < end) {
+        const char *skip = skip_substitution(p, end);
+        if (skip != p) {
+            p = skip;
+            continue;
+        }
+        if (*p == '{') {
+            depth++;
+        } else if (*p == '}') {
+            depth--;
+        } else if (*p == ',' && depth == 0) {
+            add_part(group, parse_seq(item, p));
+            item = p + 1;
+        }
+        p++;
+    }
+
+    if (group->count > 0) {
+        add_part(group, parse_seq(item, end));
+        return group;
+    }
+
+    group->kind = BRACE_RANGE;
+    if (parse_range(group, item, end) < 0) {
+        free_node(group);
+        return NULL;
+    }
+    return group;
+}
+
+/**
+ * Parses x..y or x..y..step, where x and y are both integers or both
+ * single characters. The step's sign is ignored, the direction comes
+ * from the bounds. Integers with a leading zero pad every item to the
+ * widest bound.
+ *
+ * Note: Returns 0 on success, -1 if the text isn't a range
+ */
+static int parse_range(struct brace_node *node, const char *p, const char *end) {
+    const char *dots = memmem(p, end - p, "..", 2);
+    if (dots == NULL) return -1;
+    const char *second = dots + 2;
+    const char *step = memmem(second, end - second, "..", 2);
+    const char *second_end = step ? step : end;
+
+    int first_char, last_char;
+    if (parse_bound(p, dots, &node->first, &first_char) < 0 ||
+        parse_bound(second, second_end, &node->last, &last_char) < 0 ||
+        first_char != last_char) {
+        return -1;
+    }
+    node->chars = first_char;
+
+    long long incr = 1;
+    if (step != NULL) {
+        int step_char;
+        if (parse_bound(step + 2, end, &incr, &step_char) < 0 || step_char) return -1;
+        if (incr < 0) incr = -incr;
+        if (incr == 0) incr = 1;
+    }
+    node->step = node->first <= node->last ? incr : -incr;
+    node->value = node->first;
+
+    if (!node->chars) {
+        const char *a = p + (*p == '-' || *p == '+');
+        const char *b = second + (*second == '-' || *second == '+');
+        if ((a[0] == '0' && a + 1 < dots) || (b[0] == '0' && b + 1 < second_end)) {
+            node->width = (int) (dots - p > second_end - second ? dots - p : second_end - second);
+        }
+    }
+    return 0;
+}
+
+/**
+ * Parses one range bound: an optionally signed integer, or a single
+ * character.
+ *
+ * Note: Returns 0 on success, -1 if it's neither
+ */
+static int parse_bound(const char *p, const char *end, long long *value, int *is_char) {
+    if (p >= end) return -1;
+    if (end - p == 1 && !isdigit((unsigned char) *p)) {
+        *value = (unsigned char) *p;
+        *is_char = 1;
+        return 0;
+    }
+
+    const char *digits = p + (*p == '-' || *p == '+');
+    if (digits >= end) return -1;
+    for (const char *c = digits; c < end; c++) {
+        if (!isdigit((unsigned char) *c)) return -1;
+    }
+
+    char number[32];
+    if ((size_t) (end - p) >= sizeof(number)) return -1;
+    memcpy(number, p, end - p);
+    number[end - p] = '\0';
+    errno = 0;
+    *value = strtoll(number, NULL, 10);
+    if (errno == ERANGE) return -1;
+    *is_char = 0;
+    return 0;
+}
+
+/**
+ * Returns the end of the $(...), <(...), >(...), `...` or ${name} starting
+ * at p, or p itself if none starts there. An unterminated one runs to end.
+ */
+static const char *skip_substitution(const char *p, const char *end) {
+    const char *close;
+    if (p[0] == '$' && p + 1 < end && p[1] == '{') {
+        size_t len = var_ref_length(p);
+        return len > 0 && p + len <= end ? p + len : p;
+    } else if ((p[0] == '$' || p[0] == '<' || p[0] == '>') && p + 1 < end && p[1] == '(') {
+        close = substitutionEnd(p + 2);
+    } else if (*p == '`') {
+        close = memchr(p + 1, '`', end - p - 1);
+    } else {
+        return p;
+    }
+    return close != NULL && close < end ? close + 1 : end;
+}
+
+/**
+ * Finds the '}' closing the '{' at p, skipping nested pairs and
+ * substitutions.
+ *
+ * Note: Returns NULL if it's never closed
+ */
+static const char *matching_brace(const char *p, const char *end) {
+    int depth = 0;
+    while (p < end) {
+        const char *skip = skip_substitution(p, end);
+        if (skip != p) {
+            p = skip;
+            continue;
+        }
+        if (*p == '{') {
+            depth++;
+        } else if (*p == '}' && --depth == 0) {
+            return p;
+        }
+        p++;
+    }
+    return NULL;
+}
+
+/**
+ * Allocates a zeroed node of the given kind.
+ *
+ * Note: Calls exit(1) on allocation failure
+ */
+static struct brace_node *new_node(enum brace_kind kind) {
+    struct brace_node *node = calloc(1, sizeof(struct brace_node));
+    if (node == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed while expanding braces: %s\n", strerror(errno));
+        exit(1);
+    }
+    node->kind = kind;
+    return node;
+}
+
+/**
+ * Appends a child to a sequence or list node.
+ *
+ * Note: Calls exit(1) on allocation failure
+ */
+static void add_part(struct brace_node *parent, struct brace_node *part) {
+    struct brace_node **temp = realloc(parent->parts, (parent->count + 1) * sizeof(struct brace_node *));
+    if (temp == NULL) {
+        fprintf(stderr, "Error: Memory reallocation failed while expanding braces: %s\n", strerror(errno));
+        exit(1);
+    }
+    parent->parts = temp;
+    parent->parts[parent->count++] = part;
+}
+
+/**
+ * Frees a node and everything below it.
+ */
+static void free_node(struct brace_node *node) {
+    for (int i = 0; i < node->count; i++) {
+        free_node(node->parts[i]);
+    }
+    free(node->parts);
+    free(node);
+}
+
+/**
+ * Appends the node's current value to out.
+ */
+static void emit(struct brace_node *node, struct buffer *out) {
+    switch (node->kind) {
+    case BRACE_TEXT:
+        buffer_append(out, node->text, node->len);
+        break;
+    case BRACE_SEQ:
+        for (int i = 0; i < node->count; i++) {
+            emit(node->parts[i], out);
+        }
+        break;
+    case BRACE_LIST:
+        emit(node->parts[node->current], out);
+        break;
+    case BRACE_RANGE:
+        if (node->chars) {
+            char c = (char) node->value;
+            buffer_append(out, &c, 1);
+        } else {
+            char number[32];
+            int len = snprintf(number, sizeof(number), "%0*lld", node->width, node->value);
+            buffer_append(out, number, len);
+        }
+        break;
+    }
+}
+
+/**
+ * Steps the node to its next value like an odometer, rightmost parts
+ * first.
+ *
+ * Note: Returns 1 when the node wrapped back to its first value, so the
+ * part to its left must step too
+ */
+static int advance(struct brace_node *node) {
+    switch (node->kind) {
+    case BRACE_TEXT:
+        return 1;
+    case BRACE_SEQ:
+        for (int i = node->count - 1; i >= 0; i--) {
+            if (!advance(node->parts[i])) return 0;
+        }
+        return 1;
+    case BRACE_LIST:
+        if (!advance(node->parts[node->current])) return 0;
+        if (++node->current < node->count) return 0;
+        node->current = 0;
+        return 1;
+    case BRACE_RANGE:
+        if (node->step > 0 ? node->value <= node->last - node->step
+                           : node->value >= node->last - node->step) {
+            node->value += node->step;
+            return 0;
+        }
+        node->value = node->first;
+        return 1;
+    }
+    return 1;
+}
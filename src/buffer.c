@@ -0,0 +1,73 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "shell.h"
+
+/**
+ * Initializes an empty growable buffer. Nothing is allocated until the
+ * first append, so an unused buffer costs nothing to free.
+ */
+void buffer_init(struct buffer *buf) {
+    buf->data = NULL;
+    buf->len = 0;
+    buf->cap = 0;
+}
+
+/**
+ * Ensures room for extra more bytes plus a null terminator, doubling the
+ * capacity as needed.
+ *
+ * Note: Calls exit(1) on allocation failure
+ */
+void buffer_reserve(struct buffer *buf, size_t extra) {
+    size_t needed = buf->len + extra + 1;
+    if (needed <= buf->cap) return;
+
+    size_t capacity = buf->cap ? buf->cap : INIT_BUFFER_CAP;
+    while (capacity < needed) {
+        capacity *= 2;
+    }
+
+    char *temp = realloc(buf->data, capacity);
+    if (temp == NULL) {
+        fprintf(stderr, "Error: Memory reallocation failed while growing buffer: %s\n", strerror(errno));
+        exit(1);
+    }
+    buf->data = temp;
+    buf->data[buf->len] = '\0';
+    buf->cap = capacity;
+}
+
+/**
+ * Appends len bytes to the buffer, keeping it null-terminated.
+ *
+ * Note: Calls exit(1) on allocation failure
+ */
+void buffer_append(struct buffer *buf, const char *data, size_t len) {
+    buffer_reserve(buf, len);
+    memcpy(buf->data + buf->len, data, len);
+    buf->len += len;
+    buf->data[buf->len] = '\0';
+}
+
+/**
+ * Hands the buffer's null-terminated string to the caller, who must free()
+ * it, and resets the buffer to empty.
+ *
+ * Note: Calls exit(1) on allocation failure
+ */
+char *buffer_release(struct buffer *buf) {
+    buffer_reserve(buf, 0);
+    char *data = buf->data;
+    buffer_init(buf);
+    return data;
+}
+
+/**
+ * Frees the buffer's storage. Safe to call on an empty buffer.
+ */
+void buffer_free(struct buffer *buf) {
+    free(buf->data);
+    buffer_init(buf);
+}
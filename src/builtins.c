@@ -0,0 +1,190 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include "shell.h"
+
+static int builtin_cd(char **argv);
+static int builtin_exit(char **argv);
+static int builtin_pwd(char **argv);
+static int builtin_echo(char **argv);
+static int builtin_enable(char **argv);
+static struct builtin *lookup_builtin(const char *name);
+
+// Builtin table, searched linearly by find_builtin(). Only the flags change
+// at runtime, through enable.
+static struct builtin builtins[] = {
+    { "cd",            builtin_cd,            0 },
+    { "exit",          builtin_exit,          0 },
+    { "pwd",           builtin_pwd,           BUILTIN_SUBST_SAFE },
+    { "echo",          builtin_echo,          BUILTIN_SUBST_SAFE },
+    { "enable",        builtin_enable,        0 },
+    { "wc",            builtin_wc,            BUILTIN_FORKED },
+    { "head",          builtin_head,          BUILTIN_FORKED },
+    { "tail",          builtin_tail,          BUILTIN_FORKED },
+    { "grep",          builtin_grep,          BUILTIN_FORKED },
+    { "batch",         builtin_batch,         BUILTIN_FORKED | BUILTIN_LAZY_ARGS },
+    { "read",          builtin_read,          0 },
+    { "mapfile",       builtin_mapfile,       0 },
+    { "readarray",     builtin_mapfile,       0 },
+    { "source",        builtin_source,        0 },
+    { ".",             builtin_source,        0 },
+    { "cached-source", builtin_cached_source, 0 },
+    { "history",       builtin_history,       0 },
+};
+
+/**
+ * Looks up an enabled builtin by command name.
+ *
+ * Note: Returns NULL if name isn't a builtin, is disabled (or is NULL).
+ */
+const struct builtin *find_builtin(const char *name) {
+    struct builtin *b = lookup_builtin(name);
+    if (b == NULL || (b->flags & BUILTIN_DISABLED)) return NULL;
+    return b;
+}
+
+/**
+ * Looks up a builtin by command name, enabled or not.
+ */
+static struct builtin *lookup_builtin(const char *name) {
+    if (name == NULL) return NULL;
+    for (size_t i = 0; i < sizeof(builtins) / sizeof(builtins[0]); i++) {
+        if (strcmp(builtins[i].name, name) == 0) {
+            return &builtins[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Built-in: cd <directory>
+ */
+static int builtin_cd(char **argv) {
+    if (argv[1] == NULL) {
+        fprintf(stderr, "cd: missing operand\n");
+        fprintf(stderr, "Usage: cd <directory>\n");
+        return 1;
+    }
+    if (cd(argv[1]) < 0) {
+        fprintf(stderr, "cd: cannot change directory to '%s': %s\n", argv[1], strerror(errno));
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Built-in: exit [status]
+ *
+ * Only flags the request, the main loop does the actual exiting so it can
+ * clean up. Without an argument, the last command's status is used.
+ */
+static int builtin_exit(char **argv) {
+    exit_status = last_status;
+    if (argv[1] != NULL) {
+        char *end;
+        long value = strtol(argv[1], &end, 10);
+        if (*end != '\0' || end == argv[1]) {
+            fprintf(stderr, "exit: numeric argument required: '%s'\n", argv[1]);
+            value = 2;
+        }
+        exit_status = (int) (value & 0xff);
+    }
+    exit_requested = 1;
+    return exit_status;
+}
+
+/**
+ * Built-in: pwd
+ *
+ * Prints the logical current directory, $PWD, see cwd_get().
+ */
+static int builtin_pwd(char **argv) {
+    (void) argv;
+    const char *cwd = cwd_get();
+    if (cwd == NULL) {
+        fprintf(stderr, "pwd: unable to determine current directory: %s\n", strerror(errno));
+        return 1;
+    }
+    printf("%s\n", cwd);
+    return 0;
+}
+
+/**
+ * Built-in: echo [-n] [args...]
+ */
+static int builtin_echo(char **argv) {
+    int newline = 1;
+    int i = 1;
+
+    if (argv[i] != NULL && strcmp(argv[i], "-n") == 0) {
+        newline = 0;
+        i++;
+    }
+    for (; argv[i] != NULL; i++) {
+        fputs(argv[i], stdout);
+        if (argv[i + 1] != NULL) putchar(' ');
+    }
+    if (newline) putchar('\n');
+    return 0;
+}
+
+/**
+ * Built-in: enable [-n] [names...]
+ *
+ * Turns builtins on, or off with -n so the program of the same name runs
+ * instead (e.g. enable -n grep). Without names, lists the enabled ones.
+ */
+static int builtin_enable(char **argv) {
+    int disable = 0;
+    int i = 1;
+
+    if (argv[i] != NULL && strcmp(argv[i], "-n") == 0) {
+        disable = 1;
+        i++;
+    }
+    if (argv[i] == NULL) {
+        for (size_t j = 0; j < sizeof(builtins) / sizeof(builtins[0]); j++) {
+            int off = (builtins[j].flags & BUILTIN_DISABLED) != 0;
+            if (off == disable) {
+                printf("enable %s%s\n", disable ? "-n " : "", builtins[j].name);
+            }
+        }
+        return 0;
+    }
+
+    int status = 0;
+    for (; argv[i] != NULL; i++) {
+        if (set_builtin_enabled(argv[i], !disable) < 0) {
+            fprintf(stderr, "enable: %s: not a shell builtin\n", argv[i]);
+            status = 1;
+        }
+    }
+    return status;
+}
+
+/**
+ * Turns a builtin on or off, like enable and enable -n.
+ *
+ * Note: Returns 0 on success, -1 if name isn't a builtin
+ */
+int set_builtin_enabled(const char *name, int enabled) {
+    struct builtin *b = lookup_builtin(name);
+    if (b == NULL) return -1;
+    if (enabled) {
+        b->flags &= ~BUILTIN_DISABLED;
+    } else {
+        b->flags |= BUILTIN_DISABLED;
+    }
+    return 0;
+}
+
+/**
+ * Calls fn with the name of every builtin turned off with enable -n.
+ */
+void for_each_disabled_builtin(void (*fn)(const char *name, void *ctx), void *ctx) {
+    for (size_t i = 0; i < sizeof(builtins) / sizeof(builtins[0]); i++) {
+        if (builtins[i].flags & BUILTIN_DISABLED) fn(builtins[i].name, ctx);
+    }
+}
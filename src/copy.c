@@ -0,0 +1,164 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include "shell.h"
+
+#define COPY_CHUNK (1 << 30)
+#define COPY_BUF_SIZE 65536
+
+static int copy_splice(int in, off_t *in_off, int out);
+static int copy_rw(int in, off_t *in_off, int out);
+
+/**
+ * Copies everything from in to out without a userspace buffer wherever the
+ * kernel allows it. Regular files (memfds included) try copy_file_range(2),
+ * which can share extents on the same filesystem, then sendfile(2). Other
+ * inputs, or files those refuse, go through splice(2), and read/write is the
+ * last resort.
+ *
+ * in_off is the position to read from in, advanced as data is copied, or
+ * NULL to use (and consume) in's own file position. out is written at its
+ * current position; an O_APPEND out, which all three syscalls refuse, goes
+ * straight to read/write.
+ *
+ * Note: Returns 0 on success, -1 w/ errno set on failure
+ */
+int copy_fd(int in, off_t *in_off, int out) {
+    struct stat st;
+    if (fstat(in, &st) == -1) return -1;
+
+    int out_flags = fcntl(out, F_GETFL);
+    if (out_flags != -1 && (out_flags & O_APPEND)) return copy_rw(in, in_off, out);
+
+    if (S_ISREG(st.st_mode)) {
+        while (1) {
+            ssize_t n = copy_file_range(in, in_off, out, NULL, COPY_CHUNK, 0);
+            if (n > 0) continue;
+            if (n == 0) return 0;
+            if (errno == EINTR) continue;
+            if (errno != EXDEV && errno != EINVAL && errno != ENOSYS &&
+                errno != EOPNOTSUPP && errno != EBADF) return -1;
+            break;
+        }
+
+        while (1) {
+            ssize_t n = sendfile(out, in, in_off, COPY_CHUNK);
+            if (n > 0) continue;
+            if (n == 0) return 0;
+            if (errno == EINTR) continue;
+            if (errno != EINVAL && errno != ENOSYS) return -1;
+            break;
+        }
+    }
+
+    return copy_splice(in, in_off, out);
+}
+
+/**
+ * splice(2) copy: a pipe input is moved straight to out, anything else is
+ * moved through a private pipe. Falls back to copy_rw() when either side
+ * doesn't support splicing; if that's out, found only once data is in the
+ * private pipe, the pipe is drained with read/write first.
+ */
+static int copy_splice(int in, off_t *in_off, int out) {
+    struct stat st;
+    if (fstat(in, &st) == 0 && S_ISFIFO(st.st_mode)) {
+        while (1) {
+            ssize_t n = splice(in, NULL, out, NULL, COPY_CHUNK, SPLICE_F_MOVE);
+            if (n > 0) continue;
+            if (n == 0) return 0;
+            if (errno == EINTR) continue;
+            if (errno != EINVAL) return -1;
+            return copy_rw(in, NULL, out);
+        }
+    }
+
+    int p[2];
+    if (pipe2(p, O_CLOEXEC) == -1) return -1;
+
+    int status = 0;
+    int started = 0;
+    while (1) {
+        loff_t off = in_off ? *in_off : 0;
+        ssize_t n = splice(in, in_off ? &off : NULL, p[1], NULL, COPY_CHUNK, SPLICE_F_MOVE);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && errno == EINVAL && !started) {
+            // Nothing moved yet, so plain read/write can take over cleanly
+            close(p[0]);
+            close(p[1]);
+            return copy_rw(in, in_off, out);
+        }
+        if (n <= 0) {
+            status = n < 0 ? -1 : 0;
+            break;
+        }
+        if (in_off) *in_off = off;
+        started = 1;
+
+        while (n > 0) {
+            ssize_t m = splice(p[0], NULL, out, NULL, n, SPLICE_F_MOVE);
+            if (m < 0 && errno == EINTR) continue;
+            if (m < 0 && errno == EINVAL) {
+                close(p[1]);
+                status = copy_rw(p[0], NULL, out) < 0 ? -1 : copy_rw(in, in_off, out);
+                int saved_errno = errno;
+                close(p[0]);
+                errno = saved_errno;
+                return status;
+            }
+            if (m <= 0) {
+                status = -1;
+                break;
+            }
+            n -= m;
+        }
+        if (status < 0) break;
+    }
+
+    int saved_errno = errno;
+    close(p[0]);
+    close(p[1]);
+    errno = saved_errno;
+    return status;
+}
+
+/**
+ * Plain read/write copy, for fds none of the kernel copy paths accept.
+ */
+static int copy_rw(int in, off_t *in_off, int out) {
+    char *buf = malloc(COPY_BUF_SIZE);
+    if (buf == NULL) return -1;
+
+    int status = 0;
+    while (1) {
+        ssize_t n = in_off ? pread(in, buf, COPY_BUF_SIZE, *in_off) : read(in, buf, COPY_BUF_SIZE);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            status = n < 0 ? -1 : 0;
+            break;
+        }
+        if (in_off) *in_off += n;
+
+        for (ssize_t off = 0; off < n; ) {
+            ssize_t w = write(out, buf + off, n - off);
+            if (w < 0 && errno == EINTR) continue;
+            if (w < 0) {
+                status = -1;
+                break;
+            }
+            off += w;
+        }
+        if (status < 0) break;
+    }
+
+    int saved_errno = errno;
+    free(buf);
+    errno = saved_errno;
+    return status;
+}
@@ -0,0 +1,171 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include "shell.h"
+
+// Logical working directory, the path cd took to get there (symlinks kept)
+static struct buffer logical;
+static dev_t logical_dev;
+static ino_t logical_ino;
+static int known = 0;
+static unsigned long generation = 0;    // Bumped whenever logical changes
+
+static int set_logical(const char *path);
+static int refresh(void);
+static void normalize(struct buffer *path);
+
+/**
+ * Returns the current directory, as $PWD holds it: the logical path cd
+ * built, so symlinks stay as typed. Checking it costs one stat(), which
+ * is compared with the directory the path led to when it was set; only
+ * when that no longer matches (the directory was renamed, removed or
+ * replaced) is the path worked out again with getcwd(). On first use an
+ * inherited $PWD is taken if it leads to the current directory.
+ *
+ * Note: Returns a string valid until the next cd, or NULL w/ errno set if
+ * the current directory can't be named (e.g. it was removed)
+ */
+const char *cwd_get(void) {
+    struct stat st;
+    if (!known) {
+        const char *pwd = getenv("PWD");
+        struct stat dot;
+        known = 1;
+        if (pwd != NULL && pwd[0] == '/' && stat(pwd, &st) == 0 && stat(".", &dot) == 0 &&
+            st.st_dev == dot.st_dev && st.st_ino == dot.st_ino) {
+            buffer_append(&logical, pwd, strlen(pwd));
+            generation++;
+            logical_dev = st.st_dev;
+            logical_ino = st.st_ino;
+            return logical.data;
+        }
+        return refresh() == 0 ? logical.data : NULL;
+    }
+
+    if (logical.data != NULL && stat(logical.data, &st) == 0 &&
+        st.st_dev == logical_dev && st.st_ino == logical_ino) {
+        return logical.data;
+    }
+    return refresh() == 0 ? logical.data : NULL;
+}
+
+/**
+ * Returns a number that changes whenever the path cwd_get() returns does,
+ * so callers can tell without comparing strings.
+ */
+unsigned long cwd_generation(void) {
+    return generation;
+}
+
+/**
+ * Built-in change directory function. path is followed logically, like
+ * cd -L in bash: "dir/.." goes back to where the path started, not to the
+ * parent of a symlink's target. If that path doesn't work, path is tried
+ * as is. $PWD and $OLDPWD are updated on success.
+ *
+ * Note: Returns 0 on success, -1 on failure w/ errno set
+ */
+int cd(char *path) {
+    const char *old = cwd_get();
+    struct buffer target;
+    buffer_init(&target);
+    if (path[0] != '/' && old != NULL) {
+        buffer_append(&target, old, strlen(old));
+        buffer_append(&target, "/", 1);
+    }
+    buffer_append(&target, path, strlen(path));
+    normalize(&target);
+
+    int status = 0;
+    if (chdir(target.data) == 0) {
+        if (old != NULL) setenv("OLDPWD", old, 1);
+        if (set_logical(target.data) < 0) refresh();
+    } else if (chdir(path) == 0) {
+        if (old != NULL) setenv("OLDPWD", old, 1);
+        refresh();
+    } else {
+        status = -1;
+    }
+    buffer_free(&target);
+    return status;
+}
+
+/**
+ * Makes path, which must lead to the current directory, the logical one.
+ *
+ * Note: Returns 0 on success, -1 if path can't be stat'd
+ */
+static int set_logical(const char *path) {
+    struct stat st;
+    if (stat(path, &st) == -1) return -1;
+
+    // path may point into logical itself
+    struct buffer copy;
+    buffer_init(&copy);
+    buffer_append(&copy, path, strlen(path));
+    buffer_free(&logical);
+    logical = copy;
+    generation++;
+    logical_dev = st.st_dev;
+    logical_ino = st.st_ino;
+    setenv("PWD", logical.data, 1);
+    return 0;
+}
+
+/**
+ * Works out the current directory's physical path with getcwd(), in a
+ * buffer grown until it fits, and makes it the logical one.
+ *
+ * Note: Returns 0 on success, -1 w/ errno set if getcwd() fails
+ */
+static int refresh(void) {
+    struct buffer path;
+    buffer_init(&path);
+    buffer_reserve(&path, INIT_BUFFER_CAP);
+    while (getcwd(path.data, path.cap) == NULL) {
+        if (errno != ERANGE) {
+            int saved = errno;
+            buffer_free(&path);
+            errno = saved;
+            return -1;
+        }
+        buffer_reserve(&path, path.cap);
+    }
+    int status = set_logical(path.data);
+    buffer_free(&path);
+    return status;
+}
+
+/**
+ * Removes ".", ".." and repeated slashes from an absolute path in place,
+ * lexically. A ".." at the root stays at the root.
+ */
+static void normalize(struct buffer *path) {
+    if (path->data[0] != '/') return;
+
+    char *in = path->data;
+    char *out = path->data;     // Output never runs ahead of input
+    while (*in != '\0') {
+        while (*in == '/') in++;
+        if (*in == '\0') break;
+        char *end = strchrnul(in, '/');
+        size_t len = end - in;
+        if (len == 1 && in[0] == '.') {
+            // Nothing
+        } else if (len == 2 && in[0] == '.' && in[1] == '.') {
+            while (out > path->data && *--out != '/');
+        } else {
+            *out++ = '/';
+            memmove(out, in, len);
+            out += len;
+        }
+        in = end;
+    }
+    if (out == path->data) *out++ = '/';
+    *out = '\0';
+    path->len = out - path->data;
+}
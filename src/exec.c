@@ -0,0 +1,389 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "shell.h"
+
+static int run_builtin(const struct builtin *b, struct stage *st);
+static int capture_builtin(const struct builtin *b, struct stage *st, struct buffer *out);
+static int capture_pipeline(struct pipeline *pl, struct buffer *out);
+static int capture_redirect_only(struct redirect_info *redir, struct buffer *out);
+static void track_pid(struct pipeline *pl, pid_t pid);
+
+/**
+ * Runs an expanded pipeline and returns the exit status of its last stage.
+ * A lone builtin runs in the shell process so it can change shell state,
+ * and so does a lone command made only of redirections. Everything else,
+ * streaming builtins included, runs in forked children.
+ */
+int execute_pipeline(struct pipeline *pl) {
+    struct stage *st = &pl->stages[0];
+    if (pl->count == 1 && st->command[0] == NULL) {
+        return redirect_only(&st->redir);
+    }
+
+    const struct builtin *b = find_builtin(st->command[0]);
+    if (pl->count == 1 && b != NULL && !(b->flags & BUILTIN_FORKED)) {
+        return run_builtin(b, st);
+    }
+
+    if (launch_pipeline(pl, -1, -1) < 0) {
+        wait_pipeline(pl);
+        return 1;
+    }
+    return wait_pipeline(pl);
+}
+
+/**
+ * Replaces the shell with a pipeline's only command, as the last thing
+ * `bshell -c` does, so no fork or wait is spent on it. Returns without
+ * doing anything if there are several stages or the output fans out to
+ * several files, which need the shell around.
+ *
+ * Note: Doesn't return if the command ran
+ */
+void exec_pipeline(struct pipeline *pl) {
+    struct stage *st = &pl->stages[0];
+    if (pl->count != 1 || needs_fanout(&st->redir, -1)) return;
+
+    fflush(stdout);
+    exec_child(st);
+}
+
+/**
+ * Forks every stage of a pipeline, connecting each stage's stdout to the
+ * next one's stdin. The first stage reads in_fd and the last writes out_fd
+ * when those aren't -1, otherwise they inherit the shell's. Stages with
+ * several outputs (or an output and a pipe) get a fan-out helper.
+ *
+ * Started pids are recorded in pl for wait_pipeline(), which must be called
+ * even when this fails part way through.
+ *
+ * Note: Returns 0 on success, -1 w/ message if a pipe or fork failed
+ */
+int launch_pipeline(struct pipeline *pl, int in_fd, int out_fd) {
+    pl->pids = malloc(2 * pl->count * sizeof(pid_t));
+    pl->pid_count = 0;
+    pl->last_pid = -1;
+    if (pl->pids == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed for pipeline: %s\n", strerror(errno));
+        exit(1);
+    }
+
+    int prev_read = in_fd;
+    for (int i = 0; i < pl->count; i++) {
+        struct stage *st = &pl->stages[i];
+        int next[2] = { -1, -1 };
+
+        if (i < pl->count - 1 && pipe2(next, O_CLOEXEC) == -1) {
+            fprintf(stderr, "Error: Failed to create pipe: %s\n", strerror(errno));
+            if (prev_read != in_fd) close(prev_read);
+            return -1;
+        }
+        int stage_out = (i < pl->count - 1) ? next[1] : out_fd;
+
+        // zsh-style multios: files and the next stage all get the output
+        if (needs_fanout(&st->redir, next[1])) {
+            pid_t helper = start_fanout(&st->redir, next[1]);
+            if (helper < 0) {
+                if (prev_read != in_fd) close(prev_read);
+                if (next[0] != -1) {
+                    close(next[0]);
+                    close(next[1]);
+                }
+                return -1;
+            }
+            track_pid(pl, helper);
+        }
+
+        fflush(stdout);
+        pid_t child_pid = fork();
+
+        if (child_pid < 0) {
+            fprintf(stderr, "Error: Failed to create child process: %s\n", strerror(errno));
+            if (prev_read != in_fd) close(prev_read);
+            if (next[0] != -1) {
+                close(next[0]);
+                close(next[1]);
+            }
+            return -1;
+        } else if (child_pid == 0) {
+            // Child path, own redirections are applied later and win
+            signal(SIGINT, SIG_DFL);
+            if (prev_read != -1 && dup2(prev_read, STDIN_FILENO) == -1) exit(1);
+            if (stage_out != -1 && dup2(stage_out, STDOUT_FILENO) == -1) exit(1);
+            if (next[0] != -1) close(next[0]);
+            exec_child(st);
+        }
+
+        // Parent path
+        track_pid(pl, child_pid);
+        pl->last_pid = child_pid;
+        close_redirects(&st->redir);
+        if (prev_read != in_fd) close(prev_read);
+        if (next[1] != -1) close(next[1]);
+        prev_read = next[0];
+    }
+    return 0;
+}
+
+/**
+ * Waits for every process launch_pipeline() started.
+ *
+ * Note: Returns the last stage's exit status, 1 if it never started.
+ */
+int wait_pipeline(struct pipeline *pl) {
+    int status = 1;
+    for (int i = 0; i < pl->pid_count; i++) {
+        int s = wait_status(pl->pids[i]);
+        if (pl->pids[i] == pl->last_pid) status = s;
+    }
+    pl->pid_count = 0;
+    return status;
+}
+
+/**
+ * Runs the command line inside $(...) or backticks and appends its stdout
+ * to out. A substitution-safe builtin on its own runs in-process with
+ * stdout pointed at a memfd, and so does a bare $(< file). Anything else
+ * runs as a forked pipeline writing into a pipe.
+ *
+ * Note: Returns the command's exit status.
+ */
+int capture_output(const char *cmdline, struct buffer *out) {
+    char *line = strdup(cmdline);
+    if (line == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed while copying substitution: %s\n", strerror(errno));
+        exit(1);
+    }
+
+    struct pipeline pl;
+    int status = 0;
+    size_t mark = procsubst_mark();
+    if (parse_pipeline(line, &pl) < 0 || expand_pipeline(&pl) < 0) {
+        status = 1;
+    } else if (pl.count == 1 && pl.stages[0].command[0] == NULL) {
+        status = capture_redirect_only(&pl.stages[0].redir, out);
+    } else {
+        const struct builtin *b = find_builtin(pl.stages[0].command[0]);
+        if (pl.count == 1 && b != NULL && (b->flags & BUILTIN_SUBST_SAFE)) {
+            status = capture_builtin(b, &pl.stages[0], out);
+        } else {
+            status = capture_pipeline(&pl, out);
+        }
+    }
+
+    free(line);
+    free_pipeline(&pl);
+    procsubst_release(mark);
+    return status;
+}
+
+/**
+ * Turns a forked child into a pipeline stage: applies its redirections,
+ * hands down its process substitution fds, then runs a builtin and exits
+ * with its status or execs the program.
+ *
+ * Note: Never returns, calls exit(1) on redirect or exec failure
+ */
+void exec_child(struct stage *st) {
+    // Redirection-only stage, or one expansion left empty like $(true) | cat
+    char **command = st->command;
+    if (command[0] == NULL) exit(redirect_only(&st->redir));
+
+    if (apply_redirects(&st->redir) < 0) exit(1);
+    procsubst_inherit(st->procsubst_begin, st->procsubst_end);
+
+    const struct builtin *b = find_builtin(command[0]);
+    if (b != NULL) {
+        command_expanded_at = st->expanded_at;
+        command_deferred = st->deferred;
+        exit(b->fn(command));
+    }
+    execvp(command[0], command);
+    fprintf(stderr, "Error: Command not found or failed to execute '%s': %s\n", command[0], strerror(errno));
+    exit(1);
+}
+
+/**
+ * Runs a builtin in the shell process, applying its redirections around the
+ * call and restoring the shell's own fds afterwards. Several outputs are
+ * fanned out by a helper, which is waited for so the files are complete
+ * when the builtin returns.
+ */
+static int run_builtin(const struct builtin *b, struct stage *st) {
+    struct redirect_info *redir = &st->redir;
+    pid_t helper = -1;
+
+    if (needs_fanout(redir, -1)) {
+        helper = start_fanout(redir, -1);
+        if (helper < 0) return 1;
+    }
+
+    int saved[3];
+    int status = 1;
+    if (save_fds(redir, saved) == 0) {
+        if (apply_redirects(redir) == 0) {
+            status = b->fn(st->command);
+        }
+        restore_fds(saved);
+    }
+
+    if (helper > 0) {
+        close_redirects(redir);
+        wait_status(helper);
+    }
+    return status;
+}
+
+/**
+ * Captures a builtin's output without forking: stdout is swapped for a
+ * memfd while the builtin runs, then the memfd is read back into out.
+ * SIGINT is held off meanwhile so a Ctrl-C can't jump back to the prompt
+ * with stdout still pointing at the memfd.
+ */
+static int capture_builtin(const struct builtin *b, struct stage *st, struct buffer *out) {
+    int mfd = memfd_create("bshell-subst", MFD_CLOEXEC);
+    if (mfd == -1) {
+        fprintf(stderr, "Error: Failed to create substitution buffer: %s\n", strerror(errno));
+        return 1;
+    }
+
+    sigset_t block, old;
+    sigemptyset(&block);
+    sigaddset(&block, SIGINT);
+    sigprocmask(SIG_BLOCK, &block, &old);
+
+    fflush(stdout);
+    int saved_out = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 10);
+    if (saved_out == -1 || dup2(mfd, STDOUT_FILENO) == -1) {
+        fprintf(stderr, "Error: Failed to redirect substitution output: %s\n", strerror(errno));
+        if (saved_out != -1) close(saved_out);
+        close(mfd);
+        sigprocmask(SIG_SETMASK, &old, NULL);
+        return 1;
+    }
+
+    int status = run_builtin(b, st);
+
+    fflush(stdout);
+    dup2(saved_out, STDOUT_FILENO);
+    close(saved_out);
+    sigprocmask(SIG_SETMASK, &old, NULL);
+
+    off_t size = lseek(mfd, 0, SEEK_END);
+    if (size > 0) {
+        buffer_reserve(out, size);
+        ssize_t n = pread(mfd, out->data + out->len, size, 0);
+        if (n > 0) {
+            out->len += n;
+            out->data[out->len] = '\0';
+        }
+    }
+    close(mfd);
+    return status;
+}
+
+/**
+ * Captures a pipeline's output by launching it with stdout on a pipe and
+ * reading the pipe into out until EOF. Builtins that would change shell
+ * state (cd, exit) land here too, so like a subshell they only affect the
+ * child.
+ */
+static int capture_pipeline(struct pipeline *pl, struct buffer *out) {
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) == -1) {
+        fprintf(stderr, "Error: Failed to create substitution pipe: %s\n", strerror(errno));
+        return 1;
+    }
+
+    int launched = launch_pipeline(pl, -1, fds[1]);
+    close(fds[1]);
+    while (launched == 0) {
+        buffer_reserve(out, INIT_BUFFER_CAP);
+        ssize_t n = read(fds[0], out->data + out->len, out->cap - out->len - 1);
+        if (n == 0) break;
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "Error: Failed to read substitution output: %s\n", strerror(errno));
+            break;
+        }
+        out->len += n;
+        out->data[out->len] = '\0';
+    }
+    close(fds[0]);
+
+    int status = wait_pipeline(pl);
+    return launched == 0 ? status : 1;
+}
+
+/**
+ * Captures a redirection-only command. $(< file) reads the file straight
+ * into out like bash does, anything else just runs redirect_only().
+ */
+static int capture_redirect_only(struct redirect_info *redir, struct buffer *out) {
+    if (redir->output_count > 0 || redir->error_file != NULL ||
+        (redir->input_file == NULL && redir->input_fd == -1)) {
+        return redirect_only(redir);
+    }
+
+    int in = redir->input_fd;
+    if (in == -1) {
+        in = open(redir->input_file, O_RDONLY | O_CLOEXEC);
+        if (in == -1) {
+            fprintf(stderr, "Error: Failed to open input file '%s': %s\n",
+                    redir->input_file, strerror(errno));
+            return 1;
+        }
+    }
+
+    int status = 0;
+    struct stat st;
+    if (fstat(in, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        buffer_reserve(out, st.st_size);
+    }
+    while (1) {
+        buffer_reserve(out, INIT_BUFFER_CAP);
+        ssize_t n = read(in, out->data + out->len, out->cap - out->len - 1);
+        if (n == 0) break;
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "Error: Failed to read input: %s\n", strerror(errno));
+            status = 1;
+            break;
+        }
+        out->len += n;
+        out->data[out->len] = '\0';
+    }
+
+    if (in != redir->input_fd) close(in);
+    return status;
+}
+
+/**
+ * Records a started process so wait_pipeline() reaps it.
+ */
+static void track_pid(struct pipeline *pl, pid_t pid) {
+    pl->pids[pl->pid_count++] = pid;
+}
+
+/**
+ * Waits for a child and converts its wait status into a shell exit status,
+ * 128 + signal number for children killed by a signal.
+ */
+int wait_status(pid_t pid) {
+    int status;
+    while (waitpid(pid, &status, WUNTRACED) == -1) {
+        if (errno != EINTR) return 1;
+    }
+    if (WIFEXITED(status)) return WEXITSTATUS(status);
+    if (WIFSIGNALED(status)) return 128 + WTERMSIG(status);
+    return 1;
+}
@@ -0,0 +1,342 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "shell.h"
+
+#define FIELD_SEPARATORS " \t\n"
+
+static int hasSubstitution(const char *word);
+static int expandWord(const char *word, char ***command, int *count, int *capacity);
+static int substituteWord(const char *word, struct buffer *out);
+static int expandTarget(char **target);
+static int globTarget(char **target);
+static void appendField(char ***command, int *count, int *capacity, const char *field, size_t len);
+
+/**
+ * Expansion phase, run after setup_redirects() and before execution.
+ * Words with {a,b} lists or {x..y} ranges are brace-expanded first, each
+ * result then expanded on its own. Replaces $name, ${name} and $? with
+ * their values and $(...) and `...` with the output of the command inside,
+ * minus trailing newlines, then splits the result into fields on
+ * whitespace. <(...) and >(...) start their command
+ * on a pipe and become its /dev/fd path. Fields with *, ? or [ are globbed
+ * last, kept as is if nothing matches. Redirect targets are expanded too
+ * and must stay a single word. *expanded_at is set to the index of the
+ * first word an expansion produced (-1 if none), where batch starts
+ * splitting.
+ *
+ * A builtin flagged BUILTIN_LAZY_ARGS gets its words from *expanded_at on
+ * as typed, with *deferred set, so it can stream their brace and glob
+ * expansions instead of holding them all. Words with substitutions need
+ * the shell itself, so if any are among them everything expands here.
+ *
+ * Note:
+ * - Replaces *command with a new array, freeing the old one
+ * - Returns 0 on success, -1 on a syntax error or ambiguous redirect
+ * - Calls exit(1) on allocation failure
+ */
+int expandCommand(char ***command, struct redirect_info *redir, int *expanded_at, int *deferred) {
+    int capacity = INIT_CMD_CAP;
+    int count = 0;
+    char **expanded = malloc(capacity * sizeof(char *));
+    int status = 0;
+
+    if (expanded == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed for command array: %s\n", strerror(errno));
+        exit(1);
+    }
+
+    const struct builtin *b = find_builtin((*command)[0]);
+    int lazy = b != NULL && (b->flags & BUILTIN_LAZY_ARGS);
+
+    *expanded_at = -1;
+    *deferred = 0;
+    for (int i = 0; status == 0 && (*command)[i] != NULL; i++) {
+        char *word = (*command)[i];
+        struct brace_gen *gen = brace_open(word);
+        if (*expanded_at == -1 && (gen != NULL || hasSubstitution(word) || has_glob(word))) {
+            *expanded_at = count;
+            *deferred = lazy;
+            for (int j = i; *deferred && (*command)[j] != NULL; j++) {
+                if (hasSubstitution((*command)[j])) *deferred = 0;
+            }
+        }
+
+        if (*deferred) {
+            brace_close(gen);
+            if (appendToken(&expanded, &count, &capacity, word, strlen(word)) < 0) exit(1);
+            continue;
+        }
+        if (gen == NULL) {
+            status = expandWord(word, &expanded, &count, &capacity);
+            continue;
+        }
+
+        // Empty brace results vanish, like empty substitutions
+        struct buffer item;
+        buffer_init(&item);
+        while (status == 0 && brace_next(gen, &item)) {
+            if (item.len > 0) status = expandWord(item.data, &expanded, &count, &capacity);
+        }
+        buffer_free(&item);
+        brace_close(gen);
+    }
+    expanded[count] = NULL;
+
+    if (status == 0) {
+        if (expandTarget(&redir->input_file) < 0 || expandTarget(&redir->error_file) < 0) {
+            status = -1;
+        } else if (redir->input_file != NULL) {
+            // What an rc reads with < is part of its snapshot
+            snapshot_depend(redir->input_file);
+        }
+        for (int i = 0; status == 0 && i < redir->output_count; i++) {
+            if (expandTarget(&redir->outputs[i].file) < 0) status = -1;
+        }
+    }
+
+    freeCommand(*command);
+    *command = expanded;
+    return status;
+}
+
+/**
+ * Expands one word, already brace-expanded, onto the end of command:
+ * substitutions with field splitting, then globbing.
+ *
+ * Note: Returns 0 on success, -1 if a substitution failed
+ */
+static int expandWord(const char *word, char ***command, int *count, int *capacity) {
+    // Plain words are copied through untouched, or globbed
+    if (!hasSubstitution(word)) {
+        appendField(command, count, capacity, word, strlen(word));
+        return 0;
+    }
+
+    struct buffer result;
+    buffer_init(&result);
+    if (substituteWord(word, &result) < 0) {
+        buffer_free(&result);
+        return -1;
+    }
+
+    // Field splitting, empty results vanish like in other shells
+    char *field = result.data;
+    while (field != NULL && *field != '\0') {
+        field += strspn(field, FIELD_SEPARATORS);
+        size_t len = strcspn(field, FIELD_SEPARATORS);
+        if (len == 0) break;
+        appendField(command, count, capacity, field, len);
+        field += len;
+    }
+    buffer_free(&result);
+    return 0;
+}
+
+/**
+ * Expands every stage of a pipeline in order, recording which process
+ * substitutions each stage opened so only its own child inherits them.
+ *
+ * Note: Returns 0 on success, -1 if any stage fails to expand
+ */
+int expand_pipeline(struct pipeline *pl) {
+    for (int i = 0; i < pl->count; i++) {
+        struct stage *st = &pl->stages[i];
+        st->procsubst_begin = procsubst_mark();
+        int status = expandCommand(&st->command, &st->redir, &st->expanded_at, &st->deferred);
+        st->procsubst_end = procsubst_mark();
+        if (status < 0) return -1;
+    }
+    return 0;
+}
+
+/**
+ * Returns whether word contains a command or process substitution, or a
+ * variable reference.
+ */
+static int hasSubstitution(const char *word) {
+    if (strchr(word, '`') != NULL || strstr(word, "<(") != NULL || strstr(word, ">(") != NULL) {
+        return 1;
+    }
+    for (const char *p = strchr(word, '$'); p != NULL; p = strchr(p + 1, '$')) {
+        if (p[1] == '(' || var_ref_length(p) > 0) return 1;
+    }
+    return 0;
+}
+
+/**
+ * Copies word into out with every variable reference replaced by its
+ * value, every command substitution replaced by the command's output,
+ * trailing newlines stripped, and every process substitution replaced by
+ * its /dev/fd path. A command substitution sets last_status, so $? after
+ * a line that is only substitutions is the last one's.
+ *
+ * Note: Returns 0 on success, -1 if a substitution is unterminated or its
+ * process couldn't be started.
+ */
+static int substituteWord(const char *word, struct buffer *out) {
+    const char *p = word;
+
+    while (*p != '\0') {
+        const char *body;
+        const char *end;
+        size_t ref_len = var_ref_length(p);
+
+        if (ref_len > 0) {
+            expand_var_ref(p, ref_len, out);
+            p += ref_len;
+            continue;
+        } else if ((p[0] == '$' || p[0] == '<' || p[0] == '>') && p[1] == '(') {
+            body = p + 2;
+            end = substitutionEnd(body);
+        } else if (*p == '`') {
+            body = p + 1;
+            end = strchr(body, '`');
+        } else {
+            buffer_append(out, p, 1);
+            p++;
+            continue;
+        }
+
+        if (end == NULL) {
+            fprintf(stderr, "Error: Unterminated %s substitution in '%s'\n",
+                    *p == '$' || *p == '`' ? "command" : "process", word);
+            return -1;
+        }
+
+        char *cmdline = strndup(body, end - body);
+        if (cmdline == NULL) {
+            fprintf(stderr, "Error: Memory allocation failed while copying substitution: %s\n", strerror(errno));
+            exit(1);
+        }
+
+        if (*p == '<' || *p == '>') {
+            int status = procsubst_open(cmdline, *p == '>', out);
+            free(cmdline);
+            if (status < 0) return -1;
+            p = end + 1;
+            continue;
+        }
+
+        size_t start = out->len;
+        last_status = capture_output(cmdline, out);
+        free(cmdline);
+
+        while (out->len > start && out->data[out->len - 1] == '\n') {
+            out->data[--out->len] = '\0';
+        }
+        p = end + 1;
+    }
+    return 0;
+}
+
+/**
+ * Expands the substitutions in a single word without field splitting, as
+ * used for here-strings and unquoted here-document bodies.
+ *
+ * Note:
+ * - Returns a malloc'd string, or NULL if a substitution is unterminated
+ * - Calls exit(1) on allocation failure
+ */
+char *expandString(const char *word) {
+    struct buffer result;
+    buffer_init(&result);
+    if (substituteWord(word, &result) < 0) {
+        buffer_free(&result);
+        return NULL;
+    }
+    return buffer_release(&result);
+}
+
+/**
+ * Appends one field to the expanded command, replaced by the paths it
+ * matches if it's a glob pattern that matches anything.
+ *
+ * Note: Calls exit(1) on allocation failure
+ */
+static void appendField(char ***command, int *count, int *capacity, const char *field, size_t len) {
+    if (memchr(field, '*', len) || memchr(field, '?', len) || memchr(field, '[', len)) {
+        char *pattern = strndup(field, len);
+        if (pattern == NULL) {
+            fprintf(stderr, "Error: Memory allocation failed while expanding '%s': %s\n", field, strerror(errno));
+            exit(1);
+        }
+        int found = glob_word(pattern, command, count, capacity);
+        free(pattern);
+        if (found > 0) return;
+    }
+    if (appendToken(command, count, capacity, field, len) < 0) exit(1);
+}
+
+/**
+ * Expands a redirect target in place. A target that expands to nothing or
+ * to several fields is an error, since it can't name a single file. Glob
+ * patterns are expanded too, when not mixed with substitutions.
+ *
+ * Note: Returns 0 on success (or no target), -1 w/ message otherwise
+ */
+static int expandTarget(char **target) {
+    if (*target == NULL) {
+        return 0;
+    }
+    if (!hasSubstitution(*target)) {
+        return has_glob(*target) ? globTarget(target) : 0;
+    }
+
+    struct buffer result;
+    buffer_init(&result);
+    if (substituteWord(*target, &result) < 0) {
+        buffer_free(&result);
+        return -1;
+    }
+
+    char *field = result.data ? result.data + strspn(result.data, FIELD_SEPARATORS) : NULL;
+    size_t len = field ? strcspn(field, FIELD_SEPARATORS) : 0;
+    if (len == 0 || field[len + strspn(field + len, FIELD_SEPARATORS)] != '\0') {
+        fprintf(stderr, "Error: %s: ambiguous redirect\n", *target);
+        buffer_free(&result);
+        return -1;
+    }
+
+    char *expanded = strndup(field, len);
+    if (expanded == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed while expanding redirect: %s\n", strerror(errno));
+        exit(1);
+    }
+    buffer_free(&result);
+    free(*target);
+    *target = expanded;
+    return 0;
+}
+
+/**
+ * Globs a redirect target in place. No match leaves it as is, one match
+ * replaces it, and several are an ambiguous redirect.
+ *
+ * Note: Returns 0 on success, -1 w/ message if ambiguous
+ */
+static int globTarget(char **target) {
+    int capacity = INIT_CMD_CAP;
+    int count = 0;
+    char **matches = malloc(capacity * sizeof(char *));
+    if (matches == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed while expanding redirect: %s\n", strerror(errno));
+        exit(1);
+    }
+
+    int status = 0;
+    glob_word(*target, &matches, &count, &capacity);
+    matches[count] = NULL;
+    if (count > 1) {
+        fprintf(stderr, "Error: %s: ambiguous redirect\n", *target);
+        status = -1;
+    } else if (count == 1) {
+        free(*target);
+        *target = matches[0];
+        matches[0] = NULL;
+    }
+    freeCommand(matches);
+    return status;
+}
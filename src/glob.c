@@ -0,0 +1,310 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <fnmatch.h>
+#include <sys/stat.h>
+#include "shell.h"
+
+#define GLOB_DENTS_SIZE (256 * 1024)
+
+struct glob_walk {
+    char **components;      // Pattern split on '/', empty ones dropped
+    int component_count;
+    int dirs_only;          // Pattern ended in '/', only directories match
+    struct buffer path;     // Path matched so far, with a trailing '/'
+    char **matches;
+    size_t match_count;
+    size_t match_cap;
+    char *dents;            // getdents64() batch buffer, shared by all levels
+};
+
+static void glob_dir(struct glob_walk *w, int dirfd, int index);
+static void glob_globstar(struct glob_walk *w, int dirfd, int index);
+static void add_match(struct glob_walk *w, const char *name);
+static void add_path(struct glob_walk *w, const char *path);
+static int compare_paths(const void *a, const void *b);
+
+/**
+ * Returns whether word contains glob characters (*, ? or [) and so must
+ * go through glob_word().
+ */
+int has_glob(const char *word) {
+    return strpbrk(word, "*?[") != NULL;
+}
+
+/**
+ * Expands a glob pattern against the filesystem and appends the matching
+ * paths to command in sorted order, like appendToken(). Names starting
+ * with '.' only match a pattern component that starts with '.' too, and
+ * . and .. never do. A ** component matches any depth of directories.
+ *
+ * Directories are read with getdents64(2) in large batches and entries are
+ * matched on name alone. stat() only happens when the entry type is
+ * unknown or a symlink and the walk needs to know if it's a directory,
+ * or to check that a literal last component exists.
+ *
+ * Note:
+ * - Returns the number of matches appended, 0 if none (the caller keeps
+ *   the word as is)
+ * - Calls exit(1) on allocation failure
+ */
+int glob_word(const char *pattern, char ***command, int *count, int *capacity) {
+    struct glob_walk w = { 0 };
+    buffer_init(&w.path);
+
+    char *copy = strdup(pattern);
+    w.components = malloc((strlen(pattern) / 2 + 2) * sizeof(char *));
+    w.dents = malloc(GLOB_DENTS_SIZE);
+    if (copy == NULL || w.components == NULL || w.dents == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed while expanding '%s': %s\n", pattern, strerror(errno));
+        exit(1);
+    }
+
+    size_t len = strlen(copy);
+    w.dirs_only = len > 0 && copy[len - 1] == '/';
+    if (copy[0] == '/') {
+        buffer_append(&w.path, "/", 1);
+    }
+    for (char *saveptr = NULL, *c = strtok_r(copy, "/", &saveptr); c != NULL; c = strtok_r(NULL, "/", &saveptr)) {
+        w.components[w.component_count++] = c;
+    }
+
+    if (w.component_count > 0) {
+        int dirfd = AT_FDCWD;
+        if (copy[0] == '/') {
+            dirfd = open("/", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        }
+        if (dirfd != -1) {
+            glob_dir(&w, dirfd, 0);
+            if (dirfd != AT_FDCWD) close(dirfd);
+        }
+    }
+
+    if (w.match_count > 1) qsort(w.matches, w.match_count, sizeof(char *), compare_paths);
+    for (size_t i = 0; i < w.match_count; i++) {
+        if (appendToken(command, count, capacity, w.matches[i], strlen(w.matches[i])) < 0) exit(1);
+        free(w.matches[i]);
+    }
+
+    int found = (int) w.match_count;
+    free(w.matches);
+    free(w.dents);
+    free(w.components);
+    free(copy);
+    buffer_free(&w.path);
+    return found;
+}
+
+/**
+ * Matches components[index] against the entries of the directory dirfd
+ * (AT_FDCWD for the current one), then descends into matching
+ * directories for the components left.
+ */
+static void glob_dir(struct glob_walk *w, int dirfd, int index) {
+    const char *component = w->components[index];
+    int last = (index == w->component_count - 1);
+    size_t path_len = w->path.len;
+
+    if (strcmp(component, "**") == 0) {
+        glob_globstar(w, dirfd, index);
+        return;
+    }
+
+    // A literal component needs no directory scan, just the one lookup
+    if (!has_glob(component)) {
+        struct stat st;
+        if (last) {
+            if (fstatat(dirfd, component, &st, w->dirs_only ? 0 : AT_SYMLINK_NOFOLLOW) == 0 &&
+                (!w->dirs_only || S_ISDIR(st.st_mode))) {
+                add_match(w, component);
+            }
+            return;
+        }
+        int sub = openat(dirfd, component, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (sub == -1) return;
+        buffer_append(&w->path, component, strlen(component));
+        buffer_append(&w->path, "/", 1);
+        glob_dir(w, sub, index + 1);
+        close(sub);
+        w->path.len = path_len;
+        w->path.data[path_len] = '\0';
+        return;
+    }
+
+    int fd = openat(dirfd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) return;
+
+    // Matching names are collected first, deeper levels reuse the batch buffer
+    struct buffer names;
+    buffer_init(&names);
+    ssize_t n;
+    while ((n = getdents64(fd, w->dents, GLOB_DENTS_SIZE)) > 0) {
+        for (ssize_t off = 0; off < n; ) {
+            struct dirent64 *d = (struct dirent64 *) (w->dents + off);
+            off += d->d_reclen;
+
+            if (!glob_match(component, d->d_name)) continue;
+            if ((!last || w->dirs_only) && !glob_is_dir(fd, d->d_name, d->d_type)) continue;
+            if (last) {
+                add_match(w, d->d_name);
+            } else {
+                buffer_append(&names, d->d_name, strlen(d->d_name) + 1);
+            }
+        }
+    }
+
+    for (size_t off = 0; off < names.len; ) {
+        const char *name = names.data + off;
+        size_t len = strlen(name);
+        off += len + 1;
+
+        int sub = openat(fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (sub == -1) continue;
+        buffer_append(&w->path, name, len);
+        buffer_append(&w->path, "/", 1);
+        glob_dir(w, sub, index + 1);
+        close(sub);
+        w->path.len = path_len;
+        w->path.data[path_len] = '\0';
+    }
+
+    buffer_free(&names);
+    close(fd);
+}
+
+/**
+ * Expands a ** component, which matches any number of directories
+ * (zero included), with the parallel walk_tree(). When at most one
+ * component follows, the walk matches it in every directory on its own,
+ * otherwise it lists the directories and the rest of the pattern is
+ * matched from each.
+ */
+static void glob_globstar(struct glob_walk *w, int dirfd, int index) {
+    size_t path_len = w->path.len;
+    size_t count;
+
+    if (index + 1 >= w->component_count - 1) {
+        // ** alone matches everything below, files and directories alike,
+        // and the directory it starts from when that has a name
+        const char *leaf = "*";
+        if (index + 1 < w->component_count) {
+            leaf = w->components[index + 1];
+        } else if (w->path.len > 0) {
+            add_path(w, w->path.data);
+        }
+        char **paths = walk_tree(dirfd, leaf, w->dirs_only, &count);
+        for (size_t i = 0; i < count; i++) {
+            add_match(w, paths[i]);
+            free(paths[i]);
+        }
+        free(paths);
+        return;
+    }
+
+    char **dirs = walk_tree(dirfd, NULL, 0, &count);
+    for (size_t i = 0; i < count; i++) {
+        if (dirs[i][0] == '\0') {
+            glob_dir(w, dirfd, index + 1);
+        } else {
+            int sub = openat(dirfd, dirs[i], O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if (sub != -1) {
+                buffer_append(&w->path, dirs[i], strlen(dirs[i]));
+                glob_dir(w, sub, index + 1);
+                close(sub);
+                w->path.len = path_len;
+                w->path.data[path_len] = '\0';
+            }
+        }
+        free(dirs[i]);
+    }
+    free(dirs);
+}
+
+/**
+ * Matches one directory entry against one pattern component. The common
+ * shapes *.ext, prefix* and * are compared directly, anything else goes
+ * through fnmatch(3).
+ */
+int glob_match(const char *pattern, const char *name) {
+    if (name[0] == '.') {
+        if (pattern[0] != '.') return 0;
+        if (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')) return 0;
+    }
+
+    size_t plen = strlen(pattern);
+    if (strpbrk(pattern + 1, "*?[") == NULL) {
+        if (pattern[0] == '*') {
+            size_t nlen = strlen(name);
+            return nlen >= plen - 1 && memcmp(name + nlen - (plen - 1), pattern + 1, plen - 1) == 0;
+        }
+    } else if (pattern[plen - 1] == '*' && strcspn(pattern, "*?[") == plen - 1) {
+        return strncmp(name, pattern, plen - 1) == 0;
+    }
+    return fnmatch(pattern, name, 0) == 0;
+}
+
+/**
+ * Returns whether an entry is a directory, trusting d_type and only
+ * falling back to stat() for symlinks and filesystems that leave it
+ * unknown.
+ */
+int glob_is_dir(int dirfd, const char *name, unsigned char type) {
+    if (type == DT_DIR) return 1;
+    if (type != DT_LNK && type != DT_UNKNOWN) return 0;
+
+    struct stat st;
+    return fstatat(dirfd, name, &st, 0) == 0 && S_ISDIR(st.st_mode);
+}
+
+/**
+ * Records the current path plus name as a match.
+ */
+static void add_match(struct glob_walk *w, const char *name) {
+    size_t len = strlen(name);
+    char *match = malloc(w->path.len + len + 2);
+    if (match == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed while expanding glob: %s\n", strerror(errno));
+        exit(1);
+    }
+    memcpy(match, w->path.data ? w->path.data : "", w->path.len);
+    memcpy(match + w->path.len, name, len);
+    if (w->dirs_only) match[w->path.len + len++] = '/';
+    match[w->path.len + len] = '\0';
+    add_path(w, match);
+    free(match);
+}
+
+/**
+ * Records a copy of path as a match, as is.
+ */
+static void add_path(struct glob_walk *w, const char *path) {
+    if (w->match_count >= w->match_cap) {
+        size_t capacity = w->match_cap ? w->match_cap * 2 : INIT_CMD_CAP;
+        char **temp = realloc(w->matches, capacity * sizeof(char *));
+        if (temp == NULL) {
+            fprintf(stderr, "Error: Memory reallocation failed while expanding glob: %s\n", strerror(errno));
+            exit(1);
+        }
+        w->matches = temp;
+        w->match_cap = capacity;
+    }
+
+    char *match = strdup(path);
+    if (match == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed while expanding glob: %s\n", strerror(errno));
+        exit(1);
+    }
+    w->matches[w->match_count++] = match;
+}
+
+/**
+ * qsort() comparator for match paths.
+ */
+static int compare_paths(const void *a, const void *b) {
+    return strcmp(*(char * const *) a, *(char * const *) b);
+}
@@ -0,0 +1,391 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include "shell.h"
+
+#define WALK_MAX_THREADS 16
+#define WALK_DENTS_SIZE (64 * 1024)
+#define INIT_WALK_CAP 64
+
+/*
+ * Recursive ** walk on a pool of threads. Every worker owns a deque of
+ * directories still to scan: it pushes and pops at the tail, so its own
+ * walk goes depth first and keeps few directories open, and idle workers
+ * steal from the head, where the biggest unexplored subtrees sit.
+ *
+ * A directory is opened with openat() relative to its parent's fd, which
+ * stays open (refcounted) until every child has been opened, so paths are
+ * never resolved from the top again.
+ */
+
+struct walk_dir {
+    int fd;
+    atomic_int refs;        // The scan itself plus every queued child
+    char *path;             // Relative to the walk's root, '/' terminated or ""
+};
+
+struct walk_task {
+    struct walk_dir *parent;
+    char *name;             // NULL for the root, scanned as parent itself
+};
+
+struct walk_deque {
+    pthread_mutex_t lock;
+    struct walk_task *tasks;    // Ring buffer, head is stolen from, tail is owned
+    size_t head;
+    size_t count;
+    size_t cap;
+};
+
+struct walk_worker {
+    struct walk_pool *pool;
+    struct walk_deque deque;
+    char **results;
+    size_t result_count;
+    size_t result_cap;
+    char *dents;
+};
+
+struct walk_pool {
+    const char *leaf;       // Pattern matched in every directory, NULL to list directories
+    int dirs_only;
+    struct walk_worker *workers;
+    int worker_count;
+    atomic_size_t pending;  // Tasks queued or being scanned, 0 means done
+    atomic_size_t queued;   // Tasks sitting in some deque
+    atomic_int idle;
+    pthread_mutex_t lock;   // Only guards sleeping on wake
+    pthread_cond_t wake;
+};
+
+static void *walk_worker(void *arg);
+static void walk_scan(struct walk_worker *self, struct walk_task *task);
+static void walk_push(struct walk_worker *self, struct walk_dir *parent, const char *name);
+static int walk_pop(struct walk_deque *dq, struct walk_task *task);
+static int walk_steal(struct walk_pool *pool, struct walk_worker *self, struct walk_task *task);
+static void walk_release(struct walk_dir *dir);
+static void walk_result(struct walk_worker *self, const char *path, const char *name);
+static void *walk_alloc(void *ptr, size_t size);
+
+/**
+ * Walks the tree under dirfd (AT_FDCWD for the current directory) for a
+ * ** glob. With leaf set, returns every entry at any depth whose name
+ * matches it (directories only if dirs_only), as paths relative to dirfd.
+ * With leaf NULL, returns every directory instead, dirfd itself as "" and
+ * the rest with a trailing '/'. Like bash's globstar, hidden directories
+ * are skipped and symlinks to directories are never descended: neither
+ * listed nor searched for leaf, though a symlink's own name can match it.
+ *
+ * Results come back in no particular order, the caller sorts them, so
+ * the output is the same whatever the thread count.
+ *
+ * Note:
+ * - Returns a malloc'd array of malloc'd paths, count in *count
+ * - SIGINT is held off during the walk, the pool can't be abandoned
+ * - Calls exit(1) on allocation failure
+ */
+char **walk_tree(int dirfd, const char *leaf, int dirs_only, size_t *count) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int threads = cpus < 1 ? 1 : (cpus > WALK_MAX_THREADS ? WALK_MAX_THREADS : (int) cpus);
+
+    struct walk_pool pool = {
+        .leaf = leaf,
+        .dirs_only = dirs_only,
+        .worker_count = threads,
+    };
+    atomic_init(&pool.pending, 0);
+    atomic_init(&pool.queued, 0);
+    atomic_init(&pool.idle, 0);
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.wake, NULL);
+    pool.workers = walk_alloc(NULL, threads * sizeof(struct walk_worker));
+    for (int i = 0; i < threads; i++) {
+        struct walk_worker *w = &pool.workers[i];
+        memset(w, 0, sizeof(*w));
+        w->pool = &pool;
+        pthread_mutex_init(&w->deque.lock, NULL);
+        w->dents = walk_alloc(NULL, WALK_DENTS_SIZE);
+    }
+
+    // The root is a pseudo directory whose fd is dirfd, scanned in place
+    struct walk_dir *root = walk_alloc(NULL, sizeof(*root));
+    root->fd = dirfd;
+    atomic_init(&root->refs, 1);
+    root->path = walk_alloc(NULL, 1);
+    root->path[0] = '\0';
+    walk_push(&pool.workers[0], root, NULL);
+    walk_release(root);
+
+    sigset_t block, old;
+    sigemptyset(&block);
+    sigaddset(&block, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &block, &old);
+
+    // The calling thread is worker 0, the rest are helpers. Workers that
+    // failed to start just leave an empty deque to steal from
+    pthread_t *tids = walk_alloc(NULL, threads * sizeof(pthread_t));
+    int started = 1;
+    for (; started < threads; started++) {
+        if (pthread_create(&tids[started], NULL, walk_worker, &pool.workers[started]) != 0) break;
+    }
+    walk_worker(&pool.workers[0]);
+    for (int i = 1; i < started; i++) {
+        pthread_join(tids[i], NULL);
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    // Merge the per-worker results
+    size_t total = 0;
+    for (int i = 0; i < threads; i++) total += pool.workers[i].result_count;
+    char **results = walk_alloc(NULL, (total + 1) * sizeof(char *));
+    size_t n = 0;
+    for (int i = 0; i < threads; i++) {
+        struct walk_worker *w = &pool.workers[i];
+        if (w->result_count > 0) {
+            memcpy(results + n, w->results, w->result_count * sizeof(char *));
+            n += w->result_count;
+        }
+        free(w->results);
+        free(w->deque.tasks);
+        free(w->dents);
+        pthread_mutex_destroy(&w->deque.lock);
+    }
+    results[n] = NULL;
+
+    free(tids);
+    free(pool.workers);
+    pthread_cond_destroy(&pool.wake);
+    pthread_mutex_destroy(&pool.lock);
+    *count = n;
+    return results;
+}
+
+/**
+ * Worker loop: scan from the own deque, else steal, else sleep until work
+ * shows up or the walk is over.
+ */
+static void *walk_worker(void *arg) {
+    struct walk_worker *self = arg;
+    struct walk_pool *pool = self->pool;
+
+    while (1) {
+        struct walk_task task;
+        if (walk_pop(&self->deque, &task) || walk_steal(pool, self, &task)) {
+            atomic_fetch_sub(&pool->queued, 1);
+            walk_scan(self, &task);
+            if (atomic_fetch_sub(&pool->pending, 1) == 1) {
+                pthread_mutex_lock(&pool->lock);
+                pthread_cond_broadcast(&pool->wake);
+                pthread_mutex_unlock(&pool->lock);
+            }
+            continue;
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        atomic_fetch_add(&pool->idle, 1);
+        while (atomic_load(&pool->queued) == 0 && atomic_load(&pool->pending) > 0) {
+            pthread_cond_wait(&pool->wake, &pool->lock);
+        }
+        atomic_fetch_sub(&pool->idle, 1);
+        int done = atomic_load(&pool->pending) == 0;
+        pthread_mutex_unlock(&pool->lock);
+        if (done) return NULL;
+    }
+}
+
+/**
+ * Opens one directory relative to its parent and scans it: matching
+ * entries become results, subdirectories become tasks on the own deque.
+ */
+static void walk_scan(struct walk_worker *self, struct walk_task *task) {
+    struct walk_pool *pool = self->pool;
+    struct walk_dir *parent = task->parent;
+    struct walk_dir *dir = parent;
+    int is_root = task->name == NULL;
+    int fd;
+
+    if (is_root) {
+        fd = openat(parent->fd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        atomic_fetch_add(&parent->refs, 1);
+    } else {
+        fd = openat(parent->fd, task->name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (fd != -1) {
+            size_t plen = strlen(parent->path);
+            size_t nlen = strlen(task->name);
+            dir = walk_alloc(NULL, sizeof(*dir));
+            dir->fd = fd;
+            atomic_init(&dir->refs, 1);
+            dir->path = walk_alloc(NULL, plen + nlen + 2);
+            memcpy(dir->path, parent->path, plen);
+            memcpy(dir->path + plen, task->name, nlen);
+            memcpy(dir->path + plen + nlen, "/", 2);
+        }
+    }
+    walk_release(parent);
+    if (fd == -1) return;
+
+    if (pool->leaf == NULL) {
+        walk_result(self, dir->path, "");
+    }
+
+    ssize_t n;
+    while ((n = getdents64(fd, self->dents, WALK_DENTS_SIZE)) > 0) {
+        for (ssize_t off = 0; off < n; ) {
+            struct dirent64 *d = (struct dirent64 *) (self->dents + off);
+            off += d->d_reclen;
+            if (d->d_name[0] == '.' && (d->d_name[1] == '\0' || (d->d_name[1] == '.' && d->d_name[2] == '\0'))) {
+                continue;
+            }
+
+            // d_type is trusted, stat() only runs for unknowns and symlinks
+            unsigned char type = d->d_type;
+            if (type == DT_UNKNOWN) {
+                struct stat st;
+                if (fstatat(fd, d->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0) {
+                    type = S_ISDIR(st.st_mode) ? DT_DIR : (S_ISLNK(st.st_mode) ? DT_LNK : DT_REG);
+                }
+            }
+            int is_dir = type == DT_DIR || (type == DT_LNK && glob_is_dir(fd, d->d_name, type));
+
+            if (pool->leaf != NULL && glob_match(pool->leaf, d->d_name) && (!pool->dirs_only || is_dir)) {
+                walk_result(self, dir->path, d->d_name);
+            }
+            if (type == DT_DIR && d->d_name[0] != '.') {
+                walk_push(self, dir, d->d_name);
+            }
+        }
+    }
+
+    if (is_root) close(fd);
+    free(task->name);
+    walk_release(dir);
+}
+
+/**
+ * Queues a subdirectory of parent (or parent itself, for name NULL) on
+ * the worker's deque, waking a sleeping worker to steal it.
+ */
+static void walk_push(struct walk_worker *self, struct walk_dir *parent, const char *name) {
+    struct walk_pool *pool = self->pool;
+    struct walk_deque *dq = &self->deque;
+    struct walk_task task = { parent, NULL };
+    if (name != NULL) {
+        size_t len = strlen(name);
+        task.name = walk_alloc(NULL, len + 1);
+        memcpy(task.name, name, len + 1);
+    }
+    atomic_fetch_add(&parent->refs, 1);
+    atomic_fetch_add(&pool->pending, 1);
+
+    pthread_mutex_lock(&dq->lock);
+    if (dq->count == dq->cap) {
+        size_t capacity = dq->cap ? dq->cap * 2 : INIT_WALK_CAP;
+        struct walk_task *tasks = walk_alloc(NULL, capacity * sizeof(*tasks));
+        for (size_t i = 0; i < dq->count; i++) {
+            tasks[i] = dq->tasks[(dq->head + i) % dq->cap];
+        }
+        free(dq->tasks);
+        dq->tasks = tasks;
+        dq->head = 0;
+        dq->cap = capacity;
+    }
+    dq->tasks[(dq->head + dq->count) % dq->cap] = task;
+    dq->count++;
+    pthread_mutex_unlock(&dq->lock);
+
+    atomic_fetch_add(&pool->queued, 1);
+    if (atomic_load(&pool->idle) > 0) {
+        pthread_mutex_lock(&pool->lock);
+        pthread_cond_signal(&pool->wake);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+/**
+ * Takes the newest task off the owner's end of a deque.
+ *
+ * Note: Returns 1 if a task was taken, 0 if the deque is empty
+ */
+static int walk_pop(struct walk_deque *dq, struct walk_task *task) {
+    pthread_mutex_lock(&dq->lock);
+    int found = dq->count > 0;
+    if (found) {
+        dq->count--;
+        *task = dq->tasks[(dq->head + dq->count) % dq->cap];
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return found;
+}
+
+/**
+ * Takes the oldest task from another worker's deque, trying each victim
+ * once starting after self.
+ *
+ * Note: Returns 1 if a task was stolen, 0 if every deque was empty
+ */
+static int walk_steal(struct walk_pool *pool, struct walk_worker *self, struct walk_task *task) {
+    int me = (int) (self - pool->workers);
+    for (int i = 1; i < pool->worker_count; i++) {
+        struct walk_deque *dq = &pool->workers[(me + i) % pool->worker_count].deque;
+        pthread_mutex_lock(&dq->lock);
+        int found = dq->count > 0;
+        if (found) {
+            *task = dq->tasks[dq->head];
+            dq->head = (dq->head + 1) % dq->cap;
+            dq->count--;
+        }
+        pthread_mutex_unlock(&dq->lock);
+        if (found) return 1;
+    }
+    return 0;
+}
+
+/**
+ * Drops a reference to a directory, closing it once neither its scan nor
+ * any queued child needs its fd. The root's fd belongs to the caller.
+ */
+static void walk_release(struct walk_dir *dir) {
+    if (atomic_fetch_sub(&dir->refs, 1) != 1) return;
+    if (dir->path[0] != '\0') close(dir->fd);
+    free(dir->path);
+    free(dir);
+}
+
+/**
+ * Records path + name in the worker's own result list.
+ */
+static void walk_result(struct walk_worker *self, const char *path, const char *name) {
+    if (self->result_count == self->result_cap) {
+        self->result_cap = self->result_cap ? self->result_cap * 2 : INIT_WALK_CAP;
+        self->results = walk_alloc(self->results, self->result_cap * sizeof(char *));
+    }
+    size_t plen = strlen(path);
+    size_t nlen = strlen(name);
+    char *result = walk_alloc(NULL, plen + nlen + 1);
+    memcpy(result, path, plen);
+    memcpy(result + plen, name, nlen + 1);
+    self->results[self->result_count++] = result;
+}
+
+/**
+ * realloc() that exits on failure, the walk has no way to unwind.
+ *
+ * Note: Calls exit(1) on allocation failure
+ */
+static void *walk_alloc(void *ptr, size_t size) {
+    void *temp = realloc(ptr, size);
+    if (temp == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed while walking directories: %s\n", strerror(errno));
+        exit(1);
+    }
+    return temp;
+}
@@ -0,0 +1,466 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include "shell.h"
+
+#define RECORD_MAGIC "BSHR"
+#define INDEX_MAGIC "BSHI"
+#define INDEX_VERSION 1
+#define INDEX_SLACK 256                     // Unindexed records tolerated before the index is rewritten
+#define MAP_STEP (1 << 20)                  // The log's mapping grows by this much at a time
+#define IN_SESSION (1ull << 63)             // Offset is into session, not the log
+#define DEFAULT_HISTSIZE 1000
+#define DEFAULT_HISTFILE ".bshell_history"
+
+/*
+ * Command history, kept in an append-only log shared by every interactive
+ * shell. Each command is one record, written with a single write() on an
+ * O_APPEND descriptor once it finishes, so concurrent shells interleave
+ * whole records and never tear each other's.
+ *
+ * Record: a history_record header, then the cwd and the command, each
+ * NUL-terminated, padded with NULs to a multiple of 8. check is a hash of those bytes, so a
+ * record cut short by a crash (or any stray bytes) is skipped, reading
+ * resumes at the next magic.
+ *
+ * Finding the records means scanning the log, so the offsets are kept in
+ * an index in the cache directory: an index_header (naming the log by dev
+ * and inode and saying how much of it was indexed) and the u64 offsets.
+ * At startup the log and index are mmap'd and only what was appended
+ * since is scanned; once that tail grows past INDEX_SLACK records, the
+ * index is rewritten. It's written to a temporary file renamed into
+ * place, so concurrent shells see one index or the other, both valid.
+ *
+ * The session's own records are read back from the log too, through a
+ * mapping grown as they're appended, so they cost memory only when
+ * there's no log to write them to.
+ */
+
+struct history_record {
+    char magic[4];
+    uint32_t len;           // Bytes after the header, padding included
+    int64_t time;           // When the command started, seconds since the epoch
+    uint32_t duration_ms;
+    int32_t status;
+    uint32_t cwd_len;       // cwd comes first in the payload, then the
+    uint32_t command_len;   // command
+    uint32_t check;
+    uint32_t reserved;
+};
+
+struct index_header {
+    char magic[4];
+    uint32_t version;
+    uint64_t dev;           // The log it indexes
+    uint64_t ino;
+    uint64_t covered;       // Bytes of the log it covers, ending on a record
+    uint64_t count;         // Offsets that follow
+};
+
+// The history as of startup, mapped, and what was added since
+static int log_fd = -1;
+static int log_writable = 0;            // Cleared after a write error, log_fd stays for fstat()
+static char *log_map = NULL;
+static size_t log_len = 0;              // Bytes of the log known to be there
+static size_t map_len = 0;              // Bytes mapped, past the end of the log
+static void *index_map = NULL;
+static size_t index_len = 0;
+static const uint64_t *indexed = NULL;  // Offsets of records in log_map
+static size_t indexed_count = 0;
+static uint64_t *tail = NULL;           // Offsets found past the index
+static size_t tail_count = 0;
+static size_t tail_cap = 0;
+static struct buffer session;           // This session's records the log doesn't have
+static uint64_t *session_offsets = NULL;    // Into the log, or session with IN_SESSION
+static size_t session_count = 0;
+static size_t session_cap = 0;
+
+// The command that's running, written out by history_end()
+static int pending = 0;
+static struct buffer pending_command;
+static struct buffer pending_cwd;
+static struct timespec pending_start;
+static time_t pending_time;
+
+static const char *log_path(char *path, size_t size);
+static void load_index(const char *key, const struct stat *st);
+static void save_index(const char *key, const struct stat *st);
+static void scan(size_t pos);
+static int map_log(size_t end);
+static int record_at(const char *data, size_t len, size_t pos, int verify, struct history_entry *e);
+static void push_offset(uint64_t **offsets, size_t *count, size_t *cap, size_t offset);
+static uint32_t record_check(const char *payload, size_t len);
+
+/**
+ * Opens the history log and loads its last $HISTSIZE (default 1000)
+ * commands into the store the arrow keys browse. The log is $HISTFILE, ~/.bshell_history when
+ * unset; an empty $HISTFILE keeps history in memory only.
+ *
+ * Loading costs an mmap of the log and of its index, plus a scan of the
+ * records other shells appended since the index was written, however
+ * long the history is.
+ */
+void history_init(void) {
+    const char *size = get_var("HISTSIZE", 8);
+    long keep = size != NULL ? strtol(size, NULL, 10) : DEFAULT_HISTSIZE;
+    if (keep <= 0) keep = DEFAULT_HISTSIZE;
+    store_init(keep);
+
+    char path[PATH_MAX];
+    if (log_path(path, sizeof(path)) == NULL) return;
+    log_fd = open(path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    if (log_fd == -1) return;
+    log_writable = 1;
+
+    struct stat st;
+    if (fstat(log_fd, &st) == -1 || st.st_size == 0) return;
+    log_map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, log_fd, 0);
+    if (log_map == MAP_FAILED) {
+        log_map = NULL;
+        return;
+    }
+    log_len = st.st_size;
+    map_len = st.st_size;
+
+    char key[PATH_MAX];
+    if (realpath(path, key) == NULL) snprintf(key, sizeof(key), "%s", path);
+    load_index(key, &st);
+
+    size_t total = history_entry_count();
+    size_t first = total > (size_t) keep ? total - keep : 0;
+    struct history_entry e;
+    for (size_t i = first; i < total; i++) {
+        if (history_entry_at(i, &e) == 0) store_add(e.command, e.command_len);
+    }
+}
+
+/**
+ * Notes the start of a command typed at the prompt: it goes into the
+ * store the arrow keys browse now, and into the log with its status and
+ * duration when history_end() is called.
+ */
+void history_begin(const char *line) {
+    store_add(line, strlen(line));
+    pending_command.len = 0;
+    buffer_append(&pending_command, line, strlen(line));
+    const char *cwd = cwd_get();
+    pending_cwd.len = 0;
+    buffer_append(&pending_cwd, cwd != NULL ? cwd : "", cwd != NULL ? strlen(cwd) : 0);
+    pending_time = time(NULL);
+    clock_gettime(CLOCK_MONOTONIC, &pending_start);
+    pending = 1;
+}
+
+/**
+ * Finishes the command history_begin() started, appending its record to
+ * the log. Does nothing if there's none (e.g. it was already ended).
+ */
+void history_end(int status) {
+    if (!pending) return;
+    pending = 0;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long ms = (now.tv_sec - pending_start.tv_sec) * 1000 + (now.tv_nsec - pending_start.tv_nsec) / 1000000;
+
+    size_t payload = pending_cwd.len + 1 + pending_command.len + 1;
+    size_t padded = (payload + 7) & ~(size_t) 7;
+    struct history_record head = {
+        .len = padded,
+        .time = pending_time,
+        .duration_ms = ms > UINT32_MAX ? UINT32_MAX : (uint32_t) ms,
+        .status = status,
+        .cwd_len = pending_cwd.len,
+        .command_len = pending_command.len,
+    };
+    memcpy(head.magic, RECORD_MAGIC, 4);
+
+    size_t offset = session.len;
+    buffer_append(&session, (const char *) &head, sizeof(head));
+    buffer_append(&session, pending_cwd.data, pending_cwd.len + 1);
+    buffer_append(&session, pending_command.data, pending_command.len + 1);
+    buffer_reserve(&session, padded - payload);
+    memset(session.data + session.len, 0, padded - payload);
+    session.len += padded - payload;
+    struct history_record *rec = (struct history_record *) (session.data + offset);
+    rec->check = record_check(session.data + offset + sizeof(head), padded);
+
+    // One write, so it lands whole even with other shells appending. With
+    // O_APPEND, the file offset afterwards is the end of this record
+    size_t total = sizeof(head) + padded;
+    ssize_t written = log_writable ? write(log_fd, session.data + offset, total) : -1;
+    off_t end = written == (ssize_t) total ? lseek(log_fd, 0, SEEK_CUR) : -1;
+    if (end != -1 && map_log(end) == 0) {
+        session.len = offset;
+        push_offset(&session_offsets, &session_count, &session_cap, end - total);
+    } else {
+        // Kept as written, for history_entry_at()
+        push_offset(&session_offsets, &session_count, &session_cap, offset | IN_SESSION);
+    }
+    if (log_writable && written == -1) {
+        fprintf(stderr, "bshell: history: %s\n", strerror(errno));
+        log_writable = 0;
+    }
+    history_check_log();
+    search_add(history_entry_count() - 1);
+}
+
+/**
+ * Notices the log having been truncated by someone else since it was
+ * last seen: what's past its end is no longer read, as touching those
+ * pages of the mapping would fault, and the entries there fail to load
+ * from then on. Called before the history is read, each time a reader
+ * starts (builtin_history(), search_history()).
+ */
+void history_check_log(void) {
+    struct stat st;
+    if (log_map != NULL && log_fd != -1 && fstat(log_fd, &st) == 0 && (size_t) st.st_size < log_len) {
+        log_len = st.st_size;
+    }
+}
+
+/**
+ * Number of history entries: the log's as of startup, then this session's.
+ */
+size_t history_entry_count(void) {
+    return indexed_count + tail_count + session_count;
+}
+
+/**
+ * Fills e with history entry i, oldest first.
+ *
+ * Note: Returns 0 on success, -1 if there's no such entry. e's strings
+ * stay valid until the next history_end()
+ */
+int history_entry_at(size_t i, struct history_entry *e) {
+    if (i < indexed_count) return record_at(log_map, log_len, indexed[i], 0, e);
+    i -= indexed_count;
+    if (i < tail_count) return record_at(log_map, log_len, tail[i], 0, e);
+    i -= tail_count;
+    if (i >= session_count) return -1;
+    if (session_offsets[i] & IN_SESSION) {
+        return record_at(session.data, session.len, session_offsets[i] & ~IN_SESSION, 0, e);
+    }
+    return record_at(log_map, log_len, session_offsets[i], 0, e);
+}
+
+/**
+ * Built-in: history [n]
+ *
+ * Lists the history, or its last n entries, numbered from 1.
+ */
+int builtin_history(char **argv) {
+    history_check_log();
+    size_t total = history_entry_count();
+    size_t first = 0;
+    if (argv[1] != NULL) {
+        char *end;
+        long n = strtol(argv[1], &end, 10);
+        if (*end != '\0' || end == argv[1] || n < 0) {
+            fprintf(stderr, "history: %s: numeric argument required\n", argv[1]);
+            return 2;
+        }
+        if ((size_t) n < total) first = total - n;
+    }
+
+    struct history_entry e;
+    for (size_t i = first; i < total; i++) {
+        if (history_entry_at(i, &e) == 0) printf("%5zu  %s\n", i + 1, e.command);
+    }
+    return 0;
+}
+
+/**
+ * Puts the path of the history log in path, see history_init().
+ *
+ * Note: Returns path, or NULL if history isn't to be saved
+ */
+static const char *log_path(char *path, size_t size) {
+    const char *file = get_var("HISTFILE", 8);
+    const char *home = getenv("HOME");
+    int len;
+    if (file != NULL) {
+        if (*file == '\0') return NULL;
+        len = snprintf(path, size, "%s", file);
+    } else if (home != NULL && *home != '\0') {
+        len = snprintf(path, size, "%s/%s", home, DEFAULT_HISTFILE);
+    } else {
+        return NULL;
+    }
+    return len < 0 || (size_t) len >= size ? NULL : path;
+}
+
+/**
+ * Maps the index of the log at key, described by st, then scans what it
+ * doesn't cover, rewriting it if that was more than INDEX_SLACK records.
+ * A missing or stale index (the log was replaced or truncated) is
+ * rebuilt from a scan of the whole log.
+ */
+static void load_index(const char *key, const struct stat *st) {
+    char path[PATH_MAX];
+    size_t covered = 0;
+    if (cache_file(key, strlen(key), "hidx", path, sizeof(path)) == 0) {
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        struct stat ist;
+        if (fd != -1 && fstat(fd, &ist) == 0 && (size_t) ist.st_size >= sizeof(struct index_header)) {
+            void *map = mmap(NULL, ist.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            const struct index_header *head = map;
+            if (map != MAP_FAILED && memcmp(head->magic, INDEX_MAGIC, 4) == 0 &&
+                head->version == INDEX_VERSION && head->dev == (uint64_t) st->st_dev &&
+                head->ino == (uint64_t) st->st_ino && head->covered <= log_len &&
+                (uint64_t) ist.st_size == sizeof(*head) + head->count * sizeof(uint64_t)) {
+                index_map = map;
+                index_len = ist.st_size;
+                indexed = (const uint64_t *) (head + 1);
+                indexed_count = head->count;
+                covered = head->covered;
+            } else if (map != MAP_FAILED) {
+                munmap(map, ist.st_size);
+            }
+        }
+        if (fd != -1) close(fd);
+    }
+
+    // The last indexed record must still be there, or the log was rewritten
+    struct history_entry e;
+    if (indexed_count > 0 && record_at(log_map, log_len, indexed[indexed_count - 1], 1, &e) < 0) {
+        munmap(index_map, index_len);
+        index_map = NULL;
+        indexed = NULL;
+        indexed_count = 0;
+        covered = 0;
+    }
+
+    scan(covered);
+    if (tail_count > INDEX_SLACK) save_index(key, st);
+}
+
+/**
+ * Writes an index covering everything mapped from the log: the offsets of
+ * the old index followed by those found after it.
+ */
+static void save_index(const char *key, const struct stat *st) {
+    char path[PATH_MAX];
+    if (cache_file(key, strlen(key), "hidx", path, sizeof(path)) < 0) return;
+
+    struct index_header head = { .version = INDEX_VERSION };
+    memcpy(head.magic, INDEX_MAGIC, 4);
+    head.dev = st->st_dev;
+    head.ino = st->st_ino;
+    head.count = indexed_count + tail_count;
+    head.covered = log_len;
+    struct iovec parts[] = {
+        { &head, sizeof(head) },
+        { (void *) indexed, indexed_count * sizeof(uint64_t) },
+        { tail, tail_count * sizeof(uint64_t) },
+    };
+    cache_save(path, parts, 3);
+}
+
+/**
+ * Collects the offsets of the log's records from pos to the end of the
+ * mapping into tail, skipping anything that isn't a whole record.
+ */
+static void scan(size_t pos) {
+    struct history_entry e;
+    while (pos + sizeof(struct history_record) <= log_len) {
+        if (record_at(log_map, log_len, pos, 1, &e) == 0) {
+            push_offset(&tail, &tail_count, &tail_cap, pos);
+            pos += sizeof(struct history_record) + ((const struct history_record *) (log_map + pos))->len;
+            continue;
+        }
+        // Damaged: look for the next record, which starts 8-aligned
+        // unless the damage was a torn write
+        const char *next = memmem(log_map + pos + 1, log_len - pos - 1, RECORD_MAGIC, 4);
+        if (next == NULL) break;
+        pos = next - log_map;
+    }
+}
+
+/**
+ * Makes the log mapped up to end, where the file was just seen to end,
+ * growing the mapping by MAP_STEP at a time. Only the first end bytes are
+ * ever read, what's mapped past the file isn't touched.
+ *
+ * Note: Returns 0 on success, -1 if the log can't be mapped
+ */
+static int map_log(size_t end) {
+    if (end > map_len) {
+        size_t len = (end + MAP_STEP - 1) / MAP_STEP * MAP_STEP;
+        void *map = log_map == NULL ? mmap(NULL, len, PROT_READ, MAP_PRIVATE, log_fd, 0) :
+                                      mremap(log_map, map_len, len, MREMAP_MAYMOVE);
+        if (map == MAP_FAILED) return -1;
+        log_map = map;
+        map_len = len;
+    }
+    log_len = end;
+    return 0;
+}
+
+/**
+ * Decodes the record at pos in data into e, if there's a whole one
+ * there. With verify its checksum is checked too, as it must be for
+ * offsets not yet known to hold a record; the rest were checked when
+ * they were found.
+ *
+ * Note: Returns 0 on success, -1 otherwise
+ */
+static int record_at(const char *data, size_t len, size_t pos, int verify, struct history_entry *e) {
+    struct history_record head;
+    if (pos > len || len - pos < sizeof(head)) return -1;
+    memcpy(&head, data + pos, sizeof(head));
+    if (memcmp(head.magic, RECORD_MAGIC, 4) != 0 || head.len > len - pos - sizeof(head) ||
+        (uint64_t) head.cwd_len + head.command_len + 2 > head.len) {
+        return -1;
+    }
+    const char *payload = data + pos + sizeof(head);
+    if ((verify && record_check(payload, head.len) != head.check) || payload[head.cwd_len] != '\0' ||
+        payload[head.cwd_len + 1 + head.command_len] != '\0') {
+        return -1;
+    }
+
+    e->cwd = payload;
+    e->cwd_len = head.cwd_len;
+    e->command = payload + head.cwd_len + 1;
+    e->command_len = head.command_len;
+    e->time = head.time;
+    e->duration_ms = head.duration_ms;
+    e->status = head.status;
+    return 0;
+}
+
+/**
+ * Appends an offset to a growing array.
+ *
+ * Note: Calls exit(1) on allocation failure
+ */
+static void push_offset(uint64_t **offsets, size_t *count, size_t *cap, size_t offset) {
+    if (*count == *cap) {
+        *cap = *cap ? *cap * 2 : 256;
+        uint64_t *grown = realloc(*offsets, *cap * sizeof(uint64_t));
+        if (grown == NULL) {
+            fprintf(stderr, "Error: Memory allocation failed for history: %s\n", strerror(errno));
+            exit(1);
+        }
+        *offsets = grown;
+    }
+    (*offsets)[(*count)++] = offset;
+}
+
+/**
+ * Checksum of a record's payload.
+ */
+static uint32_t record_check(const char *payload, size_t len) {
+    uint64_t h = hash_bytes(payload, len);
+    return (uint32_t) (h ^ (h >> 32));
+}
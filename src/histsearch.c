@@ -0,0 +1,763 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <poll.h>
+#include <readline/readline.h>
+#include "shell.h"
+
+#define SEARCH_RESULTS 64       // Ranked matches kept, what Ctrl-R cycles through
+#define SEARCH_MAX_GRAMS 64     // Grams of a query looked up, the rest only verified
+#define SEARCH_QUERY_MAX 256
+#define SEARCH_SCORE_ALL_MAX 4096   // Most matches scored outright, rather than walked best first
+#define SEARCH_WALK_BUDGET 8192     // Steps a walk takes before giving up on stopping early
+#define SEARCH_LETTER_BUDGET 1024   // Steps a single letter query walks, all it gets
+#define NO_ID UINT32_MAX
+#define GRAM_USED 0x1000000
+#define GRAM_PAIR 0x2000000     // Two bytes, not three
+#define CTRL_KEY(c) ((c) & 0x1f)
+#define DEFAULT_KEYSEQ_TIMEOUT 500   // ms, readline's own default
+
+/*
+ * Fuzzy history search, bound to Ctrl-R in place of readline's linear
+ * reverse-i-search. Every distinct command is a candidate, with the entry
+ * it last ran as, how often it ran and a hash of where it last ran. An
+ * index maps each bigram and trigram (ASCII lowercased) to the ids of the
+ * candidates containing it: a sorted list while few do, a bitmap once
+ * at least one candidate in 64 does.
+ *
+ * A query is split into words, each of which has to appear in the
+ * command, in any order and ignoring case. Two-letter words are looked
+ * up as bigrams, longer ones as their trigrams; words the grams don't
+ * pin down are then checked against the command itself. When a gram is
+ * sparse, its list is gone through; when all are dense their bitmaps are
+ * ANDed, and if that leaves a lot, the candidates are walked best first
+ * (see walk()), which stops early for broad queries. Matches are scored
+ * before they're checked, so most never are. If nothing matches and the
+ * query is long enough, candidates missing at most a few trigrams (one
+ * typo's worth) are taken instead, ranked lower.
+ *
+ * The index is built the first time it's needed and kept up to date as
+ * commands finish, see search_add().
+ */
+
+struct candidate {
+    size_t last;            // Entry it last ran as
+    uint64_t hash;          // Of the command
+    uint64_t cwd_hash;      // Of the directory it last ran in
+    uint32_t count;         // Times it ran
+    float freq;             // count's part of the score
+};
+
+struct gram {
+    uint32_t key;           // The bytes | GRAM_USED (| GRAM_PAIR), 0 if free
+    uint32_t count;         // Candidates containing it
+    uint32_t cap;
+    uint32_t *ids;          // Them, ascending, while sparse
+    uint64_t *bits;         // Them as a bitmap once dense, ids is freed
+};
+
+struct result {
+    uint32_t id;
+    double score;
+};
+
+// One query being answered
+struct search {
+    const char *query;
+    struct gram *lists[SEARCH_MAX_GRAMS];   // Of its grams, rarest first
+    size_t n;               // Grams in the query
+    size_t found;           // Of those, ones some command has
+    size_t need;            // Grams a typo pass match must have
+    int verify;             // Some word isn't pinned down by its grams
+    const uint64_t *bits;   // AND of the lists, when they're all dense
+    size_t total;           // History entries
+    uint64_t cwd_hash;
+    struct result results[SEARCH_RESULTS];
+    size_t count;
+};
+
+static int built = 0;
+static struct candidate *cands = NULL;
+static size_t cand_count = 0;
+static size_t cand_cap = 0;
+static uint32_t *by_hash = NULL;        // Open addressing, id + 1 per slot
+static size_t by_hash_cap = 0;
+static struct gram *grams = NULL;       // Open addressing on key
+static size_t gram_count = 0;
+static size_t gram_cap = 0;
+static uint32_t *newer = NULL;          // Candidates by when they last ran,
+static uint32_t *older = NULL;          // a list linked both ways
+static uint32_t newest = NO_ID;
+static uint32_t *by_freq = NULL;        // Candidates by count, highest first
+static uint32_t *freq_pos = NULL;       // Where each one is in by_freq
+static uint32_t *seen = NULL;           // Candidates a query has looked at,
+static uint32_t stamp = 0;              // those marked with stamp
+static uint64_t *scratch = NULL;        // Bitmap for combining lists
+
+static void build(void);
+static void add_entry(size_t i);
+static uint32_t find_candidate(const struct history_entry *e, uint64_t hash);
+static void grow_candidates(void);
+static void rehash_candidates(void);
+static void touch(uint32_t id);
+static void bump(uint32_t id);
+static struct gram *find_gram(uint32_t key, int create);
+static void post(uint32_t key, uint32_t id);
+static size_t query_grams(const char *query, uint32_t *keys, int *verify);
+static int walk(struct search *s, size_t budget);
+static size_t count_end(size_t pos);
+static void consider(struct search *s, uint32_t id);
+static void consider_typo(struct search *s, uint32_t id);
+static void typo_pass(struct search *s);
+static void next_stamp(void);
+static int words_match(const char *command, const char *query);
+static double score(const struct search *s, uint32_t id, size_t missing);
+static int beaten(const struct search *s, double value);
+static void keep_result(struct search *s, uint32_t id, double value);
+static double approx_log2(double x);
+static int search_widget(int count, int key);
+static int key_follows(void);
+static int contains(const struct gram *g, uint32_t id);
+static uint32_t gram_key(const char *p, size_t len);
+
+/**
+ * Binds Ctrl-R to the fuzzy search widget, also available to inputrc as
+ * fuzzy-history-search.
+ */
+void search_init(void) {
+    rl_add_defun("fuzzy-history-search", search_widget, CTRL_KEY('r'));
+}
+
+/**
+ * Adds history entry i, which just finished, to the index if it's been
+ * built.
+ */
+void search_add(size_t i) {
+    if (built) add_entry(i);
+}
+
+/**
+ * Searches the history for query, putting up to max entry numbers in out,
+ * best match first.
+ *
+ * Note: Returns the number of matches put in out
+ */
+size_t search_history(const char *query, size_t *out, size_t max) {
+    history_check_log();
+    if (!built) build();
+
+    struct search s = { .query = query, .total = history_entry_count() };
+    const char *cwd = cwd_get();
+    s.cwd_hash = cwd != NULL ? hash_bytes(cwd, strlen(cwd)) : 0;
+
+    uint32_t keys[SEARCH_MAX_GRAMS];
+    s.n = query_grams(query, keys, &s.verify);
+    for (size_t i = 0; i < s.n; i++) {
+        struct gram *g = find_gram(keys[i], 0);
+        if (g != NULL) s.lists[s.found++] = g;
+    }
+    // Rarest list first
+    for (size_t i = 1; i < s.found; i++) {
+        for (size_t j = i; j > 0 && s.lists[j]->count < s.lists[j - 1]->count; j--) {
+            struct gram *swap = s.lists[j];
+            s.lists[j] = s.lists[j - 1];
+            s.lists[j - 1] = swap;
+        }
+    }
+
+    next_stamp();
+    if (s.n == 0) {
+        // Single letters: only as far as a walk gets
+        walk(&s, SEARCH_LETTER_BUDGET);
+    } else if (s.found < s.n) {
+        // A gram no command has, only the typo pass can match
+    } else if (s.lists[0]->bits == NULL) {
+        for (uint32_t k = s.lists[0]->count; k > 0; k--) consider(&s, s.lists[0]->ids[k - 1]);
+    } else {
+        size_t words = cand_cap / 64;
+        size_t left = 0;
+        memcpy(scratch, s.lists[0]->bits, words * sizeof(uint64_t));
+        for (size_t w = 0; w < words; w++) {
+            for (size_t i = 1; i < s.found; i++) scratch[w] &= s.lists[i]->bits[w];
+            left += __builtin_popcountll(scratch[w]);
+        }
+        s.bits = scratch;
+        if (left > SEARCH_SCORE_ALL_MAX && walk(&s, SEARCH_WALK_BUDGET)) left = 0;
+        for (size_t w = words; left > 0 && w > 0; w--) {
+            for (uint64_t bits = scratch[w - 1]; bits != 0; bits &= ~(1ull << (63 - __builtin_clzll(bits)))) {
+                consider(&s, (w - 1) * 64 + 63 - __builtin_clzll(bits));
+            }
+        }
+    }
+
+    if (s.count == 0 && s.n >= 4 && s.found > 0) typo_pass(&s);
+
+    if (s.count > max) s.count = max;
+    for (size_t i = 0; i < s.count; i++) out[i] = cands[s.results[i].id].last;
+    return s.count;
+}
+
+/**
+ * Indexes the whole history.
+ */
+static void build(void) {
+    built = 1;
+    size_t total = history_entry_count();
+    for (size_t i = 0; i < total; i++) add_entry(i);
+}
+
+/**
+ * Counts entry i towards its command's candidate, creating the candidate
+ * and posting its grams the first time the command is seen.
+ */
+static void add_entry(size_t i) {
+    struct history_entry e;
+    if (history_entry_at(i, &e) < 0) return;
+    uint64_t hash = hash_bytes(e.command, e.command_len);
+    uint32_t id = find_candidate(&e, hash);
+    if (id == NO_ID) {
+        if (cand_count == cand_cap) grow_candidates();
+        if ((cand_count + 1) * 2 > by_hash_cap) rehash_candidates();
+        id = cand_count++;
+        cands[id] = (struct candidate) { .hash = hash };
+        newer[id] = older[id] = NO_ID;
+        by_freq[id] = id;
+        freq_pos[id] = id;
+        seen[id] = 0;
+        size_t slot = hash & (by_hash_cap - 1);
+        while (by_hash[slot] != 0) slot = (slot + 1) & (by_hash_cap - 1);
+        by_hash[slot] = id + 1;
+        for (size_t k = 0; k + 2 <= e.command_len; k++) {
+            post(gram_key(e.command + k, 2), id);
+            if (k + 3 <= e.command_len) post(gram_key(e.command + k, 3), id);
+        }
+    }
+    cands[id].last = i;
+    cands[id].cwd_hash = hash_bytes(e.cwd, e.cwd_len);
+    bump(id);
+    touch(id);
+}
+
+/**
+ * Finds the candidate for e's command.
+ *
+ * Note: Returns its id, or NO_ID if there's none yet
+ */
+static uint32_t find_candidate(const struct history_entry *e, uint64_t hash) {
+    if (by_hash_cap == 0) return NO_ID;
+    struct history_entry other;
+    for (size_t slot = hash & (by_hash_cap - 1); by_hash[slot] != 0; slot = (slot + 1) & (by_hash_cap - 1)) {
+        uint32_t id = by_hash[slot] - 1;
+        if (cands[id].hash == hash && history_entry_at(cands[id].last, &other) == 0 &&
+            other.command_len == e->command_len && memcmp(other.command, e->command, e->command_len) == 0) {
+            return id;
+        }
+    }
+    return NO_ID;
+}
+
+/**
+ * Doubles the room for candidates, and with it everything sized by their
+ * number: the orders, marks and bitmaps.
+ *
+ * Note: Calls exit(1) on allocation failure
+ */
+static void grow_candidates(void) {
+    size_t cap = cand_cap ? cand_cap * 2 : 1024;
+    cands = realloc(cands, cap * sizeof(struct candidate));
+    newer = realloc(newer, cap * sizeof(uint32_t));
+    older = realloc(older, cap * sizeof(uint32_t));
+    by_freq = realloc(by_freq, cap * sizeof(uint32_t));
+    freq_pos = realloc(freq_pos, cap * sizeof(uint32_t));
+    seen = realloc(seen, cap * sizeof(uint32_t));
+    scratch = realloc(scratch, cap / 8);
+    if (cands == NULL || newer == NULL || older == NULL || by_freq == NULL || freq_pos == NULL || seen == NULL ||
+        scratch == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed for history search: %s\n", strerror(errno));
+        exit(1);
+    }
+    for (size_t i = 0; i < gram_cap; i++) {
+        if (grams[i].bits == NULL) continue;
+        grams[i].bits = realloc(grams[i].bits, cap / 8);
+        if (grams[i].bits == NULL) {
+            fprintf(stderr, "Error: Memory allocation failed for history search: %s\n", strerror(errno));
+            exit(1);
+        }
+        memset(grams[i].bits + cand_cap / 64, 0, (cap - cand_cap) / 8);
+    }
+    cand_cap = cap;
+}
+
+/**
+ * Doubles the command hash table, reinserting every candidate.
+ *
+ * Note: Calls exit(1) on allocation failure
+ */
+static void rehash_candidates(void) {
+    size_t cap = by_hash_cap ? by_hash_cap * 2 : 2048;
+    uint32_t *table = calloc(cap, sizeof(uint32_t));
+    if (table == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed for history search: %s\n", strerror(errno));
+        exit(1);
+    }
+    for (uint32_t id = 0; id < cand_count; id++) {
+        size_t slot = cands[id].hash & (cap - 1);
+        while (table[slot] != 0) slot = (slot + 1) & (cap - 1);
+        table[slot] = id + 1;
+    }
+    free(by_hash);
+    by_hash = table;
+    by_hash_cap = cap;
+}
+
+/**
+ * Moves a candidate that just ran to the front of the recency list.
+ */
+static void touch(uint32_t id) {
+    if (newest == id) return;
+    if (newer[id] != NO_ID) older[newer[id]] = older[id];
+    if (older[id] != NO_ID) newer[older[id]] = newer[id];
+    newer[id] = NO_ID;
+    older[id] = newest;
+    if (newest != NO_ID) newer[newest] = id;
+    newest = id;
+}
+
+/**
+ * Counts another run of a candidate, keeping by_freq sorted: it swaps
+ * places with the first candidate of its old count, found by binary
+ * search, and so becomes the last of the new one.
+ */
+static void bump(uint32_t id) {
+    uint32_t old = cands[id].count;
+    uint32_t lo = 0;
+    uint32_t hi = freq_pos[id];
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (cands[by_freq[mid]].count > old) lo = mid + 1;
+        else hi = mid;
+    }
+    uint32_t other = by_freq[lo];
+    by_freq[lo] = id;
+    by_freq[freq_pos[id]] = other;
+    freq_pos[other] = freq_pos[id];
+    freq_pos[id] = lo;
+    cands[id].count++;
+    cands[id].freq = 1.5 * approx_log2(1.0 + cands[id].count);
+}
+
+/**
+ * Finds the ids of a gram, adding an empty list with create.
+ *
+ * Note: Returns NULL if there's none and create isn't set. Calls exit(1)
+ * on allocation failure
+ */
+static struct gram *find_gram(uint32_t key, int create) {
+    if (create && (gram_count + 1) * 2 > gram_cap) {
+        size_t cap = gram_cap ? gram_cap * 2 : 4096;
+        struct gram *table = calloc(cap, sizeof(struct gram));
+        if (table == NULL) {
+            fprintf(stderr, "Error: Memory allocation failed for history search: %s\n", strerror(errno));
+            exit(1);
+        }
+        for (size_t i = 0; i < gram_cap; i++) {
+            if (grams[i].key == 0) continue;
+            size_t slot = (grams[i].key * 2654435761u) & (cap - 1);
+            while (table[slot].key != 0) slot = (slot + 1) & (cap - 1);
+            table[slot] = grams[i];
+        }
+        free(grams);
+        grams = table;
+        gram_cap = cap;
+    }
+    if (gram_cap == 0) return NULL;
+
+    size_t slot = (key * 2654435761u) & (gram_cap - 1);
+    while (grams[slot].key != 0) {
+        if (grams[slot].key == key) return &grams[slot];
+        slot = (slot + 1) & (gram_cap - 1);
+    }
+    if (!create) return NULL;
+    grams[slot].key = key;
+    gram_count++;
+    return &grams[slot];
+}
+
+/**
+ * Adds candidate id to a gram, once: ids arrive in ascending order, so a
+ * repeat is always the last one. The list turns into a bitmap once that
+ * takes at most twice the room.
+ *
+ * Note: Calls exit(1) on allocation failure
+ */
+static void post(uint32_t key, uint32_t id) {
+    struct gram *g = find_gram(key, 1);
+    if (g->bits != NULL) {
+        if (!contains(g, id)) g->count++;
+        g->bits[id / 64] |= 1ull << (id % 64);
+        return;
+    }
+    if (g->count > 0 && g->ids[g->count - 1] == id) return;
+
+    if (g->count >= 64 && (size_t) g->count * 64 >= cand_count) {
+        g->bits = calloc(cand_cap / 64, sizeof(uint64_t));
+        if (g->bits == NULL) {
+            fprintf(stderr, "Error: Memory allocation failed for history search: %s\n", strerror(errno));
+            exit(1);
+        }
+        for (uint32_t k = 0; k < g->count; k++) g->bits[g->ids[k] / 64] |= 1ull << (g->ids[k] % 64);
+        g->bits[id / 64] |= 1ull << (id % 64);
+        g->count++;
+        free(g->ids);
+        g->ids = NULL;
+        g->cap = 0;
+        return;
+    }
+    if (g->count == g->cap) {
+        uint32_t cap = g->cap ? g->cap * 2 : 4;
+        uint32_t *ids = realloc(g->ids, cap * sizeof(uint32_t));
+        if (ids == NULL) {
+            fprintf(stderr, "Error: Memory allocation failed for history search: %s\n", strerror(errno));
+            exit(1);
+        }
+        g->ids = ids;
+        g->cap = cap;
+    }
+    g->ids[g->count++] = id;
+}
+
+/**
+ * Puts the distinct grams of the query's words in keys, up to
+ * SEARCH_MAX_GRAMS: a two-letter word's bigram, a longer one's trigrams.
+ * verify is set if having them doesn't prove the words are there, which
+ * it does for words of two or three letters.
+ *
+ * Note: Returns the number of grams
+ */
+static size_t query_grams(const char *query, uint32_t *keys, int *verify) {
+    size_t n = 0;
+    *verify = 0;
+    while (*query != '\0') {
+        query += strspn(query, " ");
+        size_t len = strcspn(query, " ");
+        if (len == 1 || len > 3) *verify = 1;
+        for (size_t k = 0; k + 3 <= len || (len == 2 && k == 0); k++) {
+            uint32_t key = gram_key(query + k, len == 2 ? 2 : 3);
+            size_t j = 0;
+            while (j < n && keys[j] != key) j++;
+            if (j == n && n < SEARCH_MAX_GRAMS) keys[n++] = key;
+            else if (j == n) *verify = 1;
+        }
+        query += len;
+    }
+    return n;
+}
+
+/**
+ * Goes through the candidates best first, by two orders at once (most
+ * recent, most frequent), considering each. Stops when even a candidate
+ * as recent as the next in one order and as frequent as the next in the
+ * other couldn't make the results, which for broad queries is soon.
+ *
+ * Note: Returns 1 if it got to the end that way, 0 if it ran out of
+ * budget steps first
+ */
+static int walk(struct search *s, size_t budget) {
+    uint32_t recent = newest;
+    size_t frequent = 0;
+    size_t class_end = 0;
+    // Either order running out means every candidate was seen
+    for (size_t steps = 0; recent != NO_ID && frequent < cand_count; steps++) {
+        double bound = cands[by_freq[frequent]].freq + 3.0 -
+                       approx_log2(1.0 + (double) (s->total - 1 - cands[recent].last));
+        if (beaten(s, bound)) return 1;
+        if (steps == budget) return 0;
+        uint32_t id = recent;
+        recent = older[recent];
+        consider(s, id);
+        // The bound only drops once all of a count is passed, which for
+        // the common counts won't happen within budget: leave those to
+        // recency
+        if (frequent == class_end) class_end = count_end(frequent);
+        if (class_end - frequent <= budget - steps) consider(s, by_freq[frequent++]);
+    }
+    return 1;
+}
+
+/**
+ * Finds where the candidates that ran as often as by_freq[pos] end in
+ * by_freq, by binary search.
+ */
+static size_t count_end(size_t pos) {
+    uint32_t count = cands[by_freq[pos]].count;
+    size_t lo = pos;
+    size_t hi = cand_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (cands[by_freq[mid]].count >= count) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+/**
+ * Keeps candidate id if it matches the query exactly and ranks among the
+ * best so far. What's cheapest to check goes first.
+ */
+static void consider(struct search *s, uint32_t id) {
+    if (seen[id] == stamp) return;
+    seen[id] = stamp;
+    double value = score(s, id, 0);
+    if (beaten(s, value)) return;
+    if (s->bits != NULL) {
+        if (!(s->bits[id / 64] >> (id % 64) & 1)) return;
+    } else {
+        for (size_t i = 0; i < s->found; i++) {
+            if (!contains(s->lists[i], id)) return;
+        }
+    }
+    struct history_entry e;
+    if (s->verify && (history_entry_at(cands[id].last, &e) < 0 || !words_match(e.command, s->query))) return;
+    keep_result(s, id, value);
+}
+
+/**
+ * Keeps candidate id if it has at least need of the query's grams and
+ * ranks among the best so far.
+ */
+static void consider_typo(struct search *s, uint32_t id) {
+    if (seen[id] == stamp) return;
+    seen[id] = stamp;
+    if (beaten(s, score(s, id, s->n - s->found))) return;
+    size_t hits = 0;
+    for (size_t i = 0; i < s->found; i++) hits += contains(s->lists[i], id);
+    if (hits >= s->need) keep_result(s, id, score(s, id, s->n - hits));
+}
+
+/**
+ * Looks for near misses: candidates missing up to four of the query's
+ * grams, what a swapped pair of letters costs, but never half of them.
+ * Those on a sparse list are gone through; any others have their grams
+ * only in dense lists, so they're found by counting, a bit at a time,
+ * how many of those bitmaps have them.
+ */
+static void typo_pass(struct search *s) {
+    s->need = s->n - 4 > (s->n + 1) / 2 ? s->n - 4 : (s->n + 1) / 2;
+    next_stamp();
+
+    size_t dense = 0;
+    for (size_t i = 0; i < s->found; i++) {
+        if (s->lists[i]->bits != NULL) {
+            dense++;
+            continue;
+        }
+        for (uint32_t k = s->lists[i]->count; k > 0; k--) consider_typo(s, s->lists[i]->ids[k - 1]);
+    }
+    if (dense < s->need) return;
+
+    for (size_t w = cand_cap / 64; w-- > 0;) {
+        uint64_t planes[8] = { 0 };     // Bit j of each id's count
+        for (size_t i = 0; i < s->found; i++) {
+            if (s->lists[i]->bits == NULL) continue;
+            uint64_t carry = s->lists[i]->bits[w];
+            for (int j = 0; carry != 0 && j < 8; j++) {
+                uint64_t next = planes[j] & carry;
+                planes[j] ^= carry;
+                carry = next;
+            }
+        }
+        // count >= need, compared bit plane by bit plane from the top
+        uint64_t greater = 0;
+        uint64_t equal = ~0ull;
+        for (int j = 7; j >= 0; j--) {
+            if (s->need >> j & 1) {
+                equal &= planes[j];
+            } else {
+                greater |= equal & planes[j];
+                equal &= ~planes[j];
+            }
+        }
+        for (uint64_t bits = greater | equal; bits != 0; bits &= ~(1ull << (63 - __builtin_clzll(bits)))) {
+            consider_typo(s, w * 64 + 63 - __builtin_clzll(bits));
+        }
+    }
+}
+
+/**
+ * Starts a new marking of candidates in seen.
+ */
+static void next_stamp(void) {
+    if (++stamp == 0) {
+        memset(seen, 0, cand_cap * sizeof(uint32_t));
+        stamp = 1;
+    }
+}
+
+/**
+ * Whether every word of query appears in command, ignoring case.
+ */
+static int words_match(const char *command, const char *query) {
+    char word[SEARCH_QUERY_MAX];
+    while (*query != '\0') {
+        query += strspn(query, " ");
+        size_t len = strcspn(query, " ");
+        if (len == 0) break;
+        if (len >= sizeof(word)) len = sizeof(word) - 1;
+        memcpy(word, query, len);
+        word[len] = '\0';
+        if (strcasestr(command, word) == NULL) return 0;
+        query += len;
+    }
+    return 1;
+}
+
+/**
+ * Ranks a match: recent, frequent and run in the current directory are
+ * better, each missing gram (a likely typo) is worse.
+ */
+static double score(const struct search *s, uint32_t id, size_t missing) {
+    const struct candidate *c = &cands[id];
+    double value = c->freq - approx_log2(1.0 + (double) (s->total - 1 - c->last));
+    if (c->cwd_hash == s->cwd_hash) value += 3.0;
+    return value - 4.0 * missing;
+}
+
+/**
+ * Whether a match scoring value wouldn't make the results.
+ */
+static int beaten(const struct search *s, double value) {
+    return s->count == SEARCH_RESULTS && value <= s->results[SEARCH_RESULTS - 1].score;
+}
+
+/**
+ * Inserts a match into the results, kept sorted best first and cut at
+ * SEARCH_RESULTS.
+ */
+static void keep_result(struct search *s, uint32_t id, double value) {
+    if (beaten(s, value)) return;
+    size_t i = s->count < SEARCH_RESULTS ? s->count++ : SEARCH_RESULTS - 1;
+    for (; i > 0 && s->results[i - 1].score < value; i--) s->results[i] = s->results[i - 1];
+    s->results[i] = (struct result) { id, value };
+}
+
+/**
+ * log2(x) for x >= 1, to within 0.09: the exponent plus the mantissa
+ * taken as linear. Plenty for ranking, and a fraction of log2()'s cost.
+ */
+static double approx_log2(double x) {
+    uint64_t bits;
+    memcpy(&bits, &x, sizeof(bits));
+    int exponent = (int) (bits >> 52 & 0x7ff) - 1023;
+    return exponent + (double) (bits & ((1ull << 52) - 1)) / (double) (1ull << 52);
+}
+
+/**
+ * readline widget: searches the history as the query is typed, showing
+ * the best match in the line. Ctrl-R moves to the next match, Enter runs
+ * the match shown, Ctrl-G or a lone Esc gives the original line back, and
+ * any other key, arrows and other Esc sequences included, keeps the match
+ * for editing and then does what it does.
+ */
+static int search_widget(int count, int key) {
+    (void) count;
+    (void) key;
+    char query[SEARCH_QUERY_MAX] = "";
+    size_t len = 0;
+    size_t matches[SEARCH_RESULTS];
+    size_t match_count = 0;
+    size_t shown = 0;
+    char *original = strdup(rl_line_buffer);
+    int original_point = rl_point;
+    if (original == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed for history search: %s\n", strerror(errno));
+        exit(1);
+    }
+
+    rl_save_prompt();
+    while (1) {
+        struct history_entry e;
+        history_check_log();
+        int have = match_count > 0 && history_entry_at(matches[shown], &e) == 0;
+        rl_message("(fuzzy-search)`%s'%s: ", query, len > 0 && !have ? " (no match)" : "");
+        rl_replace_line(have ? e.command : original, 0);
+        rl_point = have ? rl_end : original_point;
+        rl_redisplay();
+
+        int c = rl_read_key();
+        if (c == CTRL_KEY('r')) {
+            if (shown + 1 < match_count) shown++;
+            else rl_ding();
+            continue;
+        }
+        if (c == 0x7f || c == CTRL_KEY('h')) {
+            if (len == 0) {
+                rl_ding();
+                continue;
+            }
+            query[--len] = '\0';
+        } else if (c >= ' ' && c < 0x7f && len + 1 < sizeof(query)) {
+            query[len++] = c;
+            query[len] = '\0';
+        } else if (c == CTRL_KEY('g') || (c == ESC && !key_follows())) {
+            rl_replace_line(original, 0);
+            rl_point = original_point;
+            break;
+        } else if (c == '\r' || c == '\n') {
+            rl_done = 1;
+            break;
+        } else {
+            rl_execute_next(c);
+            break;
+        }
+        match_count = len > 0 ? search_history(query, matches, SEARCH_RESULTS) : 0;
+        shown = 0;
+    }
+    rl_restore_prompt();
+    rl_clear_message();
+    free(original);
+    return 0;
+}
+
+/**
+ * Whether another key arrives within readline's keyseq-timeout, which
+ * tells an Esc starting a sequence (an arrow, Home) from one pressed on
+ * its own.
+ */
+static int key_follows(void) {
+    const char *value = rl_variable_value("keyseq-timeout");
+    int timeout = value != NULL ? atoi(value) : DEFAULT_KEYSEQ_TIMEOUT;
+    struct pollfd pfd = { fileno(rl_instream != NULL ? rl_instream : stdin), POLLIN, 0 };
+    return poll(&pfd, 1, timeout > 0 ? timeout : DEFAULT_KEYSEQ_TIMEOUT) > 0;
+}
+
+/**
+ * Whether a gram's candidates include id, from its bitmap or by binary
+ * search.
+ */
+static int contains(const struct gram *g, uint32_t id) {
+    if (g->bits != NULL) return g->bits[id / 64] >> (id % 64) & 1;
+    uint32_t lo = 0;
+    uint32_t hi = g->count;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (g->ids[mid] < id) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo < g->count && g->ids[lo] == id;
+}
+
+/**
+ * The key of the len (2 or 3) byte gram at p, ASCII lowercased.
+ */
+static uint32_t gram_key(const char *p, size_t len) {
+    uint32_t key = len == 2 ? GRAM_USED | GRAM_PAIR : GRAM_USED;
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = p[i];
+        if (c >= 'A' && c <= 'Z') c += 'a' - 'A';
+        key |= (uint32_t) c << (8 * i);
+    }
+    return key;
+}
@@ -0,0 +1,297 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <readline/readline.h>
+#include <readline/history.h>
+#include "shell.h"
+
+/*
+ * The commands the arrow keys step through, the last cap of them. Each
+ * distinct command is stored once, NUL-terminated in a single arena, and
+ * the entries are a ring of ids into it, so a long session costs one
+ * string per distinct command and four bytes per entry, and nothing is
+ * malloc'd per entry. A command no entry refers to any more leaves a
+ * hole in the arena; once holes are half of it, it's compacted.
+ *
+ * The keys bound to readline's previous-history, next-history,
+ * beginning-of-history and end-of-history (in every keymap) are rebound
+ * to the ones here, which put the stored command in the line the same
+ * way. Readline's own history list is kept too, stifled to the last
+ * READLINE_WINDOW commands, for its other history commands: M-. and M-_
+ * (yank-last-arg, yank-nth-arg), history-search-backward/forward and the
+ * substring searches, M-p/M-n, C-s and C-o (operate-and-get-next). Those
+ * only reach that far back; Ctrl-R searches the whole log instead.
+ */
+
+#define READLINE_WINDOW 100
+
+struct interned {
+    uint64_t hash;
+    uint32_t offset;        // Into arena
+    uint32_t len;
+    uint32_t refs;          // Entries that are this command, 0 if unused
+};
+
+static struct buffer arena;
+static size_t dead = 0;             // Bytes of the arena no command uses
+static struct interned *strings = NULL;
+static uint32_t handed_out = 0;     // Ids used so far, those above are untouched
+static uint32_t *unused = NULL;     // Ids below it free for reuse
+static size_t unused_count = 0;
+static uint32_t *table = NULL;      // Open addressing on hash, id + 1 per slot
+static size_t table_cap = 0;
+static uint32_t *ring = NULL;       // Ids of the entries, oldest at first
+static size_t cap = 0;
+static size_t first = 0;
+static size_t count = 0;
+
+// Browsing: the entry in the line, count while it's the one being typed
+static size_t position = 0;
+static struct buffer typed;         // The line being typed, while browsing
+static int window_offset = 0;       // Readline's offset in its list, as last set
+
+static uint32_t intern(const char *command, size_t len);
+static void release(uint32_t id);
+static void compact(void);
+static const char *entry(size_t i);
+static void show(size_t i);
+static void follow_readline(void);
+static int store_reset(void);
+static int previous_entry(int n, int key);
+static int next_entry(int n, int key);
+static int first_entry(int n, int key);
+static int last_entry(int n, int key);
+static void rebind(rl_command_func_t *from, rl_command_func_t *to);
+
+/**
+ * Sets up a store for the last size commands, and rebinds readline's
+ * history keys to it. Readline is initialized here, so that the keys
+ * inputrc binds are rebound too.
+ *
+ * Note: Calls exit(1) on allocation failure
+ */
+void store_init(size_t size) {
+    cap = size;
+    table_cap = 16;
+    while (table_cap < cap * 2) table_cap *= 2;
+    strings = malloc(cap * sizeof(struct interned));
+    unused = malloc(cap * sizeof(uint32_t));
+    ring = malloc(cap * sizeof(uint32_t));
+    table = calloc(table_cap, sizeof(uint32_t));
+    if (strings == NULL || unused == NULL || ring == NULL || table == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed for history: %s\n", strerror(errno));
+        exit(1);
+    }
+    stifle_history(size < READLINE_WINDOW ? size : READLINE_WINDOW);
+    rl_initialize();
+    rebind(rl_get_previous_history, previous_entry);
+    rebind(rl_get_next_history, next_entry);
+    rebind(rl_beginning_of_history, first_entry);
+    rebind(rl_end_of_history, last_entry);
+    rl_startup_hook = store_reset;
+}
+
+/**
+ * Adds a command as the newest entry, dropping the oldest if the store
+ * is full. command must be NUL-terminated at len, for readline's list.
+ */
+void store_add(const char *command, size_t len) {
+    if (cap == 0) return;
+    add_history(command);
+    if (count == cap) {
+        release(ring[first]);
+        first = (first + 1) % cap;
+        count--;
+    }
+    ring[(first + count) % cap] = intern(command, len);
+    count++;
+    position = count;
+}
+
+/**
+ * Finds command's id, adding it to the arena if no entry has it yet.
+ *
+ * Note: Returns the id, with its reference counted
+ */
+static uint32_t intern(const char *command, size_t len) {
+    uint64_t hash = hash_bytes(command, len);
+    size_t slot = hash & (table_cap - 1);
+    for (; table[slot] != 0; slot = (slot + 1) & (table_cap - 1)) {
+        struct interned *s = &strings[table[slot] - 1];
+        if (s->hash == hash && s->len == len && memcmp(arena.data + s->offset, command, len) == 0) {
+            s->refs++;
+            return table[slot] - 1;
+        }
+    }
+
+    // There's always one free: at most cap entries refer to strings
+    uint32_t id = unused_count > 0 ? unused[--unused_count] : handed_out++;
+    strings[id] = (struct interned) { hash, arena.len, len, 1 };
+    buffer_append(&arena, command, len);
+    buffer_append(&arena, "", 1);
+    table[slot] = id + 1;
+    return id;
+}
+
+/**
+ * Drops an entry's reference to its command, removing the command once
+ * no entry has it.
+ */
+static void release(uint32_t id) {
+    struct interned *s = &strings[id];
+    if (--s->refs > 0) return;
+
+    // Remove it from the table, moving later entries of its run back
+    size_t slot = s->hash & (table_cap - 1);
+    while (table[slot] != id + 1) slot = (slot + 1) & (table_cap - 1);
+    size_t next = slot;
+    while (1) {
+        next = (next + 1) & (table_cap - 1);
+        if (table[next] == 0) break;
+        size_t home = strings[table[next] - 1].hash & (table_cap - 1);
+        // Stays put if its home lies cyclically in (slot, next]
+        if (slot <= next ? (slot < home && home <= next) : (slot < home || home <= next)) continue;
+        table[slot] = table[next];
+        slot = next;
+    }
+    table[slot] = 0;
+
+    unused[unused_count++] = id;
+    dead += s->len + 1;
+    if (dead > arena.len / 2) compact();
+}
+
+/**
+ * Rewrites the arena with only the commands entries have.
+ */
+static void compact(void) {
+    struct buffer fresh;
+    buffer_init(&fresh);
+    buffer_reserve(&fresh, arena.len - dead);
+    for (size_t id = 0; id < handed_out; id++) {
+        if (strings[id].refs == 0) continue;
+        uint32_t offset = fresh.len;
+        buffer_append(&fresh, arena.data + strings[id].offset, strings[id].len + 1);
+        strings[id].offset = offset;
+    }
+    buffer_free(&arena);
+    arena = fresh;
+    dead = 0;
+}
+
+/**
+ * The command of entry i, oldest first.
+ */
+static const char *entry(size_t i) {
+    return arena.data + strings[ring[(first + i) % cap]].offset;
+}
+
+/**
+ * Puts entry i in the line, or the line that was being typed if i is
+ * count, with the cursor at the end.
+ */
+static void show(size_t i) {
+    if (position == count) {
+        typed.len = 0;
+        buffer_append(&typed, rl_line_buffer, rl_end);
+    }
+    position = i;
+    rl_replace_line(i < count ? entry(i) : typed.data, 0);
+    rl_point = rl_end;
+
+    // Keep readline's offset on the same entry, for operate-and-get-next
+    size_t older = count - history_length;
+    window_offset = i > older ? i - older : 0;
+    history_set_pos(window_offset);
+}
+
+/**
+ * Moves to the entry readline's own commands left its offset on, if they
+ * moved it since show().
+ */
+static void follow_readline(void) {
+    int offset = where_history();
+    if (offset == window_offset) return;
+    window_offset = offset;
+    position = count - history_length + offset;
+}
+
+/**
+ * readline startup hook: each line starts out as the one being typed.
+ */
+static int store_reset(void) {
+    position = count;
+    window_offset = history_length;
+    history_set_pos(window_offset);
+    return 0;
+}
+
+/**
+ * readline command standing in for previous-history: steps n entries
+ * back (forward if n is negative).
+ */
+static int previous_entry(int n, int key) {
+    if (n < 0) return next_entry(-n, key);
+    follow_readline();
+    if (position == 0 || n == 0) {
+        if (n != 0) rl_ding();
+        return 0;
+    }
+    show(position > (size_t) n ? position - n : 0);
+    return 0;
+}
+
+/**
+ * readline command standing in for next-history: steps n entries
+ * forward, to the line being typed at most.
+ */
+static int next_entry(int n, int key) {
+    if (n < 0) return previous_entry(-n, key);
+    follow_readline();
+    if (position == count || n == 0) {
+        if (n != 0) rl_ding();
+        return 0;
+    }
+    show(count - position > (size_t) n ? position + n : count);
+    return 0;
+}
+
+/**
+ * readline command standing in for beginning-of-history.
+ */
+static int first_entry(int n, int key) {
+    (void) n;
+    (void) key;
+    if (count > 0 && position != 0) show(0);
+    return 0;
+}
+
+/**
+ * readline command standing in for end-of-history.
+ */
+static int last_entry(int n, int key) {
+    (void) n;
+    (void) key;
+    if (position != count) show(count);
+    return 0;
+}
+
+/**
+ * Binds the keys that run from, in the emacs and vi keymaps, to to.
+ */
+static void rebind(rl_command_func_t *from, rl_command_func_t *to) {
+    static const char *const keymaps[] = { "emacs", "vi-command", "vi-insert" };
+    for (size_t m = 0; m < sizeof(keymaps) / sizeof(keymaps[0]); m++) {
+        Keymap map = rl_get_keymap_by_name(keymaps[m]);
+        if (map == NULL) continue;
+        char **keys = rl_invoking_keyseqs_in_map(from, map);
+        if (keys == NULL) continue;
+        for (size_t i = 0; keys[i] != NULL; i++) {
+            rl_bind_keyseq_in_map(keys[i], to, map);
+            free(keys[i]);
+        }
+        free(keys);
+    }
+}
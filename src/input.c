@@ -0,0 +1,176 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <readline/readline.h>
+#include "shell.h"
+
+// Source lines come from, NULL for the interactive prompt
+static struct input_source *current = NULL;
+
+/**
+ * Opens a script as an input source. A regular file is read in one go
+ * into a private buffer sized from fstat(), so a script rewritten or
+ * truncated while it runs can't pull its lines out from under the shell.
+ *
+ * Note: Returns 0 on success, -1 w/ errno set if it couldn't be read
+ */
+int input_open(const char *path, struct input_source *src) {
+    memset(src, 0, sizeof(struct input_source));
+    src->name = path;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+    if (S_ISDIR(st.st_mode)) {
+        close(fd);
+        errno = EISDIR;
+        return -1;
+    }
+
+    struct buffer buf;
+    buffer_init(&buf);
+    if (S_ISREG(st.st_mode)) buffer_reserve(&buf, st.st_size);
+    while (1) {
+        if (buf.len + 1 >= buf.cap) buffer_reserve(&buf, INIT_BUFFER_CAP);
+        ssize_t n = read(fd, buf.data + buf.len, buf.cap - buf.len - 1);
+        if (n == -1 && errno == EINTR) continue;
+        if (n == -1) {
+            int saved = errno;
+            buffer_free(&buf);
+            close(fd);
+            errno = saved;
+            return -1;
+        }
+        if (n == 0) break;
+        buf.len += n;
+    }
+    close(fd);
+    src->len = buf.len;
+    src->data = buffer_release(&buf);
+    return 0;
+}
+
+/**
+ * Sets up a stream, the shell's stdin when it isn't a terminal, as an
+ * input source read through a large stdio buffer. Like dash, this reads
+ * ahead: a command that reads the shell's own stdin won't see the lines
+ * already buffered.
+ */
+void input_stream(FILE *stream, const char *name, struct input_source *src) {
+    memset(src, 0, sizeof(struct input_source));
+    src->name = name;
+    src->stream = stream;
+    setvbuf(stream, NULL, _IOFBF, STREAM_BUF_SIZE);
+}
+
+/**
+ * Sets up a command string as an input source, without copying it. The
+ * string must outlive the source and isn't freed by input_close().
+ */
+void input_string(const char *text, const char *name, struct input_source *src) {
+    memset(src, 0, sizeof(struct input_source));
+    src->name = name;
+    src->data = text;
+    src->len = strlen(text);
+    src->borrowed = 1;
+}
+
+/**
+ * Frees what input_open() and cache_attach() set up.
+ */
+void input_close(struct input_source *src) {
+    cache_free(src->cache);
+    src->cache = NULL;
+    if (!src->borrowed) {
+        free((char *) src->data);
+    }
+    src->data = NULL;
+}
+
+/**
+ * Makes src the source of input_line(), until input_pop(). Sources nest,
+ * the previous one is resumed when src is popped.
+ */
+void input_push(struct input_source *src) {
+    src->prev = current;
+    current = src;
+}
+
+/**
+ * Goes back to the source that was current before the last input_push().
+ */
+void input_pop(void) {
+    if (current != NULL) current = current->prev;
+}
+
+/**
+ * Drops every pushed source, going back to the interactive prompt. For
+ * the Ctrl-C jump, which abandons the runs that would have popped them.
+ */
+void input_reset(void) {
+    current = NULL;
+}
+
+/**
+ * Returns whether the current source has no lines left. The prompt and
+ * streams never run out ahead of time.
+ */
+int input_eof(void) {
+    return current != NULL && current->stream == NULL && current->pos >= current->len;
+}
+
+/**
+ * Returns whether lines come from the interactive prompt.
+ */
+int input_interactive(void) {
+    return current == NULL;
+}
+
+/**
+ * Reads the next line, without its newline, from the current source: the
+ * script or stream if one is pushed, otherwise readline() with prompt.
+ *
+ * Note: Returns a malloc'd line, or NULL at end of input
+ */
+char *input_line(const char *prompt) {
+    if (current == NULL) return readline(prompt);
+
+    struct input_source *src = current;
+    if (src->cache != NULL) return cache_next_line(src->cache);
+    if (src->stream != NULL) {
+        char *line = NULL;
+        size_t cap = 0;
+        ssize_t len = getdelim(&line, &cap, '\n', src->stream);
+        if (len == -1) {
+            free(line);
+            return NULL;
+        }
+        if (len > 0 && line[len - 1] == '\n') line[len - 1] = '\0';
+        return line;
+    }
+    if (src->pos >= src->len) return NULL;
+
+    const char *start = src->data + src->pos;
+    const char *nl = memchr(start, '\n', src->len - src->pos);
+    size_t len = nl ? (size_t) (nl - start) : src->len - src->pos;
+    src->pos += len + (nl != NULL);
+
+    char *line = strndup(start, len);
+    if (line == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed while reading '%s': %s\n", src->name, strerror(errno));
+        exit(1);
+    }
+    return line;
+}
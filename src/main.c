@@ -3,67 +3,87 @@
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
-#include <fcntl.h>
 #include <signal.h>
 #include <setjmp.h>
 #include <sys/wait.h>
-#include <readline/readline.h>
-#include <readline/history.h>
-
-// Constants
-#define MAX_CWD_SIZE 1024
-#define INIT_CMD_CAP 8
-#define TRUNCATE 0
-#define APPEND 1
-
-// Structures
-struct redirect_info {
-    char *input_file;
-    char *output_file;
-    char *error_file;
-    int output_mode;
-};
+#include "shell.h"
 
 // Global variables
 static volatile sig_atomic_t jump_flag = 0;
 static sigjmp_buf env;
+volatile sig_atomic_t exit_requested = 0;
+int exit_status = 0;
+int last_status = 0;
+int command_expanded_at = -1;   // Stage's expanded_at, for the builtin it runs
+int command_deferred = 0;       // Stage's deferred, for the builtin it runs
 
 // Function prototypes
-void setup_redirects(char **command, struct redirect_info *redir);
-void apply_redirects(struct redirect_info *redir);
 void setup_sigaction_handler(void);
 void sigint_handler();
-char **inputToCommand(char *input);
-void freeCommand(char **command);
-int cd(char *path);
+static int run_script(const char *path, int argc, char **argv, int use_cache);
 
 /**
- * Main shell lifecycle: Input, parse, execute, free.
+ * Main shell lifecycle: Input, parse, expand, execute, free.
+ *
+ * `bshell [--no-cache] script args...` runs the script instead, `bshell
+ * -c string [name args...]` the string, and commands piped into stdin are
+ * read in bulk, with the prompt and readline never touched. Only the
+ * interactive shell loads the rc file, see rc_load().
  */
-int main() {
+int main(int argc, char **argv) {
+    if (argc > 1 && strcmp(argv[1], "-c") == 0) {
+        if (argc < 3) {
+            fprintf(stderr, "bshell: -c: option requires an argument\n");
+            return 2;
+        }
+        struct input_source src;
+        input_string(argv[2], "-c", &src);
+        if (argc > 3) {
+            set_positional(argc - 3, argv + 3);
+        } else {
+            set_positional(1, argv);
+        }
+        return run_source(&src, 1);
+    }
+    if (argc > 2 && strcmp(argv[1], "--no-cache") == 0) {
+        return run_script(argv[2], argc - 2, argv + 2, 0);
+    }
+    if (argc > 1) {
+        return run_script(argv[1], argc - 1, argv + 1, 1);
+    }
+
+    // Commands piped in: no prompt, no history, no readline
+    set_positional(1, argv);
+    if (!isatty(STDIN_FILENO)) {
+        struct input_source src;
+        input_stream(stdin, "stdin", &src);
+        return run_source(&src, 0);
+    }
+
     char *input = NULL;
-    char **command;
-    pid_t child_pid;
-    int status;
-    char cwd[MAX_CWD_SIZE];
 
     setup_sigaction_handler();
+    prompt_init();
+    rc_load();
+    history_init();
+    search_init();
+    if (exit_requested) {
+        return exit_status;
+    }
 
     while(1) {
         // Set jump point
         if (sigsetjmp(env, 1) == 42) {
+            fds_reset();    // Before the newline, so it reaches the terminal
             printf("\n");
+            history_end(130);
+            source_reset();
+            procsubst_release(0);
+            while (waitpid(-1, NULL, WNOHANG) > 0);  // Reap interrupted children
         }
         jump_flag = 1;
 
-        // Prepend cwd to prompt
-        if (getcwd(cwd, sizeof(cwd)) == NULL) {
-            fprintf(stderr, "Warning: Unable to determine current directory: %d\n", errno);
-            strcpy(cwd, "???");  // Fallback if cwd error
-        }
-        size_t len = strlen(cwd);
-        snprintf(cwd + len, sizeof(cwd) - len, "> ");
-        input = readline(cwd);
+        input = input_line(prompt_render());
 
         // Handle CTRL-D (EOF)
         if (input == NULL) {
@@ -77,182 +97,116 @@ int main() {
             continue;
         }
 
-        add_history(input);
-
-        command = inputToCommand(input);
-
-        struct redirect_info redir;
-        setup_redirects(command, &redir);
+        history_begin(input);
+        run_line(input, 0);
+        history_end(last_status);
+        free(input);
 
-        // Skip if only whitespaces
-        if (!command[0]) {
-            free(input);
-            freeCommand(command);
-            continue;
-        }
-
-        // Built-in: exit
-        if (strcmp(command[0], "exit") == 0) {
-            free(input);
-            freeCommand(command);
-            break;
+        if (exit_requested) {
+            return exit_status;
         }
+    }
 
-        // Built-in: cd
-        if (strcmp(command[0], "cd") == 0) {
-            if (command[1] == NULL) {
-                fprintf(stderr, "cd: missing operand\n");
-                fprintf(stderr, "Usage: cd <directory>\n");
-            } else if (cd(command[1]) < 0) {
-                fprintf(stderr, "cd: cannot change directory to '%s': %s\n", command[1], strerror(errno));
-            }
-            free(input);
-            freeCommand(command);
-            continue;
-        }
+    return 0;
+}
 
-        child_pid = fork();
+/**
+ * Runs one line of input: parse, expand, execute, free. last_status is
+ * set to its result. With last set the shell has nothing left to do, so
+ * a single command replaces it through exec_pipeline() instead of being
+ * forked and waited for.
+ */
+void run_line(char *input, int last) {
+    run_tokens(inputToCommand(input), last);
+}
 
-        if (child_pid < 0) {
-            fprintf(stderr, "Error: Failed to create child process: %s\n", strerror(errno));
-            free(input);
-            freeCommand(command);
-            continue;
-        } else if (child_pid == 0) {
-            // Child path
-            apply_redirects(&redir);
-            signal(SIGINT, SIG_DFL);
-            execvp(command[0], command);
-            fprintf(stderr, "Error: Command not found or failed to execute '%s': %s\n", command[0], strerror(errno));
-            exit(1);
-        } else {
-            // Parent path
-            waitpid(child_pid, &status, WUNTRACED);
-        }
+/**
+ * run_line() for a line already tokenized, as the script cache stores
+ * them. Takes over the tokens array.
+ */
+void run_tokens(char **tokens, int last) {
+    struct pipeline pl;
+    if (parse_tokens(tokens, &pl) < 0 || expand_pipeline(&pl) < 0) {
+        last_status = 1;
+        free_pipeline(&pl);
+        procsubst_release(0);
+        return;
+    }
 
-        free(input);
-        freeCommand(command);
+    // Skip if only whitespaces
+    if (pl.count == 1 && !pl.stages[0].command[0] && !has_redirects(&pl.stages[0].redir)) {
+        free_pipeline(&pl);
+        procsubst_release(0);
+        return;
     }
 
-    return 0;
+    if (last) exec_pipeline(&pl);
+    last_status = execute_pipeline(&pl);
+
+    free_pipeline(&pl);
+    procsubst_release(0);
 }
 
 /**
- * Scrapes a command for <, >, >>, 2> and their targets, storing
- * redirect info into a struct for child execution.
+ * Runs a script line by line with argv as its positional parameters
+ * ($0 is the script). With use_cache, it runs from the parsed form kept
+ * by the script cache, see cache_attach().
+ *
+ * Note: Returns the exit status of the last command, or exit's, or
+ * 127/126 if the script couldn't be read
  */
-void setup_redirects(char **command, struct redirect_info *redir) {
-    // Initialize the struct
-    redir->input_file = NULL;
-    redir->output_file = NULL;
-    redir->error_file = NULL;
-    redir->output_mode = TRUNCATE;
-    
-    int write_idx = 0; // Where we write cleaned args
-    
-    // Parse through command array
-    for (int i = 0; command[i] != NULL; i++) {
-        if (strcmp(command[i], "<") == 0) {
-            // Input redirection
-            if (command[i + 1] != NULL) {
-                redir->input_file = command[i + 1];
-                i++; // Skip the filename
-            }
-        } else if (strcmp(command[i], ">") == 0) {
-            // Output redirection (truncate)
-            if (command[i + 1] != NULL) {
-                redir->output_file = command[i + 1];
-                redir->output_mode = TRUNCATE;
-                i++;
-            }
-        } else if (strcmp(command[i], ">>") == 0) {
-            // Output redirection (append)
-            if (command[i + 1] != NULL) {
-                redir->output_file = command[i + 1];
-                redir->output_mode = APPEND;
-                i++;
-            }
-        } else if (strcmp(command[i], "2>") == 0) {
-            // Error redirection
-            if (command[i + 1] != NULL) {
-                redir->error_file = command[i + 1];
-                i++;
-            }
-        } else {
-            // Regular command argument - keep it
-            command[write_idx++] = command[i];
-        }
-    }
-    
-    // Null-terminate at the new end
-    command[write_idx] = NULL;
+static int run_script(const char *path, int argc, char **argv, int use_cache) {
+    set_positional(argc, argv);
+    return run_file(path, use_cache);
 }
 
-
 /**
- * Apply file redirections for stdin, stdout, and stderr.
+ * Runs a file in the current shell, from the script cache when use_cache
+ * is set. The file is recorded as a dependency of the rc snapshot being
+ * taken, if any.
  *
- * Note: This function exits the process on error, as it's intended to be
- * called after forking in a child process. File descriptors are closed after
- * duplication. Calls exit(1) when open/dup2 fails
+ * Note: Returns the exit status of the last command, or exit's, or
+ * 127/126 w/ message if the file couldn't be read
  */
-void apply_redirects(struct redirect_info *redir) {
-    int fd;
-    
-    // Handle input redirection
-    if (redir->input_file != NULL) {
-        fd = open(redir->input_file, O_RDONLY);
-        if (fd == -1) {
-            fprintf(stderr, "Error: Failed to open input file '%s': %s\n",
-                    redir->input_file, strerror(errno));
-            exit(1);
-        }
-        if (dup2(fd, STDIN_FILENO) == -1) {
-            fprintf(stderr, "Error: Failed to redirect stdin from '%s': %s\n",
-                    redir->input_file, strerror(errno));
-            close(fd);
-            exit(1);
-        }
-        close(fd);
+int run_file(const char *path, int use_cache) {
+    struct input_source src;
+    if (input_open(path, &src) < 0) {
+        fprintf(stderr, "bshell: %s: %s\n", path, strerror(errno));
+        return errno == ENOENT ? 127 : 126;
     }
-    
-    // Handle output redirection
-    if (redir->output_file != NULL) {
-        if (redir->output_mode == APPEND) {
-            fd = open(redir->output_file, O_WRONLY | O_CREAT | O_APPEND, 0644);
-        } else {
-            fd = open(redir->output_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-        }
-        if (fd == -1) {
-            fprintf(stderr, "Error: Failed to open output file '%s': %s\n",
-                    redir->output_file, strerror(errno));
-            exit(1);
-        }
-        if (dup2(fd, STDOUT_FILENO) == -1) {
-            fprintf(stderr, "Error: Failed to redirect stdout to '%s': %s\n",
-                    redir->output_file, strerror(errno));
-            close(fd);
-            exit(1);
-        }
-        close(fd);
-    }
-    
-    // Handle error redirection
-    if (redir->error_file != NULL) {
-        fd = open(redir->error_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-        if (fd == -1) {
-            fprintf(stderr, "Error: Failed to open error file '%s': %s\n",
-                    redir->error_file, strerror(errno));
-            exit(1);
-        }
-        if (dup2(fd, STDERR_FILENO) == -1) {
-            fprintf(stderr, "Error: Failed to redirect stderr to '%s': %s\n",
-                    redir->error_file, strerror(errno));
-            close(fd);
-            exit(1);
+
+    snapshot_depend(path);
+    if (use_cache) cache_attach(&src, path);
+    int status = run_source(&src, 0);
+    input_close(&src);
+    return status;
+}
+
+/**
+ * Runs every line of a non-interactive source. Outside the interactive
+ * shell SIGINT keeps its default action, so Ctrl-C stops the whole run
+ * rather than returning to a prompt; a file sourced at the prompt is cut
+ * short and the prompt comes back, see source_reset(). With exec_last,
+ * the final line may exec in place of the shell.
+ *
+ * Note: Returns the exit status of the last command, or exit's
+ */
+int run_source(struct input_source *src, int exec_last) {
+    input_push(src);
+    if (src->cache != NULL) {
+        char **tokens;
+        while (!exit_requested && (tokens = cache_next_tokens(src->cache)) != NULL) {
+            run_tokens(tokens, 0);
+        }
+    } else {
+        char *line;
+        while (!exit_requested && (line = input_line(NULL)) != NULL) {
+            run_line(line, exec_last && input_eof());
+            free(line);
         }
-        close(fd);
     }
+    input_pop();
+    return exit_requested ? exit_status : last_status;
 }
 
 /**
@@ -277,86 +231,3 @@ void sigint_handler() {
     }
     siglongjmp(env, 42);
 }
-
-/**
- * Tokenizes input string into a dynamically-allocated array of command arguments.
- * 
- * Note:
- * - Calls exit(1) on allocation failure
- * - Returns an array with just null if input is all whitespace.
- */
-char **inputToCommand(char *input) {
-    int capacity = INIT_CMD_CAP;
-    int count = 0;
-    char **command = malloc(capacity * sizeof(char *));
-    
-    if (command == NULL) {
-        fprintf(stderr, "Error: Memory allocation failed for command array: %s\n", strerror(errno));
-        exit(1);
-    }
-
-    // Safety copy since strtok modifies the string
-    char *input_copy = strdup(input);
-    if (input_copy == NULL) {
-        fprintf(stderr, "Error: Memory allocation failed while copying input: %s\n", strerror(errno));
-        free(command);
-        exit(1);
-    }
-
-    char *token = strtok(input_copy, " ");
-    
-    while (token != NULL) {
-        // Resize array if needed (leave room for NULL terminator)
-        if (count >= capacity - 1) {
-            capacity *= 2;
-            char **temp = realloc(command, capacity * sizeof(char *));
-            if (temp == NULL) {
-                fprintf(stderr, "Error: Memory reallocation failed while expanding command array: %s\n", strerror(errno));
-                freeCommand(command);
-                free(input_copy);
-                exit(1);
-            }
-            command = temp;
-        }
-        
-        // Duplicate each token so it persists after input_copy is freed
-        command[count] = strdup(token);
-        if (command[count] == NULL) {
-            fprintf(stderr, "Error: Memory allocation failed while copying token: %s\n", strerror(errno));
-            freeCommand(command);
-            free(input_copy);
-            exit(1);
-        }
-        count++;
-        token = strtok(NULL, " ");
-    }
-    
-    command[count] = NULL;  // null-terminate the array for execvp
-    free(input_copy);
-    return command;
-}
-
-/**
- * Frees memory used by command array created by inputToCommand().
- * 
- * Iterates through array, freeing each individual string,
- * then frees the array itself. Safe to call with NULL pointer.
- * 
- */
-void freeCommand(char **command) {
-    if (command == NULL) return;
-    
-    for (int i = 0; command[i] != NULL; i++) {
-        free(command[i]);
-    }
-    free(command);
-}
-
-/**
- * Built-in change directory function.
- * 
- * Note: Returns 0 on success, -1 on failure w/ errno set
- */
-int cd(char *path) {
-    return chdir(path);
-}
@@ -0,0 +1,208 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include "shell.h"
+
+#define MAPFILE_CHUNK 65536
+#define INIT_ITEM_CAP 1024
+
+static int slurp_input(int fd, struct stat *st, struct array *arr);
+static int read_input(int fd, char delim, long limit, struct array *arr);
+static void index_items(struct array *arr, char delim, long limit);
+static void grow_index(struct array *arr, size_t *cap);
+
+/**
+ * Built-in: mapfile [-t] [-d delim] [-n count] [array]
+ * (also readarray)
+ *
+ * Reads stdin into an array, one item per line (or per delim), MAPFILE
+ * if no name is given. -t drops the delimiters, -n stops after count
+ * items.
+ *
+ * The rest of a regular file is read into one block with a single
+ * read(), and only the item boundaries are found up front, with the
+ * vectorized find_delims() scan. The array copies an item out only when
+ * it's accessed, so loading a large file costs no read() or malloc() per
+ * line. The block is private, so the file changing or shrinking later
+ * doesn't affect the array. Anything else is read in large chunks into
+ * one block, indexed the same way; with -n a pipe is read a byte at a
+ * time so nothing past the last item is consumed.
+ *
+ * Note: Returns 0 on success, 1 on a read error, 2 on bad usage
+ */
+int builtin_mapfile(char **argv) {
+    char delim = '\n';
+    long limit = -1;
+    int trim = 0;
+    int i = 1;
+
+    for (; argv[i] != NULL && argv[i][0] == '-' && argv[i][1] != '\0'; i++) {
+        if (strcmp(argv[i], "--") == 0) {
+            i++;
+            break;
+        }
+        if (strcmp(argv[i], "-t") == 0) {
+            trim = 1;
+        } else if (strcmp(argv[i], "-d") == 0 && argv[i + 1] != NULL) {
+            delim = argv[++i][0];
+        } else if (strcmp(argv[i], "-n") == 0 && argv[i + 1] != NULL) {
+            char *end;
+            limit = strtol(argv[++i], &end, 10);
+            if (*argv[i] == '\0' || *end != '\0' || limit < 0) {
+                fprintf(stderr, "%s: %s: invalid count\n", argv[0], argv[i]);
+                return 2;
+            }
+            if (limit == 0) limit = -1;     // 0 means all, like bash
+        } else {
+            fprintf(stderr, "%s: usage: %s [-t] [-d delim] [-n count] [array]\n", argv[0], argv[0]);
+            return 2;
+        }
+    }
+
+    const char *name = argv[i] != NULL ? argv[i] : "MAPFILE";
+    if (!valid_name(name, strlen(name)) || (argv[i] != NULL && argv[i + 1] != NULL)) {
+        fprintf(stderr, "%s: '%s': not a valid array name\n", argv[0], name);
+        return 2;
+    }
+
+    struct array arr;
+    memset(&arr, 0, sizeof(struct array));
+    arr.trim = trim;
+
+    struct stat st;
+    off_t start = -1;
+    int slurped = fstat(STDIN_FILENO, &st) == 0 && S_ISREG(st.st_mode) &&
+                  (start = lseek(STDIN_FILENO, 0, SEEK_CUR)) >= 0 &&
+                  slurp_input(STDIN_FILENO, &st, &arr) == 0;
+    if (!slurped && read_input(STDIN_FILENO, delim, start >= 0 ? -1 : limit, &arr) < 0) {
+        free(arr.data);
+        return 1;
+    }
+    index_items(&arr, delim, limit);
+
+    // Leave a regular file's offset just past the last item taken
+    if (start >= 0 && arr.count > 0) {
+        size_t used = arr.ends[arr.count - 1] + (arr.ends[arr.count - 1] < arr.len);
+        lseek(STDIN_FILENO, start + (off_t) used, SEEK_SET);
+    }
+    set_array(name, &arr);
+    return 0;
+}
+
+/**
+ * Reads the rest of a regular file, from its current offset on, with one
+ * read() of the size fstat() gave (more only if that comes up short). The
+ * offset isn't moved, the caller sets it past the items taken.
+ *
+ * Note: Returns 0 on success (an empty rest included, nothing is read
+ * then), -1 if it couldn't be read, leaving the offset for read_input()
+ */
+static int slurp_input(int fd, struct stat *st, struct array *arr) {
+    off_t offset = lseek(fd, 0, SEEK_CUR);
+    if (offset < 0) return -1;
+    if (offset >= st->st_size) return 0;
+
+    size_t want = st->st_size - offset;
+    char *data = malloc(want + 1);
+    if (data == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed for mapfile: %s\n", strerror(errno));
+        exit(1);
+    }
+    size_t len = 0;
+    while (len < want) {
+        ssize_t n = pread(fd, data + len, want - len, offset + len);
+        if (n == -1 && errno == EINTR) continue;
+        if (n == -1) {
+            free(data);
+            return -1;
+        }
+        if (n == 0) break;      // The file shrank since fstat()
+        len += n;
+    }
+    data[len] = '\0';
+
+    arr->data = data;
+    arr->len = len;
+    return 0;
+}
+
+/**
+ * Reads all of fd into arr's data in large chunks, or with limit set a
+ * byte at a time until limit delimiters have been read.
+ *
+ * Note: Returns 0 on success, -1 w/ message on a read error
+ */
+static int read_input(int fd, char delim, long limit, struct array *arr) {
+    struct buffer buf;
+    buffer_init(&buf);
+    long seen = 0;
+
+    while (limit < 0 || seen < limit) {
+        buffer_reserve(&buf, limit < 0 ? MAPFILE_CHUNK : 1);
+        ssize_t n = read(fd, buf.data + buf.len, limit < 0 ? MAPFILE_CHUNK : 1);
+        if (n == -1 && errno == EINTR) continue;
+        if (n == -1) {
+            fprintf(stderr, "mapfile: read error: %s\n", strerror(errno));
+            buffer_free(&buf);
+            return -1;
+        }
+        if (n == 0) break;
+        if (limit >= 0 && buf.data[buf.len] == delim) seen++;
+        buf.len += n;
+    }
+
+    arr->len = buf.len;
+    arr->data = buf.len > 0 ? buffer_release(&buf) : NULL;
+    buffer_free(&buf);
+    return 0;
+}
+
+/**
+ * Finds where each item of arr's data ends, stopping after limit items
+ * when limit isn't -1. A final item without a delimiter ends at len.
+ *
+ * Note: Calls exit(1) on allocation failure
+ */
+static void index_items(struct array *arr, char delim, long limit) {
+    size_t cap = 0;
+    size_t max = limit < 0 ? (size_t) -1 : (size_t) limit;
+    size_t pos = 0;
+
+    while (arr->count < max) {
+        if (arr->count == cap) grow_index(arr, &cap);
+        size_t room = cap - arr->count < max - arr->count ? cap - arr->count : max - arr->count;
+        size_t found = find_delims(arr->data + pos, arr->len - pos, delim, arr->ends + arr->count, room);
+        for (size_t i = arr->count; i < arr->count + found; i++) {
+            arr->ends[i] += pos;
+        }
+        arr->count += found;
+        if (found < room) break;
+        pos = arr->ends[arr->count - 1] + 1;
+    }
+
+    // Whatever follows the last delimiter is one last item
+    size_t tail = arr->count > 0 ? arr->ends[arr->count - 1] + 1 : 0;
+    if (arr->count < max && tail < arr->len) {
+        if (arr->count == cap) grow_index(arr, &cap);
+        arr->ends[arr->count++] = arr->len;
+    }
+}
+
+/**
+ * Doubles the room in arr's index of item ends.
+ *
+ * Note: Calls exit(1) on allocation failure
+ */
+static void grow_index(struct array *arr, size_t *cap) {
+    *cap = *cap ? *cap * 2 : INIT_ITEM_CAP;
+    size_t *temp = realloc(arr->ends, *cap * sizeof(size_t));
+    if (temp == NULL) {
+        fprintf(stderr, "Error: Memory reallocation failed for array index: %s\n", strerror(errno));
+        exit(1);
+    }
+    arr->ends = temp;
+}
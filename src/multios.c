@@ -0,0 +1,289 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include "shell.h"
+
+#define FANOUT_BUF_SIZE 65536
+
+struct fanout_target {
+    int fd;
+    int via[2];         // Private pipe tee(2) copies into, -1 for the last target
+    int use_rw;         // splice(2) refused this fd, copy through userspace
+    int dead;           // Reader went away or write failed, discard its share
+};
+
+static int fanout(int in, struct fanout_target *targets, int n);
+static int drain(int src, struct fanout_target *t, size_t len, char **scratch);
+static void close_except(int *keep, int n);
+
+/**
+ * Returns whether a command's stdout must be fanned out: more than one
+ * > or >> target, or any target on a stage that also pipes to the next
+ * (extra_fd != -1), like zsh's multios.
+ */
+int needs_fanout(struct redirect_info *redir, int extra_fd) {
+    return redir->output_count > 1 || (redir->output_count == 1 && extra_fd != -1);
+}
+
+/**
+ * Opens every output target and forks a helper that copies a fresh pipe
+ * into all of them (plus extra_fd, the next pipeline stage, if not -1).
+ * The pipe's write end is stored in redir->output_fd for apply_redirects().
+ *
+ * The copying happens in the kernel: tee(2) duplicates the pipe's pages
+ * into a private pipe per target without consuming them, splice(2) moves
+ * those into the target, and the last target gets the original pages
+ * spliced straight from the input.
+ *
+ * Note: Returns the helper's pid to wait on, -1 on failure w/ message
+ */
+pid_t start_fanout(struct redirect_info *redir, int extra_fd) {
+    int n = redir->output_count + (extra_fd != -1);
+    int *fds = malloc(n * sizeof(int));
+    if (fds == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed for output targets: %s\n", strerror(errno));
+        exit(1);
+    }
+
+    // Open in order, so an error stops before later targets are truncated
+    for (int i = 0; i < redir->output_count; i++) {
+        fds[i] = open_output(&redir->outputs[i]);
+        if (fds[i] == -1) {
+            while (i-- > 0) close(fds[i]);
+            free(fds);
+            return -1;
+        }
+    }
+    if (extra_fd != -1) {
+        fds[n - 1] = extra_fd;
+    }
+
+    int mp[2];
+    if (pipe2(mp, O_CLOEXEC) == -1) {
+        fprintf(stderr, "Error: Failed to create output fan-out pipe: %s\n", strerror(errno));
+        for (int i = 0; i < redir->output_count; i++) close(fds[i]);
+        free(fds);
+        return -1;
+    }
+
+    fflush(stdout);
+    pid_t helper = fork();
+
+    if (helper < 0) {
+        fprintf(stderr, "Error: Failed to create child process: %s\n", strerror(errno));
+        close(mp[0]);
+        close(mp[1]);
+    } else if (helper == 0) {
+        // Helper path, keep only the input and the targets so readers of
+        // other pipes in the shell still see EOF on time
+        signal(SIGINT, SIG_DFL);
+        signal(SIGPIPE, SIG_IGN);
+        close(mp[1]);
+
+        int *keep = malloc((n + 1) * sizeof(int));
+        if (keep == NULL) exit(1);
+        keep[0] = mp[0];
+        memcpy(keep + 1, fds, n * sizeof(int));
+        close_except(keep, n + 1);
+        exit(fanout_fds(mp[0], fds, n) < 0 ? 1 : 0);
+    } else {
+        // Parent path
+        close(mp[0]);
+        redir->output_fd = mp[1];
+    }
+
+    for (int i = 0; i < redir->output_count; i++) close(fds[i]);
+    free(fds);
+    return helper;
+}
+
+/**
+ * Copies everything read from the pipe in to each of the n fds until EOF,
+ * in the calling process. Used by the fan-out helper, and directly for
+ * command-less redirections reading a pipe.
+ *
+ * Note: Returns 0 on success, -1 if copying failed outright
+ */
+int fanout_fds(int in, int *fds, int n) {
+    if (n == 1) {
+        return copy_fd(in, NULL, fds[0]);
+    }
+
+    struct fanout_target *targets = calloc(n, sizeof(*targets));
+    if (targets == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed for output targets: %s\n", strerror(errno));
+        return -1;
+    }
+    for (int i = 0; i < n; i++) {
+        targets[i].fd = fds[i];
+    }
+
+    int status = fanout(in, targets, n);
+    free(targets);
+    return status;
+}
+
+/**
+ * Copies everything read from the pipe in to all n targets until EOF.
+ * Each round tees one chunk into every private pipe, drains those into
+ * their targets, then moves the chunk itself into the last target.
+ *
+ * Note: Needs n >= 2. Returns 0 on success, -1 if a kernel copy failed
+ * outright.
+ */
+static int fanout(int in, struct fanout_target *targets, int n) {
+    char *scratch = NULL;
+    int status = 0;
+
+    // A chunk must fit every private pipe in one tee, or copies would drift
+    long chunk = fcntl(in, F_GETPIPE_SZ);
+    if (chunk <= 0) chunk = FANOUT_BUF_SIZE;
+    for (int i = 0; i < n - 1; i++) {
+        if (pipe2(targets[i].via, O_CLOEXEC) == -1) {
+            fprintf(stderr, "Error: Failed to create output fan-out pipe: %s\n", strerror(errno));
+            return -1;
+        }
+        fcntl(targets[i].via[1], F_SETPIPE_SZ, chunk);
+        long size = fcntl(targets[i].via[1], F_GETPIPE_SZ);
+        if (size > 0 && size < chunk) chunk = size;
+    }
+    targets[n - 1].via[0] = targets[n - 1].via[1] = -1;
+
+    while (1) {
+        // Blocks until data arrives, 0 means every writer is gone
+        ssize_t len = tee(in, targets[0].via[1], chunk, 0);
+        if (len < 0 && errno == EINTR) continue;
+        if (len < 0) {
+            fprintf(stderr, "Error: Failed to duplicate output: %s\n", strerror(errno));
+            status = -1;
+            break;
+        }
+        if (len == 0) break;
+
+        for (int i = 1; i < n - 1; i++) {
+            ssize_t m;
+            do {
+                m = tee(in, targets[i].via[1], len, 0);
+            } while (m < 0 && errno == EINTR);
+            if (m != len) {
+                fprintf(stderr, "Error: Failed to duplicate output: short copy\n");
+                status = -1;
+                goto done;
+            }
+        }
+
+        for (int i = 0; i < n - 1; i++) {
+            if (drain(targets[i].via[0], &targets[i], len, &scratch) < 0) {
+                status = -1;
+                goto done;
+            }
+        }
+        if (drain(in, &targets[n - 1], len, &scratch) < 0) {
+            status = -1;
+            break;
+        }
+
+        int alive = 0;
+        for (int i = 0; i < n; i++) alive += !targets[i].dead;
+        if (!alive) break;
+    }
+
+done:
+    for (int i = 0; i < n; i++) {
+        if (targets[i].via[0] != -1) {
+            close(targets[i].via[0]);
+            close(targets[i].via[1]);
+        }
+    }
+    free(scratch);
+    return status;
+}
+
+/**
+ * Moves exactly len bytes from the pipe src into a target with splice(2).
+ * Targets splice can't write to (O_APPEND files, some ttys) fall back to
+ * read/write, and a dead target's share is read and thrown away so every
+ * copy stays in step.
+ *
+ * Note: Returns 0 on success, -1 if src itself can't be read
+ */
+static int drain(int src, struct fanout_target *t, size_t len, char **scratch) {
+    while (len > 0) {
+        ssize_t n;
+
+        if (!t->dead && !t->use_rw) {
+            n = splice(src, NULL, t->fd, NULL, len, SPLICE_F_MOVE);
+            if (n > 0) {
+                len -= n;
+                continue;
+            }
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && errno == EINVAL) {
+                t->use_rw = 1;
+            } else {
+                if (n < 0 && errno != EPIPE) {
+                    fprintf(stderr, "Error: Failed to write output: %s\n", strerror(errno));
+                }
+                t->dead = 1;
+            }
+            continue;
+        }
+
+        if (*scratch == NULL) {
+            *scratch = malloc(FANOUT_BUF_SIZE);
+            if (*scratch == NULL) {
+                fprintf(stderr, "Error: Memory allocation failed for output buffer: %s\n", strerror(errno));
+                return -1;
+            }
+        }
+        n = read(src, *scratch, len < FANOUT_BUF_SIZE ? len : FANOUT_BUF_SIZE);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            fprintf(stderr, "Error: Failed to read output: %s\n", n < 0 ? strerror(errno) : "unexpected EOF");
+            return -1;
+        }
+        len -= n;
+
+        for (ssize_t off = 0; !t->dead && off < n; ) {
+            ssize_t w = write(t->fd, *scratch + off, n - off);
+            if (w < 0 && errno == EINTR) continue;
+            if (w < 0) {
+                if (errno != EPIPE) {
+                    fprintf(stderr, "Error: Failed to write output: %s\n", strerror(errno));
+                }
+                t->dead = 1;
+                break;
+            }
+            off += w;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Closes every fd above stderr that isn't listed in keep.
+ */
+static void close_except(int *keep, int n) {
+    unsigned int next = 3;
+
+    while (1) {
+        // Smallest kept fd at or above next
+        int lowest = -1;
+        for (int i = 0; i < n; i++) {
+            if (keep[i] >= (int) next && (lowest == -1 || keep[i] < lowest)) lowest = keep[i];
+        }
+        if (lowest == -1) {
+            close_range(next, ~0U, 0);
+            return;
+        }
+        if ((unsigned int) lowest > next) {
+            close_range(next, lowest - 1, 0);
+        }
+        next = lowest + 1;
+    }
+}
@@ -0,0 +1,482 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include "shell.h"
+
+/**
+ * Tokenizes input string into a dynamically-allocated array of command arguments.
+ *
+ * Words are split on spaces and tabs, except inside $(...), backticks,
+ * <(...) and >(...), which are kept whole so expansion can run them later.
+ * A '#' at the start of a word begins a comment running to the end.
+ * 
+ * Note:
+ * - Calls exit(1) on allocation failure
+ * - Returns an array with just null if input is all whitespace.
+ */
+char **inputToCommand(char *input) {
+    int capacity = INIT_CMD_CAP;
+    int count = 0;
+    char **command = malloc(capacity * sizeof(char *));
+    
+    if (command == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed for command array: %s\n", strerror(errno));
+        exit(1);
+    }
+
+    const char *token = input;
+    while (1) {
+        while (*token == ' ' || *token == '\t') token++;
+        if (*token == '\0' || *token == '#') break;  // A word starting with '#' comments out the rest
+
+        // Split heredoc operators glued to their word (<<EOF, <<-EOF, <<<word)
+        size_t op_len = heredocOperatorLength(token);
+        if (op_len > 0 && token[op_len] != '\0' && token[op_len] != ' ' && token[op_len] != '\t') {
+            if (appendToken(&command, &count, &capacity, token, op_len) < 0) exit(1);
+            token += op_len;
+        }
+
+        // Pipes are their own token even when glued to a word (ls|wc)
+        size_t len = (*token == '|') ? 1 : wordLength(token);
+        if (appendToken(&command, &count, &capacity, token, len) < 0) exit(1);
+        token += len;
+    }
+    
+    command[count] = NULL;  // null-terminate the array for execvp
+    return command;
+}
+
+/**
+ * Returns the length of the word starting at p, which ends at a space, tab,
+ * pipe or the end of input. Substitutions are skipped as a unit so the
+ * spaces and pipes inside them don't split the word.
+ */
+size_t wordLength(const char *p) {
+    const char *start = p;
+
+    while (*p != '\0' && *p != ' ' && *p != '\t' && *p != '|') {
+        if ((p[0] == '$' || p[0] == '<' || p[0] == '>') && p[1] == '(') {
+            const char *end = substitutionEnd(p + 2);
+            p = end ? end + 1 : p + strlen(p);
+        } else if (*p == '`') {
+            const char *end = strchr(p + 1, '`');
+            p = end ? end + 1 : p + strlen(p);
+        } else {
+            p++;
+        }
+    }
+    return p - start;
+}
+
+/**
+ * Finds the ')' closing a substitution whose body starts at p (just past
+ * the opening parenthesis), accounting for nested parentheses and
+ * backtick-quoted sections.
+ *
+ * Note: Returns NULL if the substitution is unterminated.
+ */
+const char *substitutionEnd(const char *p) {
+    int depth = 1;
+
+    for (; *p != '\0'; p++) {
+        if (*p == '`') {
+            p = strchr(p + 1, '`');
+            if (p == NULL) return NULL;
+        } else if (*p == '(') {
+            depth++;
+        } else if (*p == ')') {
+            if (--depth == 0) return p;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Returns the length of a heredoc operator (<<, <<- or <<<) at the start of
+ * token, or 0 if it doesn't start with one.
+ */
+size_t heredocOperatorLength(const char *token) {
+    if (strncmp(token, "<<<", 3) == 0 || strncmp(token, "<<-", 3) == 0) return 3;
+    if (strncmp(token, "<<", 2) == 0) return 2;
+    return 0;
+}
+
+/**
+ * Appends a copy of the first len bytes of token to a command array,
+ * growing it as needed and keeping room for the NULL terminator.
+ *
+ * Note: Returns 0 on success, -1 on allocation failure after freeing the
+ * array and printing an error.
+ */
+int appendToken(char ***command, int *count, int *capacity, const char *token, size_t len) {
+    // Resize array if needed (leave room for NULL terminator)
+    if (*count >= *capacity - 1) {
+        *capacity *= 2;
+        char **temp = realloc(*command, *capacity * sizeof(char *));
+        if (temp == NULL) {
+            fprintf(stderr, "Error: Memory reallocation failed while expanding command array: %s\n", strerror(errno));
+            (*command)[*count] = NULL;
+            freeCommand(*command);
+            return -1;
+        }
+        *command = temp;
+    }
+
+    // Duplicate each token so it persists after input_copy is freed
+    (*command)[*count] = strndup(token, len);
+    if ((*command)[*count] == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed while copying token: %s\n", strerror(errno));
+        freeCommand(*command);
+        return -1;
+    }
+    (*count)++;
+    return 0;
+}
+
+/**
+ * Frees memory used by command array created by inputToCommand().
+ * 
+ * Iterates through array, freeing each individual string,
+ * then frees the array itself. Safe to call with NULL pointer.
+ * 
+ */
+void freeCommand(char **command) {
+    if (command == NULL) return;
+    
+    for (int i = 0; command[i] != NULL; i++) {
+        free(command[i]);
+    }
+    free(command);
+}
+
+/**
+ * Parses an input line into a pipeline: tokenizes it, splits the tokens on
+ * '|' into stages and scrapes each stage's redirections (reading any
+ * heredoc bodies, in order).
+ *
+ * Note:
+ * - Returns 0 on success, -1 on an empty stage or heredoc failure
+ * - pl is always initialized, so free_pipeline() is safe either way
+ * - A blank line parses as a single stage with an empty command
+ * - Calls exit(1) on allocation failure
+ */
+int parse_pipeline(char *input, struct pipeline *pl) {
+    return parse_tokens(inputToCommand(input), pl);
+}
+
+/**
+ * The rest of parse_pipeline() after tokenizing, for tokens that come
+ * ready-made from the script cache. Takes over the tokens array.
+ */
+int parse_tokens(char **tokens, struct pipeline *pl) {
+    int count = 1;
+
+    for (int i = 0; tokens[i] != NULL; i++) {
+        if (strcmp(tokens[i], "|") == 0) count++;
+    }
+
+    pl->stages = calloc(count, sizeof(struct stage));
+    pl->count = 0;
+    pl->pids = NULL;
+    pl->pid_count = 0;
+    pl->last_pid = -1;
+    if (pl->stages == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed for pipeline: %s\n", strerror(errno));
+        exit(1);
+    }
+
+    // Move each stage's tokens into its own command array
+    int start = 0;
+    int status = 0;
+    for (int i = 0; ; i++) {
+        if (tokens[i] != NULL && strcmp(tokens[i], "|") != 0) continue;
+
+        int len = i - start;
+        char **command = malloc((len + 1) * sizeof(char *));
+        if (command == NULL) {
+            fprintf(stderr, "Error: Memory allocation failed for command array: %s\n", strerror(errno));
+            exit(1);
+        }
+        memcpy(command, tokens + start, len * sizeof(char *));
+        command[len] = NULL;
+
+        struct stage *st = &pl->stages[pl->count++];
+        st->command = command;
+        st->procsubst_begin = st->procsubst_end = 0;
+        st->expanded_at = -1;
+        st->deferred = 0;
+        if (len == 0 && count > 1 && status == 0) {
+            fprintf(stderr, "Error: syntax error near unexpected token '|'\n");
+            status = -1;
+        }
+
+        if (tokens[i] == NULL) break;
+        free(tokens[i]);
+        start = i + 1;
+    }
+    free(tokens);
+
+    // Scrape redirections even after a syntax error, so heredoc bodies are
+    // still consumed instead of being run as commands
+    for (int i = 0; i < pl->count; i++) {
+        struct stage *st = &pl->stages[i];
+        if (setup_redirects(st->command, &st->redir) < 0) status = -1;
+    }
+    return status;
+}
+
+/**
+ * Frees every stage of a pipeline built by parse_pipeline(), closing any
+ * fds still held by their redirections. Safe to call on a failed parse.
+ */
+void free_pipeline(struct pipeline *pl) {
+    for (int i = 0; i < pl->count; i++) {
+        close_redirects(&pl->stages[i].redir);
+        freeCommand(pl->stages[i].command);
+    }
+    free(pl->stages);
+    free(pl->pids);
+    pl->stages = NULL;
+    pl->count = 0;
+    pl->pids = NULL;
+    pl->pid_count = 0;
+}
+
+/**
+ * Scrapes a command for <, >, >>, 2>, <<, <<- and <<< and their targets,
+ * storing redirect info into a struct for child execution. Operator tokens
+ * are freed and targets are handed over to the struct.
+ *
+ * Here-document bodies are read from the prompt as soon as their operator is
+ * seen, so several heredocs on one line are collected in order.
+ *
+ * Note: Returns 0 on success, -1 if a heredoc body could not be stored.
+ * The struct is always initialized, so close_redirects() is safe either way.
+ */
+int setup_redirects(char **command, struct redirect_info *redir) {
+    // Initialize the struct
+    redir->input_file = NULL;
+    redir->outputs = NULL;
+    redir->output_count = 0;
+    redir->error_file = NULL;
+    redir->input_fd = -1;
+    redir->output_fd = -1;
+    
+    int write_idx = 0; // Where we write cleaned args
+    int status = 0;
+    
+    // Parse through command array
+    for (int i = 0; command[i] != NULL; i++) {
+        char *op = command[i]; // Freed below unless kept as an argument
+        if (strcmp(command[i], "<") == 0) {
+            // Input redirection
+            if (command[i + 1] != NULL) {
+                free(redir->input_file);
+                redir->input_file = command[i + 1];
+                if (redir->input_fd != -1) {
+                    close(redir->input_fd);
+                    redir->input_fd = -1;
+                }
+                i++; // Skip the filename
+            }
+        } else if (strcmp(command[i], "<<") == 0 || strcmp(command[i], "<<-") == 0) {
+            // Here-document, body follows on the next lines
+            if (command[i + 1] != NULL) {
+                size_t len;
+                int strip_tabs = command[i][2] == '-';
+                int quoted = unquoteDelimiter(command[i + 1]);
+                char *body = read_heredoc(command[i + 1], strip_tabs, &len);
+
+                // Substitutions in the body run unless the delimiter was quoted
+                if (!quoted && status == 0) {
+                    char *expanded = expandString(body);
+                    free(body);
+                    body = expanded;
+                    if (body != NULL) len = strlen(body);
+                }
+                status = installHeredoc(redir, body, len, status);
+                free(body);
+                free(command[i + 1]);
+                i++; // Skip the delimiter
+            }
+        } else if (strcmp(command[i], "<<<") == 0) {
+            // Here-string, the expanded word itself plus a trailing newline
+            if (command[i + 1] != NULL) {
+                char *body = (status == 0) ? expandString(command[i + 1]) : NULL;
+                size_t len = 0;
+                if (body != NULL) {
+                    len = strlen(body);
+                    char *temp = realloc(body, len + 2);
+                    if (temp == NULL) {
+                        fprintf(stderr, "Error: Memory allocation failed for here-string: %s\n", strerror(errno));
+                        exit(1);
+                    }
+                    body = temp;
+                    body[len++] = '\n';
+                    body[len] = '\0';
+                }
+                status = installHeredoc(redir, body, len, status);
+                free(body);
+                free(command[i + 1]);
+                i++;
+            }
+        } else if (strcmp(command[i], ">") == 0) {
+            // Output redirection (truncate), repeats fan out to every target
+            if (command[i + 1] != NULL) {
+                addOutput(redir, command[i + 1], TRUNCATE);
+                i++;
+            }
+        } else if (strcmp(command[i], ">>") == 0) {
+            // Output redirection (append)
+            if (command[i + 1] != NULL) {
+                addOutput(redir, command[i + 1], APPEND);
+                i++;
+            }
+        } else if (strcmp(command[i], "2>") == 0) {
+            // Error redirection
+            if (command[i + 1] != NULL) {
+                free(redir->error_file);
+                redir->error_file = command[i + 1];
+                i++;
+            }
+        } else {
+            // Regular command argument - keep it
+            command[write_idx++] = command[i];
+            continue;
+        }
+        free(op);
+    }
+    
+    // Null-terminate at the new end
+    command[write_idx] = NULL;
+    return status;
+}
+
+/**
+ * Records another stdout target. Unlike other shells, which keep only the
+ * last one, every target receives the output (zsh-style multios).
+ *
+ * Note: Calls exit(1) on allocation failure
+ */
+void addOutput(struct redirect_info *redir, char *file, int mode) {
+    if (redir->output_count % INIT_OUTPUT_CAP == 0) {
+        size_t capacity = redir->output_count + INIT_OUTPUT_CAP;
+        struct output_target *temp = realloc(redir->outputs, capacity * sizeof(*temp));
+        if (temp == NULL) {
+            fprintf(stderr, "Error: Memory reallocation failed while adding output target: %s\n", strerror(errno));
+            exit(1);
+        }
+        redir->outputs = temp;
+    }
+    redir->outputs[redir->output_count].file = file;
+    redir->outputs[redir->output_count].mode = mode;
+    redir->output_count++;
+}
+
+/**
+ * Strips a here-document delimiter of its quotes in place ('EOF', "EOF"
+ * or EOF with quoted parts), since those only mark the body as literal.
+ *
+ * Note: Returns 1 if any quote was removed, 0 otherwise.
+ */
+int unquoteDelimiter(char *delim) {
+    char *write = delim;
+    int quoted = 0;
+
+    for (char *read = delim; *read != '\0'; read++) {
+        if (*read == '\'' || *read == '"') {
+            quoted = 1;
+        } else {
+            *write++ = *read;
+        }
+    }
+    *write = '\0';
+    return quoted;
+}
+
+/**
+ * Turns a heredoc/here-string body into the command's stdin, replacing any
+ * earlier input redirection. A NULL body (failed expansion) or a non-zero
+ * status from earlier redirects skips the work and keeps failing.
+ *
+ * Note: Returns the updated status, 0 on success or -1 on failure
+ */
+int installHeredoc(struct redirect_info *redir, const char *body, size_t len, int status) {
+    if (status != 0 || body == NULL) {
+        return -1;
+    }
+
+    int fd = heredoc_fd(body, len);
+    if (fd == -1) {
+        return -1;
+    }
+    if (redir->input_fd != -1) close(redir->input_fd);
+    redir->input_fd = fd;
+    free(redir->input_file);
+    redir->input_file = NULL;
+    return 0;
+}
+
+/**
+ * Reads here-document lines from the prompt, or the script being run,
+ * until a line matching delim.
+ * With strip_tabs (<<-), leading tabs are removed from every body line and
+ * from the line compared against the delimiter.
+ *
+ * Note:
+ * - Returns a malloc'd, null-terminated body, its length stored in out_len
+ * - Stops with a warning at EOF, keeping what was read like bash does
+ * - Calls exit(1) on allocation failure
+ */
+char *read_heredoc(const char *delim, int strip_tabs, size_t *out_len) {
+    size_t capacity = INIT_HEREDOC_CAP;
+    size_t len = 0;
+    char *body = malloc(capacity);
+
+    if (body == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed for here-document: %s\n", strerror(errno));
+        exit(1);
+    }
+
+    while (1) {
+        char *line = input_line("> ");
+        if (line == NULL) {
+            fprintf(stderr, "warning: here-document delimited by end-of-file (wanted '%s')\n", delim);
+            break;
+        }
+
+        char *text = line;
+        if (strip_tabs) {
+            while (*text == '\t') text++;
+        }
+        if (strcmp(text, delim) == 0) {
+            free(line);
+            break;
+        }
+
+        // Grow to fit the line, its newline and the null terminator
+        size_t line_len = strlen(text);
+        while (len + line_len + 2 > capacity) {
+            capacity *= 2;
+            char *temp = realloc(body, capacity);
+            if (temp == NULL) {
+                fprintf(stderr, "Error: Memory reallocation failed while reading here-document: %s\n", strerror(errno));
+                free(body);
+                free(line);
+                exit(1);
+            }
+            body = temp;
+        }
+        memcpy(body + len, text, line_len);
+        len += line_len;
+        body[len++] = '\n';
+        free(line);
+    }
+
+    body[len] = '\0';
+    *out_len = len;
+    return body;
+}
@@ -0,0 +1,118 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include "shell.h"
+
+// Live process substitutions, released in stack order by procsubst_release()
+static struct procsubst *active = NULL;
+static size_t active_count = 0;
+static size_t active_cap = 0;
+
+/**
+ * Starts a process substitution: runs cmdline concurrently on a pipe and
+ * appends the /dev/fd/N path naming the shell's end of it to path.
+ * For <(cmd) the helper's stdout feeds the pipe, for >(cmd) (is_output)
+ * the helper reads the pipe as stdin.
+ *
+ * cmdline runs as a full pipeline launched straight from the shell. The
+ * shell's end stays close-on-exec and is tracked until released, only the
+ * command that receives the path gets it through procsubst_inherit().
+ *
+ * Note: Returns 0 on success, -1 w/ message on pipe/fork failure
+ */
+int procsubst_open(const char *cmdline, int is_output, struct buffer *path) {
+    char *line = strdup(cmdline);
+    if (line == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed while copying substitution: %s\n", strerror(errno));
+        exit(1);
+    }
+
+    struct pipeline pl;
+    int parsed = parse_pipeline(line, &pl);
+    free(line);
+    if (parsed < 0 || expand_pipeline(&pl) < 0) {
+        free_pipeline(&pl);
+        return -1;
+    }
+
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) == -1) {
+        fprintf(stderr, "Error: Failed to create process substitution pipe: %s\n", strerror(errno));
+        free_pipeline(&pl);
+        return -1;
+    }
+    int keep = is_output ? fds[1] : fds[0];
+    int give = is_output ? fds[0] : fds[1];
+
+    if (active_count >= active_cap) {
+        size_t capacity = active_cap ? active_cap * 2 : INIT_PROCSUBST_CAP;
+        struct procsubst *temp = realloc(active, capacity * sizeof(*temp));
+        if (temp == NULL) {
+            fprintf(stderr, "Error: Memory reallocation failed while tracking process substitution: %s\n", strerror(errno));
+            exit(1);
+        }
+        active = temp;
+        active_cap = capacity;
+    }
+
+    // The helper pipeline runs concurrently, released with the command
+    int launched = is_output ? launch_pipeline(&pl, give, -1) : launch_pipeline(&pl, -1, give);
+    close(give);
+    active[active_count].fd = keep;
+    active[active_count].pl = pl;
+    active_count++;
+    if (launched < 0) {
+        procsubst_release(active_count - 1);
+        return -1;
+    }
+
+    char name[32];
+    int len = snprintf(name, sizeof(name), "/dev/fd/%d", keep);
+    buffer_append(path, name, len);
+    return 0;
+}
+
+/**
+ * Returns the current depth of the substitution stack, to hand back to
+ * procsubst_release() once the command using the new ones is done.
+ */
+size_t procsubst_mark(void) {
+    return active_count;
+}
+
+/**
+ * Closes the shell's ends of every substitution opened since mark and
+ * reaps their helpers. Closing first lets <(cmd) writers die of SIGPIPE
+ * and >(cmd) readers see EOF, so the waits can't hang.
+ */
+void procsubst_release(size_t mark) {
+    for (size_t i = mark; i < active_count; i++) {
+        close(active[i].fd);
+    }
+    for (size_t i = mark; i < active_count; i++) {
+        wait_pipeline(&active[i].pl);
+        free_pipeline(&active[i].pl);
+    }
+    if (mark < active_count) {
+        active_count = mark;
+    }
+}
+
+/**
+ * Called in a forked child right before it becomes a command: clears
+ * close-on-exec on the ends opened while expanding that command (stack
+ * entries begin..end) so their /dev/fd paths stay valid. Other ends stay
+ * close-on-exec, so unrelated commands can't keep their pipes open.
+ */
+void procsubst_inherit(size_t begin, size_t end) {
+    for (size_t i = begin; i < end && i < active_count; i++) {
+        int flags = fcntl(active[i].fd, F_GETFD);
+        if (flags != -1) {
+            fcntl(active[i].fd, F_SETFD, flags & ~FD_CLOEXEC);
+        }
+    }
+}
@@ -0,0 +1,646 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pwd.h>
+#include <signal.h>
+#include <spawn.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/wait.h>
+#include <readline/readline.h>
+#include "shell.h"
+
+extern char **environ;
+
+#define DEFAULT_PROMPT "\\w> "
+#define SEGMENT_CACHE_SIZE 32
+#define SEGMENT_TIMEOUT_MS 1000
+#define SEGMENT_READ_MAX 4096
+
+enum segment_kind {
+    SEGMENT_GIT,        // Branch of the repo at key, '*' if dirty
+    SEGMENT_K8S,        // current-context of the kubeconfig at key
+};
+
+// What a prompt op puts out
+enum op_kind {
+    OP_TEXT,            // Literal text, escapes like \u and \h resolved
+    OP_CWD,             // \w
+    OP_CWD_BASE,        // \W
+    OP_STATUS,          // \?
+    OP_GIT,             // \{git}
+    OP_K8S,             // \{k8s}
+    OP_VENV,            // \{venv}
+};
+
+struct prompt_op {
+    enum op_kind kind;
+    size_t start;       // OP_TEXT's text in literals
+    size_t len;
+};
+
+// $PS1 compiled to ops, with flags for which inputs they read
+struct template {
+    char *source;       // The $PS1 it was compiled from
+    struct buffer literals;
+    struct prompt_op *ops;
+    size_t count;
+    size_t cap;
+    int uses_cwd;
+    int uses_status;
+    int uses_segments;
+    int uses_venv;
+};
+
+// Everything a rendered prompt depends on besides the template. When it
+// matches the last render's, the last render is reused as is.
+struct prompt_inputs {
+    unsigned long cwd;          // cwd_generation()
+    int status;
+    unsigned long segments;     // Count of segment results that changed
+    const char *venv;           // $VIRTUAL_ENV; the environment's strings
+    const char *kubeconfig;     // are replaced, not edited, when they
+    const char *home;           // change, so comparing pointers is enough
+};
+
+/*
+ * Slow prompt segments are computed by a worker thread, never while the
+ * prompt is drawn. Results are cached per kind and key (the directory for
+ * git), the prompt shows the last result right away and asks the worker
+ * to refresh it; when a refresh changes a result, the worker writes to
+ * notify and prompt_getc() redraws the prompt between keystrokes.
+ */
+struct segment {
+    enum segment_kind kind;
+    char *key;              // NULL for a free slot
+    char *value;            // Last result, NULL until there is one
+    int pending;            // Waiting for the worker
+    unsigned long used;     // When it was last shown, for eviction
+};
+
+static struct segment segments[SEGMENT_CACHE_SIZE];
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work = PTHREAD_COND_INITIALIZER;
+static int worker_started = 0;
+static unsigned long tick = 0;
+static unsigned long segment_changes = 0;
+static int notify[2] = { -1, -1 };
+
+static struct template template;
+static struct prompt_inputs last_inputs;
+static int rendered_valid = 0;
+static struct buffer rendered;  // Last prompt handed to readline
+static char kubeconfig[PATH_MAX];
+
+static const char *render(int refresh);
+static void compile(const char *source);
+static void add_op(enum op_kind kind, const char *text, size_t len);
+static void build(int refresh);
+static void kubeconfig_path(int changed);
+static void append_segment(struct buffer *out, enum segment_kind kind, const char *key, int refresh);
+static struct segment *find_segment(enum segment_kind kind, const char *key);
+static void start_worker(void);
+static void *segment_worker(void *arg);
+static char *compute_segment(enum segment_kind kind, const char *key);
+static char *git_segment(const char *dir);
+static char *k8s_segment(const char *config);
+static int prompt_getc(FILE *stream);
+static long ms_since(const struct timespec *start);
+
+/**
+ * Sets up the interactive prompt: readline reads keys through
+ * prompt_getc(), so segment results arriving in the background can
+ * redraw the prompt while it waits.
+ */
+void prompt_init(void) {
+    if (pipe2(notify, O_CLOEXEC | O_NONBLOCK) == -1) return;
+    rl_getc_function = prompt_getc;
+}
+
+/**
+ * Builds the prompt from $PS1, "\w> " when unset. Like bash's PS1 it
+ * takes \w (current directory), \W (its last part), \u, \h, \? (last
+ * status), \$, \n, \e, \\ and \[ \] around non-printing sequences, plus
+ * segments:
+ *
+ *   \{git}   branch of the current repo, with '*' when it's dirty
+ *   \{k8s}   current kubectl context
+ *   \{venv}  name of the active Python virtualenv
+ *
+ * git and k8s are slow to work out, so they show their last result for
+ * the directory (nothing the first time) while a worker refreshes them,
+ * see prompt_getc(). A command that takes longer than a second is killed
+ * and its segment keeps its old value.
+ *
+ * $PS1 is compiled once into ops, see compile(), and the prompt is only
+ * rebuilt when something it shows changed since the last one, so most
+ * prompts cost a few comparisons and no allocation.
+ *
+ * Note: Returns a string valid until the next call
+ */
+const char *prompt_render(void) {
+    return render(1);
+}
+
+/**
+ * Renders the prompt into the reused buffer, recompiling $PS1 if it
+ * changed and rebuilding only if the inputs its ops read changed. With
+ * refresh, slow segments are queued to be worked out again even if the
+ * text is reused.
+ */
+static const char *render(int refresh) {
+    const char *source = get_var("PS1", 3);
+    if (source == NULL) source = DEFAULT_PROMPT;
+    if (template.source == NULL || strcmp(template.source, source) != 0) {
+        compile(source);
+        rendered_valid = 0;
+    }
+
+    struct prompt_inputs now;
+    memset(&now, 0, sizeof(now));
+    if (template.uses_cwd) {
+        cwd_get();      // Revalidates, bumping the generation if it moved
+        now.cwd = cwd_generation();
+    }
+    if (template.uses_status) now.status = last_status;
+    if (template.uses_venv) now.venv = getenv("VIRTUAL_ENV");
+    if (template.uses_segments) {
+        now.kubeconfig = getenv("KUBECONFIG");
+        now.home = getenv("HOME");
+        pthread_mutex_lock(&lock);
+        now.segments = segment_changes;
+        pthread_mutex_unlock(&lock);
+    }
+
+    int changed = !rendered_valid || memcmp(&now, &last_inputs, sizeof(now)) != 0;
+    if (template.uses_segments) {
+        kubeconfig_path(!rendered_valid || now.kubeconfig != last_inputs.kubeconfig || now.home != last_inputs.home);
+    }
+    for (size_t i = 0; refresh && !changed && i < template.count; i++) {
+        const char *cwd;
+        if (template.ops[i].kind == OP_GIT && (cwd = cwd_get()) != NULL) append_segment(NULL, SEGMENT_GIT, cwd, 1);
+        if (template.ops[i].kind == OP_K8S) append_segment(NULL, SEGMENT_K8S, kubeconfig, 1);
+    }
+    if (changed) {
+        last_inputs = now;
+        build(refresh);
+        rendered_valid = 1;
+    }
+    return rendered.data;
+}
+
+/**
+ * Compiles a PS1 template into ops. Escapes whose output can't change
+ * during the session (\u, \h, \$, \n, \e, \[, \]) become literal text
+ * right away, merged with the text around them.
+ *
+ * Note: Calls exit(1) on allocation failure
+ */
+static void compile(const char *source) {
+    free(template.source);
+    buffer_free(&template.literals);
+    template.count = 0;
+    template.uses_cwd = template.uses_status = template.uses_segments = template.uses_venv = 0;
+    template.source = strdup(source);
+    if (template.source == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed for prompt: %s\n", strerror(errno));
+        exit(1);
+    }
+
+    for (const char *p = source; *p != '\0'; p++) {
+        if (*p != '\\' || p[1] == '\0') {
+            add_op(OP_TEXT, p, 1);
+            continue;
+        }
+        p++;
+        switch (*p) {
+            case 'w':
+                add_op(OP_CWD, NULL, 0);
+                break;
+            case 'W':
+                add_op(OP_CWD_BASE, NULL, 0);
+                break;
+            case '?':
+                add_op(OP_STATUS, NULL, 0);
+                break;
+            case 'u': {
+                const char *user = getenv("USER");
+                struct passwd *pw;
+                if (user == NULL && (pw = getpwuid(geteuid())) != NULL) user = pw->pw_name;
+                if (user != NULL) add_op(OP_TEXT, user, strlen(user));
+                break;
+            }
+            case 'h': {
+                char host[256] = "";
+                gethostname(host, sizeof(host) - 1);
+                add_op(OP_TEXT, host, strcspn(host, "."));
+                break;
+            }
+            case '$':
+                add_op(OP_TEXT, geteuid() == 0 ? "#" : "$", 1);
+                break;
+            case 'n':
+                add_op(OP_TEXT, "\n", 1);
+                break;
+            case 'e':
+                add_op(OP_TEXT, "\033", 1);
+                break;
+            case '[':
+                add_op(OP_TEXT, "\001", 1);     // RL_PROMPT_START_IGNORE
+                break;
+            case ']':
+                add_op(OP_TEXT, "\002", 1);     // RL_PROMPT_END_IGNORE
+                break;
+            case '{': {
+                const char *end = strchr(p, '}');
+                if (end == NULL) {
+                    add_op(OP_TEXT, p - 1, 2);
+                    break;
+                }
+                size_t len = end - p - 1;
+                if (len == 3 && strncmp(p + 1, "git", 3) == 0) {
+                    add_op(OP_GIT, NULL, 0);
+                } else if (len == 3 && strncmp(p + 1, "k8s", 3) == 0) {
+                    add_op(OP_K8S, NULL, 0);
+                } else if (len == 4 && strncmp(p + 1, "venv", 4) == 0) {
+                    add_op(OP_VENV, NULL, 0);
+                }
+                p = end;
+                break;
+            }
+            default:
+                add_op(OP_TEXT, p, 1);
+                break;
+        }
+    }
+}
+
+/**
+ * Appends an op to the template, extending the previous one instead when
+ * both are text.
+ *
+ * Note: Calls exit(1) on allocation failure
+ */
+static void add_op(enum op_kind kind, const char *text, size_t len) {
+    size_t start = template.literals.len;
+    if (kind == OP_TEXT) {
+        buffer_append(&template.literals, text, len);
+        if (template.count > 0 && template.ops[template.count - 1].kind == OP_TEXT) {
+            template.ops[template.count - 1].len += len;
+            return;
+        }
+    }
+    if (template.count == template.cap) {
+        size_t cap = template.cap == 0 ? 8 : template.cap * 2;
+        struct prompt_op *ops = realloc(template.ops, cap * sizeof(*ops));
+        if (ops == NULL) {
+            fprintf(stderr, "Error: Memory allocation failed for prompt: %s\n", strerror(errno));
+            exit(1);
+        }
+        template.ops = ops;
+        template.cap = cap;
+    }
+    template.ops[template.count++] = (struct prompt_op) { kind, start, len };
+
+    if (kind == OP_CWD || kind == OP_CWD_BASE || kind == OP_GIT) template.uses_cwd = 1;
+    if (kind == OP_STATUS) template.uses_status = 1;
+    if (kind == OP_GIT || kind == OP_K8S) template.uses_segments = 1;
+    if (kind == OP_VENV) template.uses_venv = 1;
+}
+
+/**
+ * Rebuilds the prompt text from the compiled template. With refresh,
+ * slow segments are queued to be worked out again.
+ */
+static void build(int refresh) {
+    rendered.len = 0;
+    buffer_append(&rendered, "", 0);    // Empty, not NULL, if there are no ops
+    for (size_t i = 0; i < template.count; i++) {
+        const struct prompt_op *op = &template.ops[i];
+        const char *cwd;
+        switch (op->kind) {
+            case OP_TEXT:
+                buffer_append(&rendered, template.literals.data + op->start, op->len);
+                break;
+            case OP_CWD:
+            case OP_CWD_BASE:
+                cwd = cwd_get();
+                if (cwd == NULL) cwd = "???";
+                if (op->kind == OP_CWD_BASE && strcmp(cwd, "/") != 0) {
+                    cwd = strrchr(cwd, '/') ? strrchr(cwd, '/') + 1 : cwd;
+                }
+                buffer_append(&rendered, cwd, strlen(cwd));
+                break;
+            case OP_STATUS: {
+                char status[16];
+                int len = snprintf(status, sizeof(status), "%d", last_status);
+                buffer_append(&rendered, status, len);
+                break;
+            }
+            case OP_GIT:
+                cwd = cwd_get();
+                if (cwd != NULL) append_segment(&rendered, SEGMENT_GIT, cwd, refresh);
+                break;
+            case OP_K8S:
+                append_segment(&rendered, SEGMENT_K8S, kubeconfig, refresh);
+                break;
+            case OP_VENV: {
+                const char *venv = getenv("VIRTUAL_ENV");
+                if (venv != NULL && *venv != '\0') {
+                    const char *name = strrchr(venv, '/');
+                    name = name && name[1] ? name + 1 : venv;
+                    buffer_append(&rendered, name, strlen(name));
+                }
+                break;
+            }
+        }
+    }
+}
+
+/**
+ * Works out the kubeconfig \{k8s} reads into kubeconfig: the first file
+ * in $KUBECONFIG, else ~/.kube/config. Only done when changed says
+ * $KUBECONFIG or $HOME did.
+ */
+static void kubeconfig_path(int changed) {
+    if (!changed) return;
+    const char *env = getenv("KUBECONFIG");
+    const char *home = getenv("HOME");
+    if (env != NULL && *env != '\0') {
+        snprintf(kubeconfig, sizeof(kubeconfig), "%.*s", (int) strcspn(env, ":"), env);
+    } else {
+        snprintf(kubeconfig, sizeof(kubeconfig), "%s/.kube/config", home ? home : "");
+    }
+}
+
+/**
+ * Appends the cached value of a segment to out, if there's one yet, and
+ * with refresh (or if it's new) queues it for the worker. out may be
+ * NULL to only queue it.
+ */
+static void append_segment(struct buffer *out, enum segment_kind kind, const char *key, int refresh) {
+    pthread_mutex_lock(&lock);
+    struct segment *s = find_segment(kind, key);
+    if (s->key == NULL) {
+        s->kind = kind;
+        s->key = strdup(key);
+        if (s->key == NULL) {
+            fprintf(stderr, "Error: Memory allocation failed for prompt segment: %s\n", strerror(errno));
+            exit(1);
+        }
+        refresh = 1;
+    }
+    s->used = ++tick;
+    if (refresh && !s->pending) {
+        s->pending = 1;
+        start_worker();
+        pthread_cond_signal(&work);
+    }
+    if (out != NULL && s->value != NULL) buffer_append(out, s->value, strlen(s->value));
+    pthread_mutex_unlock(&lock);
+}
+
+/**
+ * Finds the cache slot for kind and key, or if there's none, the slot to
+ * put them in: a free one, else the least recently shown, which is
+ * emptied. Called with the lock held.
+ */
+static struct segment *find_segment(enum segment_kind kind, const char *key) {
+    struct segment *victim = &segments[0];
+    for (int i = 0; i < SEGMENT_CACHE_SIZE; i++) {
+        struct segment *s = &segments[i];
+        if (s->key != NULL && s->kind == kind && strcmp(s->key, key) == 0) return s;
+        if (victim->key != NULL && (s->key == NULL || s->used < victim->used)) victim = s;
+    }
+    free(victim->key);
+    free(victim->value);
+    memset(victim, 0, sizeof(struct segment));
+    return victim;
+}
+
+/**
+ * Starts the worker thread the first time a segment is queued. SIGINT
+ * stays blocked in it, Ctrl-C is for the main thread. Called with the
+ * lock held.
+ */
+static void start_worker(void) {
+    if (worker_started) return;
+    sigset_t block, old;
+    sigfillset(&block);
+    pthread_sigmask(SIG_BLOCK, &block, &old);
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, segment_worker, NULL) == 0) {
+        pthread_detach(tid);
+        worker_started = 1;
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+/**
+ * Worker loop: works out queued segments, most recently shown first, and
+ * pokes the prompt when a result changed.
+ */
+static void *segment_worker(void *arg) {
+    (void) arg;
+    pthread_mutex_lock(&lock);
+    while (1) {
+        struct segment *next = NULL;
+        for (int i = 0; i < SEGMENT_CACHE_SIZE; i++) {
+            struct segment *s = &segments[i];
+            if (s->key != NULL && s->pending && (next == NULL || s->used > next->used)) next = s;
+        }
+        if (next == NULL) {
+            pthread_cond_wait(&work, &lock);
+            continue;
+        }
+
+        // The slot may be reused while unlocked, so work from copies
+        enum segment_kind kind = next->kind;
+        char *key = strdup(next->key);
+        next->pending = 0;
+        pthread_mutex_unlock(&lock);
+        char *value = key != NULL ? compute_segment(kind, key) : NULL;
+        pthread_mutex_lock(&lock);
+
+        struct segment *s = NULL;
+        for (int i = 0; key != NULL && i < SEGMENT_CACHE_SIZE; i++) {
+            if (segments[i].key != NULL && segments[i].kind == kind && strcmp(segments[i].key, key) == 0) {
+                s = &segments[i];
+            }
+        }
+        if (s != NULL && value != NULL && (s->value == NULL || strcmp(s->value, value) != 0)) {
+            free(s->value);
+            s->value = value;
+            value = NULL;
+            segment_changes++;
+            if (write(notify[1], "", 1) == -1) {
+                // Full pipe, a redraw is already coming
+            }
+        }
+        free(value);
+        free(key);
+    }
+    return NULL;
+}
+
+/**
+ * Works out one segment, on the worker.
+ *
+ * Note: Returns a malloc'd value, or NULL if it failed or timed out
+ */
+static char *compute_segment(enum segment_kind kind, const char *key) {
+    return kind == SEGMENT_GIT ? git_segment(key) : k8s_segment(key);
+}
+
+/**
+ * Runs git status in dir, in its own process group so Ctrl-C at the
+ * prompt doesn't reach it, and reads the branch from its first line.
+ * Reading stops at the second line, which is enough to know the tree is
+ * dirty.
+ *
+ * Note: Returns the malloc'd branch, "" outside a repo, or NULL if git
+ * couldn't run or took longer than SEGMENT_TIMEOUT_MS
+ */
+static char *git_segment(const char *dir) {
+    int out[2];
+    if (pipe2(out, O_CLOEXEC) == -1) return NULL;
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+    posix_spawn_file_actions_adddup2(&actions, out[1], STDOUT_FILENO);
+    posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    sigset_t none, all;
+    sigemptyset(&none);
+    sigfillset(&all);
+    posix_spawnattr_setsigmask(&attr, &none);
+    posix_spawnattr_setsigdefault(&attr, &all);
+    posix_spawnattr_setpgroup(&attr, 0);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETPGROUP);
+
+    char *args[] = { "git", "-C", (char *) dir, "--no-optional-locks", "status", "--porcelain=v1", "--branch", NULL };
+    pid_t pid;
+    int failed = posix_spawnp(&pid, "git", &actions, &attr, args, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    close(out[1]);
+    if (failed) {
+        close(out[0]);
+        return NULL;
+    }
+
+    char text[SEGMENT_READ_MAX];
+    size_t len = 0;
+    int lines = 0;
+    int timed_out = 0;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (lines < 2 && len < sizeof(text) - 1) {
+        long left = SEGMENT_TIMEOUT_MS - ms_since(&start);
+        struct pollfd pfd = { out[0], POLLIN, 0 };
+        if (left <= 0 || poll(&pfd, 1, left) == 0) {
+            timed_out = 1;
+            break;
+        }
+        ssize_t n = read(out[0], text + len, sizeof(text) - 1 - len);
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) break;
+        for (ssize_t i = 0; i < n; i++) lines += text[len + i] == '\n';
+        len += n;
+    }
+    text[len] = '\0';
+    close(out[0]);
+
+    if (timed_out) kill(-pid, SIGKILL);     // Its whole group, hooks included
+    int status;
+    while (waitpid(pid, &status, 0) == -1 && errno == EINTR);
+    if (timed_out) return NULL;
+    if (strncmp(text, "## ", 3) != 0) return strdup("");
+
+    // "## main...origin/main [ahead 1]", "## No commits yet on main",
+    // "## HEAD (no branch)"
+    char *branch = text + 3;
+    if (strncmp(branch, "No commits yet on ", 18) == 0) branch += 18;
+    size_t branch_len = strcspn(branch, " \n");
+    char *dots = strstr(branch, "...");
+    if (dots != NULL && (size_t) (dots - branch) < branch_len) branch_len = dots - branch;
+
+    char *value = malloc(branch_len + 2);
+    if (value == NULL) return NULL;
+    memcpy(value, branch, branch_len);
+    if (lines >= 2) value[branch_len++] = '*';
+    value[branch_len] = '\0';
+    return value;
+}
+
+/**
+ * Reads current-context from a kubeconfig.
+ *
+ * Note: Returns the malloc'd context, "" if there's none
+ */
+static char *k8s_segment(const char *config) {
+    FILE *file = fopen(config, "re");
+    if (file == NULL) return strdup("");
+
+    char *line = NULL;
+    size_t cap = 0;
+    char *value = NULL;
+    while (value == NULL && getline(&line, &cap, file) != -1) {
+        if (strncmp(line, "current-context:", 16) != 0) continue;
+        char *start = line + 16;
+        start += strspn(start, " \t\"'");
+        size_t len = strcspn(start, "\"'\r\n");
+        while (len > 0 && (start[len - 1] == ' ' || start[len - 1] == '\t')) len--;
+        value = strndup(start, len);
+    }
+    free(line);
+    fclose(file);
+    return value != NULL ? value : strdup("");
+}
+
+/**
+ * Key reader for readline: waits for a key while watching for segment
+ * results, redrawing the prompt with them. Redraws only happen at the
+ * main prompt, not e.g. in a here-document or while a search message
+ * replaces it.
+ */
+static int prompt_getc(FILE *stream) {
+    while (1) {
+        struct pollfd fds[2] = { { fileno(stream), POLLIN, 0 }, { notify[0], POLLIN, 0 } };
+        if (poll(fds, 2, -1) == -1) {
+            if (errno != EINTR) return rl_getc(stream);
+            rl_check_signals();
+            continue;
+        }
+        if (fds[1].revents & POLLIN) {
+            char drain[64];
+            while (read(notify[0], drain, sizeof(drain)) > 0);
+            if (rl_prompt != NULL && rl_display_prompt == rl_prompt && rendered.data != NULL &&
+                strcmp(rl_prompt, rendered.data) == 0) {
+                const char *prompt = render(0);
+                if (strcmp(rl_prompt, prompt) != 0) {
+                    rl_set_prompt(prompt);
+                    rl_redisplay();
+                }
+            }
+        }
+        if (fds[0].revents) return rl_getc(stream);
+    }
+}
+
+/**
+ * Milliseconds since start, on the monotonic clock.
+ */
+static long ms_since(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000 + (now.tv_nsec - start->tv_nsec) / 1000000;
+}
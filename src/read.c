@@ -0,0 +1,191 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include "shell.h"
+
+#define READ_CHUNK 65536
+#define FIELD_SEPARATORS " \t\n"
+
+struct line_reader {
+    int fd;
+    int seekable;       // Regular file, excess can be given back with lseek
+    char *buf;
+    size_t pos;
+    size_t len;
+};
+
+static int next_byte(struct line_reader *r, char *c);
+static void assign_fields(char **names, int count, const char *line, const char *escaped, size_t len);
+static size_t skip_separators(const char *line, const char *escaped, size_t i, size_t len);
+static int is_separator(char c);
+
+/**
+ * Built-in: read [-r] [-d delim] [-n count] [name...]
+ *
+ * Reads one line (up to delim, a newline by default, or count bytes with
+ * -n) from stdin and splits it on whitespace into the named variables,
+ * the last taking the rest of the line. Without names the whole line goes
+ * in REPLY. Without -r a backslash quotes the next byte, and a backslash
+ * before a newline continues the line.
+ *
+ * Nothing past the line may be consumed, since the next command reads the
+ * same stdin. On a regular file that's done by reading a large chunk and
+ * seeking back over the excess, so a line costs two syscalls instead of
+ * one per byte. Pipes and terminals can't seek, so there it reads a byte
+ * at a time.
+ *
+ * Note: Returns 0 if a delimiter was read (or count bytes), 1 on end of
+ * file or a read error, 2 on bad usage
+ */
+int builtin_read(char **argv) {
+    int raw = 0;
+    int delim = '\n';
+    long limit = -1;
+    int i = 1;
+
+    for (; argv[i] != NULL && argv[i][0] == '-' && argv[i][1] != '\0'; i++) {
+        if (strcmp(argv[i], "--") == 0) {
+            i++;
+            break;
+        }
+        if (strcmp(argv[i], "-r") == 0) {
+            raw = 1;
+        } else if (strcmp(argv[i], "-d") == 0 && argv[i + 1] != NULL) {
+            delim = (unsigned char) argv[++i][0];
+        } else if (strcmp(argv[i], "-n") == 0 && argv[i + 1] != NULL) {
+            char *end;
+            limit = strtol(argv[++i], &end, 10);
+            if (*argv[i] == '\0' || *end != '\0' || limit < 0) {
+                fprintf(stderr, "read: %s: invalid number\n", argv[i]);
+                return 2;
+            }
+        } else {
+            fprintf(stderr, "read: usage: read [-r] [-d delim] [-n count] [name...]\n");
+            return 2;
+        }
+    }
+
+    char *reply[] = { "REPLY", NULL };
+    char **names = argv[i] != NULL ? argv + i : reply;
+    int count = 0;
+    for (; names[count] != NULL; count++) {
+        if (!valid_name(names[count], strlen(names[count]))) {
+            fprintf(stderr, "read: '%s': not a valid identifier\n", names[count]);
+            return 2;
+        }
+    }
+
+    struct stat st;
+    struct line_reader r = { .fd = STDIN_FILENO, .pos = 0, .len = 0 };
+    r.seekable = fstat(STDIN_FILENO, &st) == 0 && S_ISREG(st.st_mode);
+    r.buf = malloc(r.seekable ? READ_CHUNK : 1);
+
+    // escaped marks the bytes a backslash quoted, which never split fields
+    struct buffer line, escaped;
+    buffer_init(&line);
+    buffer_init(&escaped);
+    if (r.buf == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed for read buffer: %s\n", strerror(errno));
+        exit(1);
+    }
+
+    int status = 1;
+    char c;
+    while (limit < 0 || (long) line.len < limit) {
+        if (next_byte(&r, &c) <= 0) break;
+        char quoted = 0;
+        if (!raw && c == '\\') {
+            if (next_byte(&r, &c) <= 0) break;
+            if (c == '\n') continue;
+            quoted = 1;
+        } else if ((unsigned char) c == delim) {
+            status = 0;
+            break;
+        }
+        buffer_append(&line, &c, 1);
+        buffer_append(&escaped, &quoted, 1);
+    }
+    if (limit >= 0 && (long) line.len >= limit) status = 0;
+
+    // Give back whatever was read past the line
+    if (r.seekable && r.pos < r.len) {
+        lseek(r.fd, -(off_t) (r.len - r.pos), SEEK_CUR);
+    }
+
+    assign_fields(names, count, line.data ? line.data : "", escaped.data, line.len);
+    free(r.buf);
+    buffer_free(&line);
+    buffer_free(&escaped);
+    return status;
+}
+
+/**
+ * Hands out the reader's next byte, refilling its buffer when empty: a
+ * whole chunk on a regular file, a single byte otherwise.
+ *
+ * Note: Returns 1 with the byte in *c, 0 at end of file, -1 w/ message on
+ * a read error
+ */
+static int next_byte(struct line_reader *r, char *c) {
+    if (r->pos == r->len) {
+        ssize_t n;
+        do {
+            n = read(r->fd, r->buf, r->seekable ? READ_CHUNK : 1);
+        } while (n == -1 && errno == EINTR);
+        if (n == -1) {
+            fprintf(stderr, "read: read error: %s\n", strerror(errno));
+            return -1;
+        }
+        if (n == 0) return 0;
+        r->pos = 0;
+        r->len = n;
+    }
+    *c = r->buf[r->pos++];
+    return 1;
+}
+
+/**
+ * Splits line into fields, one per name, with the last name getting the
+ * remainder minus surrounding whitespace. Names left over are set empty.
+ * REPLY on its own gets the line untouched, like in bash.
+ */
+static void assign_fields(char **names, int count, const char *line, const char *escaped, size_t len) {
+    if (count == 1 && strcmp(names[0], "REPLY") == 0) {
+        set_var("REPLY", line, len);
+        return;
+    }
+
+    size_t i = skip_separators(line, escaped, 0, len);
+    for (int n = 0; n < count; n++) {
+        size_t start = i;
+        if (n == count - 1) {
+            size_t end = len;
+            while (end > start && !escaped[end - 1] && is_separator(line[end - 1])) end--;
+            set_var(names[n], line + start, end - start);
+            break;
+        }
+        while (i < len && (escaped[i] || !is_separator(line[i]))) i++;
+        set_var(names[n], line + start, i - start);
+        i = skip_separators(line, escaped, i, len);
+    }
+}
+
+/**
+ * Returns the index of the first byte from i on that isn't an unquoted
+ * field separator.
+ */
+static size_t skip_separators(const char *line, const char *escaped, size_t i, size_t len) {
+    while (i < len && !escaped[i] && is_separator(line[i])) i++;
+    return i;
+}
+
+/**
+ * Returns whether c splits fields. Unlike strchr(), a NUL byte doesn't.
+ */
+static int is_separator(char c) {
+    return c != '\0' && strchr(FIELD_SEPARATORS, c) != NULL;
+}
@@ -0,0 +1,346 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdio_ext.h>
+#include "shell.h"
+
+// The shell's own standard fds while a builtin has them redirected, -1
+// per fd that isn't; nested saves keep the outermost
+static int shell_fds[3] = { -1, -1, -1 };
+
+/**
+ * Apply file redirections for stdin, stdout, and stderr.
+ *
+ * Note: File descriptors are closed after duplication. Returns 0 on success,
+ * -1 when open/dup2 fails w/ message, so a forked child should exit(1) and
+ * an in-process builtin should restore_fds() instead.
+ */
+int apply_redirects(struct redirect_info *redir) {
+    int fd;
+    
+    // Handle here-document/here-string input
+    if (redir->input_fd != -1) {
+        if (dup2(redir->input_fd, STDIN_FILENO) == -1) {
+            fprintf(stderr, "Error: Failed to redirect stdin from here-document: %s\n", strerror(errno));
+            return -1;
+        }
+        close(redir->input_fd);
+        redir->input_fd = -1;
+    }
+
+    // Handle input redirection
+    if (redir->input_file != NULL) {
+        fd = open(redir->input_file, O_RDONLY);
+        if (fd == -1) {
+            fprintf(stderr, "Error: Failed to open input file '%s': %s\n",
+                    redir->input_file, strerror(errno));
+            return -1;
+        }
+        if (dup2(fd, STDIN_FILENO) == -1) {
+            fprintf(stderr, "Error: Failed to redirect stdin from '%s': %s\n",
+                    redir->input_file, strerror(errno));
+            close(fd);
+            return -1;
+        }
+        close(fd);
+    }
+    
+    // Handle output redirection, several targets arrive as one fan-out pipe
+    if (redir->output_fd != -1) {
+        if (dup2(redir->output_fd, STDOUT_FILENO) == -1) {
+            fprintf(stderr, "Error: Failed to redirect stdout to output targets: %s\n", strerror(errno));
+            return -1;
+        }
+        close(redir->output_fd);
+        redir->output_fd = -1;
+    } else if (redir->output_count > 0) {
+        struct output_target *target = &redir->outputs[redir->output_count - 1];
+        fd = open_output(target);
+        if (fd == -1) {
+            return -1;
+        }
+        if (dup2(fd, STDOUT_FILENO) == -1) {
+            fprintf(stderr, "Error: Failed to redirect stdout to '%s': %s\n",
+                    target->file, strerror(errno));
+            close(fd);
+            return -1;
+        }
+        close(fd);
+    }
+    
+    // Handle error redirection
+    if (redir->error_file != NULL) {
+        fd = open(redir->error_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd == -1) {
+            fprintf(stderr, "Error: Failed to open error file '%s': %s\n",
+                    redir->error_file, strerror(errno));
+            return -1;
+        }
+        if (dup2(fd, STDERR_FILENO) == -1) {
+            fprintf(stderr, "Error: Failed to redirect stderr to '%s': %s\n",
+                    redir->error_file, strerror(errno));
+            close(fd);
+            return -1;
+        }
+        close(fd);
+    }
+    return 0;
+}
+
+/**
+ * Opens an output target for writing, creating it and either truncating
+ * or appending per its mode.
+ *
+ * Note: Returns the fd (close-on-exec) on success, -1 on failure w/ message
+ */
+int open_output(struct output_target *target) {
+    int flags = O_WRONLY | O_CREAT | O_CLOEXEC;
+    flags |= (target->mode == APPEND) ? O_APPEND : O_TRUNC;
+
+    int fd = open(target->file, flags, 0644);
+    if (fd == -1) {
+        fprintf(stderr, "Error: Failed to open output file '%s': %s\n",
+                target->file, strerror(errno));
+    }
+    return fd;
+}
+
+/**
+ * Returns whether a command has any redirection at all.
+ */
+int has_redirects(struct redirect_info *redir) {
+    return redir->input_file != NULL || redir->input_fd != -1 ||
+           redir->output_count > 0 || redir->error_file != NULL;
+}
+
+/**
+ * Runs a command made only of redirections, in the shell process with no
+ * fork: every output target (and 2> target) is created or truncated, and
+ * when there is both an input and outputs, the input is copied to each
+ * output, like `cat < in > out` without the cat.
+ *
+ * A regular-file input (or heredoc memfd) is copied to each target from the
+ * same start offset by copy_fd(), so the kernel does the copying. A pipe
+ * input can only be read once and goes through the tee(2) fan-out.
+ * >> targets keep O_APPEND, so concurrent appenders never overwrite each
+ * other; the kernel copy paths refuse it, so those are copied with
+ * read/write.
+ *
+ * Note: Returns 0 on success, 1 on failure w/ message
+ */
+int redirect_only(struct redirect_info *redir) {
+    int in = redir->input_fd;
+    int status = 0;
+
+    if (in == -1 && redir->input_file != NULL) {
+        in = open(redir->input_file, O_RDONLY | O_CLOEXEC);
+        if (in == -1) {
+            fprintf(stderr, "Error: Failed to open input file '%s': %s\n",
+                    redir->input_file, strerror(errno));
+            return 1;
+        }
+    }
+
+    if (redir->error_file != NULL) {
+        int fd = open(redir->error_file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd == -1) {
+            fprintf(stderr, "Error: Failed to open error file '%s': %s\n",
+                    redir->error_file, strerror(errno));
+            status = 1;
+        } else {
+            close(fd);
+        }
+    }
+
+    int *fds = malloc((redir->output_count + 1) * sizeof(int));
+    if (fds == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed for output targets: %s\n", strerror(errno));
+        exit(1);
+    }
+
+    int opened = 0;
+    for (; status == 0 && opened < redir->output_count; opened++) {
+        struct output_target *target = &redir->outputs[opened];
+        fds[opened] = open_output(target);
+        if (fds[opened] == -1) {
+            status = 1;
+            break;
+        }
+    }
+
+    if (status == 0 && in != -1 && opened > 0) {
+        struct stat st;
+        if (fstat(in, &st) == 0 && S_ISREG(st.st_mode)) {
+            off_t start = lseek(in, 0, SEEK_CUR);
+            for (int i = 0; i < opened; i++) {
+                off_t off = start;
+                if (copy_fd(in, &off, fds[i]) < 0) {
+                    fprintf(stderr, "Error: Failed to copy input to '%s': %s\n",
+                            redir->outputs[i].file, strerror(errno));
+                    status = 1;
+                }
+            }
+        } else if (fanout_fds(in, fds, opened) < 0) {
+            fprintf(stderr, "Error: Failed to copy input: %s\n", strerror(errno));
+            status = 1;
+        }
+    }
+
+    for (int i = 0; i < opened; i++) close(fds[i]);
+    free(fds);
+    if (in != redir->input_fd) close(in);
+    return status;
+}
+
+/**
+ * Duplicates the standard fds that apply_redirects() is about to replace,
+ * so a builtin running in the shell process can put them back afterwards.
+ * Unaffected slots are set to -1.
+ *
+ * Note: Returns 0 on success, -1 if dup() fails w/ message
+ */
+int save_fds(struct redirect_info *redir, int saved[3]) {
+    int needed[3] = {
+        redir->input_file != NULL || redir->input_fd != -1,
+        redir->output_fd != -1 || redir->output_count > 0,
+        redir->error_file != NULL
+    };
+
+    for (int fd = 0; fd < 3; fd++) {
+        saved[fd] = -1;
+        if (needed[fd]) {
+            saved[fd] = fcntl(fd, F_DUPFD_CLOEXEC, 10);
+            if (saved[fd] == -1) {
+                fprintf(stderr, "Error: Failed to save file descriptor %d: %s\n", fd, strerror(errno));
+                restore_fds(saved);
+                return -1;
+            }
+            if (shell_fds[fd] == -1) shell_fds[fd] = saved[fd];
+        }
+    }
+    return 0;
+}
+
+/**
+ * Puts back the standard fds saved by save_fds(), flushing stdio first so
+ * buffered builtin output lands in the redirected file and not the terminal.
+ */
+void restore_fds(int saved[3]) {
+    fflush(stdout);
+    fflush(stderr);
+
+    for (int fd = 0; fd < 3; fd++) {
+        if (saved[fd] != -1) {
+            dup2(saved[fd], fd);
+            close(saved[fd]);
+            if (shell_fds[fd] == saved[fd]) shell_fds[fd] = -1;
+            saved[fd] = -1;
+        }
+    }
+}
+
+/**
+ * Puts back the shell's standard fds after Ctrl-C jumped out of a
+ * redirected builtin, past its restore_fds(). Whatever the builtin left
+ * buffered is dropped, its target may never drain. Saves made by builtins
+ * nested inside it stay open.
+ */
+void fds_reset(void) {
+    __fpurge(stdout);
+    __fpurge(stderr);
+    for (int fd = 0; fd < 3; fd++) {
+        if (shell_fds[fd] != -1) {
+            dup2(shell_fds[fd], fd);
+            close(shell_fds[fd]);
+            shell_fds[fd] = -1;
+        }
+    }
+}
+
+/**
+ * Releases parent-side resources held by a redirect_info: the heredoc and
+ * fan-out fds once the child has its own copies (or the command never
+ * ran), and the target filenames handed over by setup_redirects().
+ */
+void close_redirects(struct redirect_info *redir) {
+    if (redir->input_fd != -1) {
+        close(redir->input_fd);
+        redir->input_fd = -1;
+    }
+    if (redir->output_fd != -1) {
+        close(redir->output_fd);
+        redir->output_fd = -1;
+    }
+    for (int i = 0; i < redir->output_count; i++) {
+        free(redir->outputs[i].file);
+    }
+    free(redir->input_file);
+    free(redir->outputs);
+    free(redir->error_file);
+    redir->input_file = NULL;
+    redir->outputs = NULL;
+    redir->output_count = 0;
+    redir->error_file = NULL;
+}
+
+/**
+ * Stores a heredoc body in memory and returns a readable fd positioned at
+ * its start, so no temp file ever touches the filesystem.
+ *
+ * Bodies up to PIPE_BUF go straight into a pipe, which never blocks at that
+ * size. Larger bodies go into a sealed memfd, which is shared with the child
+ * through fork() and can't be modified after sealing.
+ *
+ * Note: Returns the fd (close-on-exec) on success, -1 on failure w/ message
+ */
+int heredoc_fd(const char *body, size_t len) {
+    if (len <= PIPE_BUF) {
+        int fds[2];
+        if (pipe2(fds, O_CLOEXEC) == -1) {
+            fprintf(stderr, "Error: Failed to create here-document pipe: %s\n", strerror(errno));
+            return -1;
+        }
+        if (len > 0 && write(fds[1], body, len) != (ssize_t) len) {
+            fprintf(stderr, "Error: Failed to write here-document: %s\n", strerror(errno));
+            close(fds[0]);
+            close(fds[1]);
+            return -1;
+        }
+        close(fds[1]);
+        return fds[0];
+    }
+
+    int fd = memfd_create("bshell-heredoc", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd == -1) {
+        fprintf(stderr, "Error: Failed to create here-document memfd: %s\n", strerror(errno));
+        return -1;
+    }
+
+    size_t written = 0;
+    while (written < len) {
+        ssize_t n = write(fd, body + written, len - written);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "Error: Failed to write here-document: %s\n", strerror(errno));
+            close(fd);
+            return -1;
+        }
+        written += n;
+    }
+
+    // Seal so the body is read-only from here on, then rewind for the reader
+    if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) == -1 ||
+        lseek(fd, 0, SEEK_SET) == -1) {
+        fprintf(stderr, "Error: Failed to seal here-document: %s\n", strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
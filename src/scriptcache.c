@@ -0,0 +1,483 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include "shell.h"
+
+#define CACHE_MAGIC "BSHC"
+#define CACHE_VERSION 2
+#define RECORD_TOKENS 1     // A command line, already tokenized
+#define RECORD_LINE 2       // A raw line, read by a here-document
+
+/*
+ * Parsed-script cache. A script is stored as the stream of records its run
+ * consumes: each command line as its token array, and each here-document
+ * body line as is, since those are read raw. On a hit the records are
+ * mmap'd and handed out in order, so lines are never tokenized again.
+ *
+ * Layout: a cache_header, the script's absolute path, then the records,
+ * each a u32 kind and u32 count followed by count strings stored as a u32
+ * length, the bytes and a NUL. Numbers are native-endian, the cache never
+ * leaves the machine.
+ */
+
+struct cache_header {
+    char magic[4];
+    uint32_t version;
+    uint64_t size;          // Script size, mtime and content hash it was
+    int64_t mtime_sec;      // built from, any mismatch is a miss
+    int64_t mtime_nsec;
+    uint64_t hash;
+    uint32_t path_len;      // Path follows the header
+    uint32_t reserved;
+};
+
+// A sourced file's records, kept for the rest of the session
+struct sourced {
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    char *records;
+    size_t len;
+    int lines;              // Can't be cached, see cache_build(): read line by line
+    struct sourced *next;
+};
+
+struct script_cache {
+    const char *data;       // Records
+    size_t len;
+    size_t pos;
+    void *map;              // Mapping of the cache file, NULL if built here
+    size_t map_len;
+    char *built;            // Records built this run, NULL if mapped or
+                            // borrowed from a sourced entry
+};
+
+// Files run by source this session, most recent first
+static struct sourced *sourced = NULL;
+
+static struct script_cache *cache_map(const char *path, const struct cache_header *want, const char *script);
+static int cache_build(const char *data, size_t len, struct buffer *out);
+static int nested_heredoc(const char *line);
+static void put_record(struct buffer *out, uint32_t kind, char **strings, uint32_t count);
+static int get_u32(struct script_cache *cache, uint32_t *value);
+static char *get_string(struct script_cache *cache);
+
+/**
+ * Attaches the parsed form of a script to its input source, from the cache
+ * when the script's size, mtime and content hash still match, otherwise
+ * parsed now and saved for next time. The cache lives in
+ * $XDG_CACHE_HOME/bshell (~/.cache/bshell), one file per script path.
+ *
+ * Note: Returns 0 if src now runs from records, -1 if the script should
+ * just be read line by line (e.g. no usable cache directory, or a
+ * here-document inside a substitution, which isn't saved either)
+ */
+int cache_attach(struct input_source *src, const char *script) {
+    char real[PATH_MAX];
+    char path[PATH_MAX];
+    struct stat st;
+    if (realpath(script, real) == NULL || stat(real, &st) == -1 ||
+        cache_file(real, strlen(real), "bsc", path, sizeof(path)) < 0) {
+        return -1;
+    }
+
+    struct cache_header want;
+    memset(&want, 0, sizeof(want));
+    memcpy(want.magic, CACHE_MAGIC, 4);
+    want.version = CACHE_VERSION;
+    want.size = st.st_size;
+    want.mtime_sec = st.st_mtim.tv_sec;
+    want.mtime_nsec = st.st_mtim.tv_nsec;
+    want.hash = hash_bytes(src->data, src->len);
+    want.path_len = strlen(real);
+
+    struct script_cache *cache = cache_map(path, &want, real);
+    if (cache == NULL) {
+        struct buffer records;
+        buffer_init(&records);
+        if (cache_build(src->data, src->len, &records) < 0) {
+            buffer_free(&records);
+            return -1;
+        }
+        struct iovec parts[3] = {
+            { &want, sizeof(struct cache_header) },
+            { real, want.path_len },
+            { records.data, records.len },
+        };
+        cache_save(path, parts, 3);
+
+        cache = calloc(1, sizeof(struct script_cache));
+        if (cache == NULL) {
+            fprintf(stderr, "Error: Memory allocation failed for script cache: %s\n", strerror(errno));
+            exit(1);
+        }
+        cache->len = records.len;
+        cache->built = buffer_release(&records);
+        cache->data = cache->built;
+    }
+    src->cache = cache;
+    return 0;
+}
+
+/**
+ * Opens a file for source, running from its parsed records. Those are kept
+ * in memory for the rest of the session, keyed on the file's device,
+ * inode, size and mtime, so sourcing it again while it's unchanged reads
+ * and tokenizes nothing. Unlike cache_attach() nothing is written to disk,
+ * the files sourced over and over (per-directory env scripts, say) are
+ * small and a session's worth of them stays small too. A file with a
+ * here-document inside a substitution is read line by line instead, see
+ * cache_build().
+ *
+ * Note: Returns 0 on success, -1 w/ errno set if the file couldn't be
+ * read. Calls exit(1) on allocation failure
+ */
+int cache_open_sourced(const char *path, struct input_source *src) {
+    struct stat st;
+    if (stat(path, &st) == -1) return -1;
+    if (S_ISDIR(st.st_mode)) {
+        errno = EISDIR;
+        return -1;
+    }
+
+    struct sourced **link = &sourced;
+    while (*link != NULL && ((*link)->dev != st.st_dev || (*link)->ino != st.st_ino)) {
+        link = &(*link)->next;
+    }
+    struct sourced *entry = *link;
+    if (entry != NULL && (entry->size != st.st_size || entry->mtime.tv_sec != st.st_mtim.tv_sec ||
+                          entry->mtime.tv_nsec != st.st_mtim.tv_nsec)) {
+        // The file changed since, its records are stale
+        *link = entry->next;
+        free(entry->records);
+        free(entry);
+        entry = NULL;
+    }
+
+    if (entry == NULL) {
+        if (input_open(path, src) < 0) return -1;
+        struct buffer records;
+        buffer_init(&records);
+        int lines = cache_build(src->data, src->len, &records) < 0;
+        if (!lines) input_close(src);
+
+        entry = calloc(1, sizeof(struct sourced));
+        if (entry == NULL) {
+            fprintf(stderr, "Error: Memory allocation failed for script cache: %s\n", strerror(errno));
+            exit(1);
+        }
+        entry->dev = st.st_dev;
+        entry->ino = st.st_ino;
+        entry->size = st.st_size;
+        entry->mtime = st.st_mtim;
+        entry->len = records.len;
+        entry->records = buffer_release(&records);
+        entry->lines = lines;
+        entry->next = sourced;
+        sourced = entry;
+        if (lines) return 0;    // src still has the text
+    }
+    if (entry->lines) return input_open(path, src);
+
+    // A view of the entry's records, which it keeps owning
+    memset(src, 0, sizeof(struct input_source));
+    src->name = path;
+    src->cache = calloc(1, sizeof(struct script_cache));
+    if (src->cache == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed for script cache: %s\n", strerror(errno));
+        exit(1);
+    }
+    src->cache->data = entry->records;
+    src->cache->len = entry->len;
+    return 0;
+}
+
+/**
+ * Frees a cache attached by cache_attach(). Safe to call with NULL.
+ */
+void cache_free(struct script_cache *cache) {
+    if (cache == NULL) return;
+    if (cache->map != NULL) munmap(cache->map, cache->map_len);
+    free(cache->built);
+    free(cache);
+}
+
+/**
+ * Hands out the next command line's tokens, ready for parse_tokens().
+ *
+ * Note: Returns a malloc'd NULL-terminated array, or NULL once the records
+ * run out (or are damaged, or a raw line comes first)
+ */
+char **cache_next_tokens(struct script_cache *cache) {
+    size_t start = cache->pos;
+    uint32_t kind, count;
+    if (get_u32(cache, &kind) < 0 || get_u32(cache, &count) < 0 || kind != RECORD_TOKENS) {
+        cache->pos = start;
+        return NULL;
+    }
+
+    char **tokens = malloc((count + 1) * sizeof(char *));
+    if (tokens == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed for command array: %s\n", strerror(errno));
+        exit(1);
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        tokens[i] = get_string(cache);
+        if (tokens[i] == NULL) {
+            freeCommand(tokens);
+            cache->pos = cache->len;
+            return NULL;
+        }
+        tokens[i + 1] = NULL;
+    }
+    tokens[count] = NULL;
+    return tokens;
+}
+
+/**
+ * Hands out the next raw line, for a here-document body.
+ *
+ * Note: Returns a malloc'd line, or NULL if the next record isn't one
+ */
+char *cache_next_line(struct script_cache *cache) {
+    size_t start = cache->pos;
+    uint32_t kind, count;
+    if (get_u32(cache, &kind) < 0 || get_u32(cache, &count) < 0 || kind != RECORD_LINE || count != 1) {
+        cache->pos = start;
+        return NULL;
+    }
+    return get_string(cache);
+}
+
+/**
+ * Builds the path of a cache file for the len bytes of key (a script's
+ * absolute path, say): a hash of the key with the given suffix, in $XDG_CACHE_HOME/bshell or
+ * ~/.cache/bshell, which is created if missing.
+ *
+ * Note: Returns 0 on success, -1 if there's no usable directory
+ */
+int cache_file(const char *key, size_t key_len, const char *suffix, char *path, size_t size) {
+    const char *base = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    int len;
+    if (base != NULL && *base != '\0') {
+        len = snprintf(path, size, "%s/bshell", base);
+    } else if (home != NULL && *home != '\0') {
+        len = snprintf(path, size, "%s/.cache", home);
+        if (len < 0 || (size_t) len >= size || (mkdir(path, 0700) == -1 && errno != EEXIST)) return -1;
+        len = snprintf(path, size, "%s/.cache/bshell", home);
+    } else {
+        return -1;
+    }
+    if (len < 0 || (size_t) len >= size || (mkdir(path, 0700) == -1 && errno != EEXIST)) return -1;
+
+    int more = snprintf(path + len, size - len, "/%016llx.%s",
+                        (unsigned long long) hash_bytes(key, key_len), suffix);
+    return more < 0 || (size_t) more >= size - len ? -1 : 0;
+}
+
+/**
+ * Writes a cache file from parts, through a temporary file renamed into
+ * place so concurrent shells never see a partial one. Failures are
+ * silent, the cache just gets rebuilt next time.
+ */
+void cache_save(const char *path, struct iovec *parts, int count) {
+    char temp[PATH_MAX];
+    if (snprintf(temp, sizeof(temp), "%s.%d.tmp", path, (int) getpid()) >= (int) sizeof(temp)) return;
+
+    int fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd == -1) return;
+
+    size_t total = 0;
+    for (int i = 0; i < count; i++) total += parts[i].iov_len;
+    ssize_t n = writev(fd, parts, count);
+    close(fd);
+    if (n != (ssize_t) total || rename(temp, path) == -1) unlink(temp);
+}
+
+/**
+ * Maps the cache file at path if its header matches want and it was made
+ * for the same script path.
+ *
+ * Note: Returns NULL on a miss
+ */
+static struct script_cache *cache_map(const char *path, const struct cache_header *want, const char *script) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return NULL;
+
+    struct stat st;
+    size_t head = sizeof(struct cache_header) + want->path_len;
+    if (fstat(fd, &st) == -1 || (size_t) st.st_size < head) {
+        close(fd);
+        return NULL;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return NULL;
+
+    if (memcmp(map, want, sizeof(struct cache_header)) != 0 ||
+        memcmp((char *) map + sizeof(struct cache_header), script, want->path_len) != 0) {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+
+    struct script_cache *cache = calloc(1, sizeof(struct script_cache));
+    if (cache == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed for script cache: %s\n", strerror(errno));
+        exit(1);
+    }
+    cache->map = map;
+    cache->map_len = st.st_size;
+    cache->data = (char *) map + head;
+    cache->len = st.st_size - head;
+    return cache;
+}
+
+/**
+ * Parses a script into records without running it: each line is tokenized
+ * like inputToCommand() does at run time, and the lines after one with
+ * << or <<- are stored raw up to their delimiter, as read_heredoc() would
+ * read them. Lines with no tokens (blank or comments) are left out.
+ *
+ * Note: Returns 0, or -1 once a line has a here-document inside a
+ * substitution: its body is read while the substitution is expanded, and
+ * the records can't say where that falls, so the file is run line by line
+ */
+static int cache_build(const char *data, size_t len, struct buffer *out) {
+    size_t pos = 0;
+    while (pos < len) {
+        const char *nl = memchr(data + pos, '\n', len - pos);
+        size_t line_len = nl ? (size_t) (nl - data - pos) : len - pos;
+        char *line = strndup(data + pos, line_len);
+        if (line == NULL) {
+            fprintf(stderr, "Error: Memory allocation failed for script cache: %s\n", strerror(errno));
+            exit(1);
+        }
+        pos += line_len + (nl != NULL);
+        if (nested_heredoc(line)) {
+            free(line);
+            return -1;
+        }
+
+        char **tokens = inputToCommand(line);
+        uint32_t count = 0;
+        while (tokens[count] != NULL) count++;
+        if (count > 0) put_record(out, RECORD_TOKENS, tokens, count);
+
+        for (uint32_t i = 0; i + 1 < count; i++) {
+            if (strcmp(tokens[i], "<<") != 0 && strcmp(tokens[i], "<<-") != 0) continue;
+            int strip_tabs = tokens[i][2] == '-';
+            char *delim = tokens[i + 1];
+            unquoteDelimiter(delim);
+
+            while (pos < len) {
+                nl = memchr(data + pos, '\n', len - pos);
+                line_len = nl ? (size_t) (nl - data - pos) : len - pos;
+                char *body = strndup(data + pos, line_len);
+                if (body == NULL) {
+                    fprintf(stderr, "Error: Memory allocation failed for script cache: %s\n", strerror(errno));
+                    exit(1);
+                }
+                pos += line_len + (nl != NULL);
+                if (nested_heredoc(body)) {
+                    free(body);
+                    freeCommand(tokens);
+                    free(line);
+                    return -1;
+                }
+                put_record(out, RECORD_LINE, &body, 1);
+
+                char *text = body;
+                if (strip_tabs) {
+                    while (*text == '\t') text++;
+                }
+                int done = strcmp(text, delim) == 0;
+                free(body);
+                if (done) break;
+            }
+            i++;
+        }
+        freeCommand(tokens);
+        free(line);
+    }
+    return 0;
+}
+
+/**
+ * Returns whether line has << or <<- after a $(, `, <( or >(. Quoting
+ * isn't looked at, a quoted one only costs the cache.
+ */
+static int nested_heredoc(const char *line) {
+    const char *p = line;
+    while ((p = strpbrk(p, "$`<>")) != NULL && *p != '`' && p[1] != '(') p++;
+    if (p == NULL) return 0;
+    while ((p = strstr(p, "<<")) != NULL) {
+        if (p[2] != '<') return 1;
+        p += 3;     // A here-string reads no lines
+    }
+    return 0;
+}
+
+/**
+ * Appends one record to out.
+ */
+static void put_record(struct buffer *out, uint32_t kind, char **strings, uint32_t count) {
+    buffer_append(out, (const char *) &kind, sizeof(kind));
+    buffer_append(out, (const char *) &count, sizeof(count));
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t len = strlen(strings[i]);
+        buffer_append(out, (const char *) &len, sizeof(len));
+        buffer_append(out, strings[i], len + 1);
+    }
+}
+
+/**
+ * Reads a u32 from the records. The mapping gives no alignment, hence the
+ * memcpy().
+ *
+ * Note: Returns 0 on success, -1 past the end
+ */
+static int get_u32(struct script_cache *cache, uint32_t *value) {
+    if (cache->len - cache->pos < sizeof(uint32_t)) return -1;
+    memcpy(value, cache->data + cache->pos, sizeof(uint32_t));
+    cache->pos += sizeof(uint32_t);
+    return 0;
+}
+
+/**
+ * Copies the next string out of the records.
+ *
+ * Note: Returns a malloc'd string, or NULL if the records are cut short
+ */
+static char *get_string(struct script_cache *cache) {
+    uint32_t len;
+    if (get_u32(cache, &len) < 0 || cache->len - cache->pos < (size_t) len + 1) return NULL;
+    char *s = strndup(cache->data + cache->pos, len);
+    if (s == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed for script cache: %s\n", strerror(errno));
+        exit(1);
+    }
+    cache->pos += len + 1;
+    return s;
+}
+
+/**
+ * 64-bit FNV-1a hash.
+ */
+uint64_t hash_bytes(const char *p, size_t len) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ (unsigned char) p[i]) * 1099511628211ULL;
+    }
+    return hash;
+}
@@ -0,0 +1,297 @@
+#ifndef BSHELL_SHELL_H
+#define BSHELL_SHELL_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+// Constants
+#define INIT_CMD_CAP 8
+#define TRUNCATE 0
+#define APPEND 1
+#define INIT_HEREDOC_CAP 256
+#define INIT_BUFFER_CAP 256
+#define INIT_PROCSUBST_CAP 4
+#define INIT_OUTPUT_CAP 2
+#define VAR_BUCKETS 64
+#define STREAM_BUF_SIZE (256 * 1024)
+
+// Builtin flags
+#define BUILTIN_SUBST_SAFE 1    // No shell state side effects, may run in-process inside $(...)
+#define BUILTIN_FORKED 2        // Streams data, always runs in a forked stage and may exec a fallback
+#define BUILTIN_DISABLED 4      // Turned off with enable -n, looked up as a regular command
+#define BUILTIN_LAZY_ARGS 8     // Expands its brace and glob words itself, one at a time
+
+// Structures
+struct output_target {
+    char *file;
+    int mode;           // TRUNCATE or APPEND
+};
+
+struct redirect_info {
+    char *input_file;
+    struct output_target *outputs;  // Every > and >> target, in order
+    int output_count;
+    char *error_file;
+    int input_fd;       // Here-document/here-string body, -1 if none
+    int output_fd;      // Write end of a multios fan-out pipe, -1 if none
+};
+
+struct stage {
+    char **command;
+    struct redirect_info redir;
+    size_t procsubst_begin;     // Process substitutions opened while expanding
+    size_t procsubst_end;       // this stage, handed down to its child only
+    int expanded_at;            // First word produced by an expansion, -1 if none
+    int deferred;               // Words from expanded_at on are left for the builtin to expand
+};
+
+struct pipeline {
+    struct stage *stages;
+    int count;
+    pid_t *pids;        // Stage children and fan-out helpers, filled by launch_pipeline()
+    int pid_count;
+    pid_t last_pid;     // Final stage, whose status is the pipeline's
+};
+
+struct builtin {
+    const char *name;
+    int (*fn)(char **argv);
+    int flags;
+};
+
+struct procsubst {
+    int fd;             // Shell's end of the pipe, close-on-exec
+    struct pipeline pl; // Helper pipeline running the substituted command
+};
+
+struct buffer {
+    char *data;
+    size_t len;
+    size_t cap;
+};
+
+struct array {
+    char *data;         // Item bytes, malloc'd
+    size_t len;
+    size_t *ends;       // Where each item ends, at its delimiter or at len
+    size_t count;
+    int trim;           // Items leave out their delimiter (mapfile -t)
+    char **items;       // Items copied out on first access, NULL until then
+};
+
+// A history entry as history_entry_at() hands it out, pointing into the log
+struct history_entry {
+    const char *command;
+    size_t command_len;
+    const char *cwd;        // Where it ran
+    size_t cwd_len;
+    int64_t time;           // When it started
+    uint32_t duration_ms;
+    int status;
+};
+
+struct script_cache;
+struct env_delta;
+
+struct input_source {
+    const char *name;
+    const char *data;   // Script text
+    size_t len;
+    size_t pos;         // Start of the next line
+    int borrowed;       // data belongs to the caller (a -c string)
+    FILE *stream;       // Read with getdelim() instead, NULL for text sources
+    struct script_cache *cache; // Parsed records to run instead of data, or NULL
+    struct input_source *prev;  // Source to resume when this one is popped
+};
+
+// Global variables
+extern volatile sig_atomic_t exit_requested;
+extern int exit_status;
+extern int last_status;
+extern int command_expanded_at;
+extern int command_deferred;
+
+// main.c
+void run_line(char *input, int last);
+void run_tokens(char **tokens, int last);
+int run_file(const char *path, int use_cache);
+int run_source(struct input_source *src, int exec_last);
+
+// snapshot.c
+void rc_load(void);
+void snapshot_depend(const char *path);
+void snapshot_reset(void);
+int delta_replay(const char *key, size_t key_len);
+struct env_delta *delta_begin(void);
+void delta_end(struct env_delta *d, const char *key, size_t key_len, char **inputs, int save);
+
+// input.c
+int input_open(const char *path, struct input_source *src);
+void input_string(const char *text, const char *name, struct input_source *src);
+void input_stream(FILE *stream, const char *name, struct input_source *src);
+void input_close(struct input_source *src);
+void input_push(struct input_source *src);
+void input_pop(void);
+void input_reset(void);
+int input_eof(void);
+int input_interactive(void);
+char *input_line(const char *prompt);
+
+// scriptcache.c
+int cache_attach(struct input_source *src, const char *script);
+void cache_free(struct script_cache *cache);
+char **cache_next_tokens(struct script_cache *cache);
+char *cache_next_line(struct script_cache *cache);
+int cache_open_sourced(const char *path, struct input_source *src);
+int cache_file(const char *key, size_t key_len, const char *suffix, char *path, size_t size);
+void cache_save(const char *path, struct iovec *parts, int count);
+uint64_t hash_bytes(const char *p, size_t len);
+
+// parse.c
+char **inputToCommand(char *input);
+size_t wordLength(const char *p);
+const char *substitutionEnd(const char *p);
+size_t heredocOperatorLength(const char *token);
+int appendToken(char ***command, int *count, int *capacity, const char *token, size_t len);
+void freeCommand(char **command);
+int parse_pipeline(char *input, struct pipeline *pl);
+int parse_tokens(char **tokens, struct pipeline *pl);
+void free_pipeline(struct pipeline *pl);
+int setup_redirects(char **command, struct redirect_info *redir);
+void addOutput(struct redirect_info *redir, char *file, int mode);
+int unquoteDelimiter(char *delim);
+int installHeredoc(struct redirect_info *redir, const char *body, size_t len, int status);
+char *read_heredoc(const char *delim, int strip_tabs, size_t *out_len);
+
+// redirect.c
+int apply_redirects(struct redirect_info *redir);
+int open_output(struct output_target *target);
+int has_redirects(struct redirect_info *redir);
+int redirect_only(struct redirect_info *redir);
+int save_fds(struct redirect_info *redir, int saved[3]);
+void restore_fds(int saved[3]);
+void fds_reset(void);
+void close_redirects(struct redirect_info *redir);
+int heredoc_fd(const char *body, size_t len);
+
+// multios.c
+int needs_fanout(struct redirect_info *redir, int extra_fd);
+pid_t start_fanout(struct redirect_info *redir, int extra_fd);
+int fanout_fds(int in, int *fds, int n);
+
+// copy.c
+int copy_fd(int in, off_t *in_off, int out);
+
+// expand.c
+int expandCommand(char ***command, struct redirect_info *redir, int *expanded_at, int *deferred);
+int expand_pipeline(struct pipeline *pl);
+char *expandString(const char *word);
+
+// glob.c
+int has_glob(const char *word);
+int glob_word(const char *pattern, char ***command, int *count, int *capacity);
+int glob_match(const char *pattern, const char *name);
+int glob_is_dir(int dirfd, const char *name, unsigned char type);
+
+// brace.c
+struct brace_gen *brace_open(const char *word);
+int brace_next(struct brace_gen *gen, struct buffer *out);
+void brace_close(struct brace_gen *gen);
+
+// globstar.c
+char **walk_tree(int dirfd, const char *leaf, int dirs_only, size_t *count);
+
+// exec.c
+int execute_pipeline(struct pipeline *pl);
+void exec_pipeline(struct pipeline *pl);
+int launch_pipeline(struct pipeline *pl, int in_fd, int out_fd);
+int wait_pipeline(struct pipeline *pl);
+int capture_output(const char *cmdline, struct buffer *out);
+void exec_child(struct stage *st) __attribute__((noreturn));
+int wait_status(pid_t pid);
+
+// procsubst.c
+int procsubst_open(const char *cmdline, int is_output, struct buffer *path);
+size_t procsubst_mark(void);
+void procsubst_release(size_t mark);
+void procsubst_inherit(size_t begin, size_t end);
+
+// builtins.c
+const struct builtin *find_builtin(const char *name);
+int set_builtin_enabled(const char *name, int enabled);
+void for_each_disabled_builtin(void (*fn)(const char *name, void *ctx), void *ctx);
+
+// textutils.c
+size_t count_newlines(const char *p, size_t len);
+size_t find_delims(const char *p, size_t len, char delim, size_t *offsets, size_t max);
+int builtin_wc(char **argv);
+int builtin_head(char **argv);
+int builtin_tail(char **argv);
+int builtin_grep(char **argv);
+
+// batch.c
+int builtin_batch(char **argv);
+
+// read.c
+int builtin_read(char **argv);
+
+// mapfile.c
+int builtin_mapfile(char **argv);
+
+// source.c
+int builtin_source(char **argv);
+int builtin_cached_source(char **argv);
+void source_reset(void);
+
+// vars.c
+int valid_name(const char *name, size_t len);
+const char *get_var(const char *name, size_t len);
+void set_var(const char *name, const char *value, size_t value_len);
+size_t var_ref_length(const char *p);
+void expand_var_ref(const char *p, size_t ref_len, struct buffer *out);
+void set_array(const char *name, struct array *arr);
+void unset_var(const char *name);
+void free_array(struct array *arr);
+void set_positional(int argc, char **argv);
+int get_positional(char ***argv);
+void for_each_var(void (*fn)(const char *name, const char *value, const struct array *arr, void *ctx), void *ctx);
+
+// cwd.c
+const char *cwd_get(void);
+unsigned long cwd_generation(void);
+int cd(char *path);
+
+// prompt.c
+void prompt_init(void);
+const char *prompt_render(void);
+
+// history.c
+void history_init(void);
+void history_begin(const char *line);
+void history_end(int status);
+size_t history_entry_count(void);
+int history_entry_at(size_t i, struct history_entry *e);
+void history_check_log(void);
+int builtin_history(char **argv);
+
+// histstore.c
+void store_init(size_t size);
+void store_add(const char *command, size_t len);
+
+// histsearch.c
+void search_init(void);
+void search_add(size_t i);
+size_t search_history(const char *query, size_t *out, size_t max);
+
+// buffer.c
+void buffer_init(struct buffer *buf);
+void buffer_reserve(struct buffer *buf, size_t extra);
+void buffer_append(struct buffer *buf, const char *data, size_t len);
+char *buffer_release(struct buffer *buf);
+void buffer_free(struct buffer *buf);
+
+#endif
@@ -0,0 +1,758 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include "shell.h"
+
+extern char **environ;
+
+#define SNAPSHOT_MAGIC "BSHS"
+#define SNAPSHOT_VERSION 2
+#define VAR_SCALAR 1
+#define VAR_ARRAY 2
+#define VAR_UNSET 3
+#define ENV_SET 4
+#define ENV_UNSET 5
+
+/*
+ * State images: what running a file did to the shell, saved so a later
+ * run can be skipped by applying the image instead. The rc snapshot holds
+ * the whole state the rc file leaves behind, a cached-source delta only
+ * what the sourced file changed. Images hold no pointers, only lengths,
+ * so they read the same wherever they're mapped.
+ *
+ * Layout: a snapshot_header, its key (the rc's path, or the sourced
+ * file's path and arguments), then dep_count dependencies (a snapshot_dep
+ * and its path), var_count variable records and builtin_count builtins.
+ * A variable record is a u32 kind and a string name, then for a scalar
+ * its value string, for an array a u32 trim flag, u64 item count and data
+ * length, the u64 item ends and the data, for ENV_SET the value string,
+ * for the unset kinds nothing. A builtin is a u32 enabled flag and its
+ * name. A string is a u32 length, the bytes and a NUL. Numbers are
+ * native-endian.
+ */
+
+struct snapshot_header {
+    char magic[4];
+    uint32_t version;
+    uint32_t key_len;       // Key follows the header
+    uint32_t dep_count;
+    uint32_t var_count;
+    uint32_t builtin_count;
+};
+
+struct snapshot_dep {
+    uint64_t dev;           // What stat() said about a file the run read,
+    uint64_t ino;           // any change makes the image stale
+    uint64_t size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint32_t path_len;      // Path follows
+    uint32_t missing;       // Didn't exist, the image is stale once it does
+};
+
+// Collects the files read while a run is being recorded. Recordings nest,
+// a file counts for every one in progress.
+struct recorder {
+    struct buffer deps;
+    uint32_t count;
+    struct recorder *parent;
+};
+
+struct records {
+    struct buffer buf;
+    uint32_t count;
+};
+
+struct cursor {
+    const char *data;
+    size_t len;
+    size_t pos;
+};
+
+// One shell variable as it was before a recorded run
+struct var_entry {
+    char *name;
+    uint64_t hash;          // Of its record, to spot a change
+    int seen;               // Still set after the run
+};
+
+// The state a cached-source run started from, and its recording
+struct env_delta {
+    struct recorder rec;
+    struct var_entry *vars;
+    size_t var_count;
+    size_t var_cap;
+    char **env;             // Copy of environ, sorted
+    char *env_seen;
+    size_t env_count;
+    char **disabled;        // Disabled builtins
+    size_t disabled_count;
+    size_t disabled_cap;
+};
+
+// Context of diff_var()
+struct var_diff {
+    struct env_delta *d;
+    struct records *out;
+};
+
+// Innermost recording in progress, NULL when none is
+static struct recorder *recording = NULL;
+
+static void *image_map(const char *path, const char *key, size_t key_len, struct snapshot_header *head,
+                       struct cursor *c, size_t *map_len);
+static int image_apply(struct cursor *c, const struct snapshot_header *head);
+static void image_save(const char *path, const char *key, size_t key_len, struct recorder *rec,
+                       struct records *vars, struct records *builtins);
+static int deps_fresh(struct cursor *c, uint32_t count);
+static int load_vars(struct cursor *c, uint32_t count, int apply);
+static int load_builtins(struct cursor *c, uint32_t count, int apply);
+static void add_dep(struct recorder *rec, const char *path);
+static void save_var(const char *name, const char *value, const struct array *arr, void *ctx);
+static void save_builtin(const char *name, void *ctx);
+static void collect_var(const char *name, const char *value, const struct array *arr, void *ctx);
+static void collect_builtin(const char *name, void *ctx);
+static void diff_var(const char *name, const char *value, const struct array *arr, void *ctx);
+static void diff_env(struct env_delta *d, struct records *out);
+static void diff_builtins(struct env_delta *d, struct records *out);
+static struct var_entry *find_entry(struct env_delta *d, const char *name);
+static int compare_entries(const void *a, const void *b);
+static int compare_strings(const void *a, const void *b);
+static void *grow(void *array, size_t *cap, size_t size);
+static char *copy_string(const char *s);
+static void put_u32(struct buffer *out, uint32_t value);
+static void put_u64(struct buffer *out, uint64_t value);
+static void put_string(struct buffer *out, const char *s, size_t len);
+static const void *take(struct cursor *c, size_t len);
+static const char *take_string(struct cursor *c, uint32_t *len);
+
+/**
+ * Loads the rc file, $BSHELL_RC or ~/.bshellrc, into the interactive shell.
+ * A snapshot of the variables, arrays and disabled builtins it leaves
+ * behind is kept in the cache directory, and a later start whose rc and
+ * every file it read are unchanged (same device, inode, size and mtime)
+ * restores that instead of running anything. Files read means those it
+ * sourced and those the shell opened for a < redirect; what a child
+ * process reads by itself (cat f, $(cat f)) isn't seen. Otherwise the rc is run and
+ * a new snapshot taken.
+ *
+ * Note: What the rc run printed or changed outside the shell, cd's
+ * included, isn't replayed from a snapshot
+ */
+void rc_load(void) {
+    char rc[PATH_MAX];
+    const char *env = getenv("BSHELL_RC");
+    const char *home = getenv("HOME");
+    if (env != NULL) {
+        if (*env == '\0' || realpath(env, rc) == NULL) return;
+    } else {
+        char path[PATH_MAX];
+        if (home == NULL || snprintf(path, sizeof(path), "%s/.bshellrc", home) >= (int) sizeof(path) ||
+            realpath(path, rc) == NULL) {
+            return;
+        }
+    }
+    if (access(rc, R_OK) == -1) return;
+
+    char path[PATH_MAX];
+    size_t rc_len = strlen(rc);
+    int cacheable = cache_file(rc, rc_len, "snap", path, sizeof(path)) == 0;
+    if (cacheable) {
+        struct snapshot_header head;
+        struct cursor c;
+        size_t map_len;
+        void *map = image_map(path, rc, rc_len, &head, &c, &map_len);
+        if (map != NULL) {
+            int status = image_apply(&c, &head);
+            munmap(map, map_len);
+            if (status == 0) return;
+        }
+    }
+
+    struct recorder rec = { .count = 0, .parent = recording };
+    buffer_init(&rec.deps);
+    recording = &rec;
+    run_file(rc, 1);
+    recording = rec.parent;
+
+    if (cacheable && !exit_requested) {
+        struct records vars = { .count = 0 }, builtins = { .count = 0 };
+        buffer_init(&vars.buf);
+        buffer_init(&builtins.buf);
+        for_each_var(save_var, &vars);
+        for_each_disabled_builtin(save_builtin, &builtins);
+        image_save(path, rc, rc_len, &rec, &vars, &builtins);
+        buffer_free(&vars.buf);
+        buffer_free(&builtins.buf);
+    }
+    buffer_free(&rec.deps);
+}
+
+/**
+ * Records path as a file the images being recorded depend on, made
+ * absolute so it's checked in the same place from any directory. Does
+ * nothing outside a recorded run.
+ */
+void snapshot_depend(const char *path) {
+    if (recording == NULL) return;
+    const char *cwd = path[0] != '/' ? cwd_get() : NULL;
+    struct buffer full;
+    buffer_init(&full);
+    if (cwd != NULL) {
+        buffer_append(&full, cwd, strlen(cwd));
+        buffer_append(&full, "/", 1);
+    }
+    buffer_append(&full, path, strlen(path));
+    for (struct recorder *rec = recording; rec != NULL; rec = rec->parent) {
+        add_dep(rec, full.data);
+    }
+    buffer_free(&full);
+}
+
+/**
+ * Stops every recording in progress, for the Ctrl-C jump which abandons
+ * the runs they belong to.
+ */
+void snapshot_reset(void) {
+    recording = NULL;
+}
+
+/**
+ * Applies the delta saved under key by delta_end(), if every file it
+ * depends on is unchanged. The files are recorded as dependencies of any
+ * image being recorded around it, as if the run had happened.
+ *
+ * Note: Returns 0 if it was applied, -1 on a miss
+ */
+int delta_replay(const char *key, size_t key_len) {
+    char path[PATH_MAX];
+    if (cache_file(key, key_len, "env", path, sizeof(path)) < 0) return -1;
+
+    struct snapshot_header head;
+    struct cursor c;
+    size_t map_len;
+    void *map = image_map(path, key, key_len, &head, &c, &map_len);
+    if (map == NULL) return -1;
+    int status = image_apply(&c, &head);
+    munmap(map, map_len);
+    return status;
+}
+
+/**
+ * Starts recording a run for a delta: takes a picture of the variables,
+ * environment and disabled builtins to diff against afterwards, and
+ * starts collecting the files the run reads.
+ *
+ * Note: Returns the recording for delta_end(). Calls exit(1) on
+ * allocation failure
+ */
+struct env_delta *delta_begin(void) {
+    struct env_delta *d = calloc(1, sizeof(struct env_delta));
+    if (d == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed for environment delta: %s\n", strerror(errno));
+        exit(1);
+    }
+    for_each_var(collect_var, d);
+    qsort(d->vars, d->var_count, sizeof(struct var_entry), compare_entries);
+    for_each_disabled_builtin(collect_builtin, d);
+
+    while (environ[d->env_count] != NULL) d->env_count++;
+    d->env = malloc((d->env_count + 1) * sizeof(char *));
+    d->env_seen = calloc(d->env_count + 1, 1);
+    if (d->env == NULL || d->env_seen == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed for environment delta: %s\n", strerror(errno));
+        exit(1);
+    }
+    for (size_t i = 0; i < d->env_count; i++) d->env[i] = copy_string(environ[i]);
+    qsort(d->env, d->env_count, sizeof(char *), compare_strings);
+
+    buffer_init(&d->rec.deps);
+    d->rec.parent = recording;
+    recording = &d->rec;
+    return d;
+}
+
+/**
+ * Ends a recording from delta_begin() and frees it. With save set, what
+ * the run changed is written under key, depending on the files it read
+ * plus the NULL-terminated inputs, to be applied by delta_replay().
+ */
+void delta_end(struct env_delta *d, const char *key, size_t key_len, char **inputs, int save) {
+    recording = d->rec.parent;
+    for (int i = 0; inputs[i] != NULL; i++) {
+        add_dep(&d->rec, inputs[i]);
+        snapshot_depend(inputs[i]);
+    }
+
+    char path[PATH_MAX];
+    if (save && cache_file(key, key_len, "env", path, sizeof(path)) == 0) {
+
+        struct records vars = { .count = 0 }, builtins = { .count = 0 };
+        buffer_init(&vars.buf);
+        buffer_init(&builtins.buf);
+        struct var_diff diff = { d, &vars };
+        for_each_var(diff_var, &diff);
+        for (size_t i = 0; i < d->var_count; i++) {
+            if (d->vars[i].seen) continue;
+            put_u32(&vars.buf, VAR_UNSET);
+            put_string(&vars.buf, d->vars[i].name, strlen(d->vars[i].name));
+            vars.count++;
+        }
+        diff_env(d, &vars);
+        diff_builtins(d, &builtins);
+        image_save(path, key, key_len, &d->rec, &vars, &builtins);
+        buffer_free(&vars.buf);
+        buffer_free(&builtins.buf);
+    }
+
+    for (size_t i = 0; i < d->var_count; i++) free(d->vars[i].name);
+    for (size_t i = 0; i < d->env_count; i++) free(d->env[i]);
+    for (size_t i = 0; i < d->disabled_count; i++) free(d->disabled[i]);
+    free(d->vars);
+    free(d->env);
+    free(d->env_seen);
+    free(d->disabled);
+    buffer_free(&d->rec.deps);
+    free(d);
+}
+
+/**
+ * Maps the image at path if it's one of ours, made for key, and every
+ * file it depends on is unchanged. The cursor is left at its variables.
+ *
+ * Note: Returns the mapping, map_len bytes long, or NULL on a miss
+ */
+static void *image_map(const char *path, const char *key, size_t key_len, struct snapshot_header *head,
+                       struct cursor *c, size_t *map_len) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (size_t) st.st_size < sizeof(struct snapshot_header)) {
+        close(fd);
+        return NULL;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return NULL;
+
+    *c = (struct cursor) { map, st.st_size, 0 };
+    memcpy(head, take(c, sizeof(struct snapshot_header)), sizeof(struct snapshot_header));
+    const char *stored = take(c, head->key_len);
+    if (memcmp(head->magic, SNAPSHOT_MAGIC, 4) != 0 || head->version != SNAPSHOT_VERSION || stored == NULL ||
+        head->key_len != key_len || memcmp(stored, key, key_len) != 0 || deps_fresh(c, head->dep_count) < 0) {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+    *map_len = st.st_size;
+    return map;
+}
+
+/**
+ * Applies the variables and builtins at the cursor. They're walked once
+ * without applying anything first, so a damaged image changes nothing.
+ *
+ * Note: Returns 0 on success, -1 if the image is damaged
+ */
+static int image_apply(struct cursor *c, const struct snapshot_header *head) {
+    size_t start = c->pos;
+    if (load_vars(c, head->var_count, 0) < 0 || load_builtins(c, head->builtin_count, 0) < 0) return -1;
+    c->pos = start;
+    load_vars(c, head->var_count, 1);
+    load_builtins(c, head->builtin_count, 1);
+    return 0;
+}
+
+/**
+ * Writes an image to path: the header, key, rec's dependencies and the
+ * records.
+ */
+static void image_save(const char *path, const char *key, size_t key_len, struct recorder *rec,
+                       struct records *vars, struct records *builtins) {
+    struct snapshot_header head;
+    memset(&head, 0, sizeof(head));
+    memcpy(head.magic, SNAPSHOT_MAGIC, 4);
+    head.version = SNAPSHOT_VERSION;
+    head.key_len = key_len;
+    head.dep_count = rec->count;
+    head.var_count = vars->count;
+    head.builtin_count = builtins->count;
+
+    struct iovec parts[5] = {
+        { &head, sizeof(head) },
+        { (void *) key, key_len },
+        { rec->deps.data, rec->deps.len },
+        { vars->buf.data, vars->buf.len },
+        { builtins->buf.data, builtins->buf.len },
+    };
+    cache_save(path, parts, 5);
+}
+
+/**
+ * Checks that every one of count dependencies still stats the same, and
+ * records them for the images being recorded.
+ *
+ * Note: Returns 0 if they all do, -1 if one changed or the image is
+ * damaged
+ */
+static int deps_fresh(struct cursor *c, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        const void *raw = take(c, sizeof(struct snapshot_dep));
+        if (raw == NULL) return -1;
+        struct snapshot_dep dep;
+        memcpy(&dep, raw, sizeof(dep));
+        const char *path = take(c, (size_t) dep.path_len + 1);
+        if (path == NULL || path[dep.path_len] != '\0') return -1;
+
+        struct stat st;
+        if (stat(path, &st) == -1) {
+            if (!dep.missing) return -1;
+        } else if (dep.missing || (uint64_t) st.st_dev != dep.dev || (uint64_t) st.st_ino != dep.ino ||
+                   (uint64_t) st.st_size != dep.size || st.st_mtim.tv_sec != dep.mtime_sec ||
+                   st.st_mtim.tv_nsec != dep.mtime_nsec) {
+            return -1;
+        }
+        snapshot_depend(path);
+    }
+    return 0;
+}
+
+/**
+ * Steps over the count variable records at the cursor, applying them if
+ * apply is set.
+ *
+ * Note: Returns 0 on success, -1 if the image is damaged. Calls exit(1) on
+ * allocation failure
+ */
+static int load_vars(struct cursor *c, uint32_t count, int apply) {
+    for (uint32_t i = 0; i < count; i++) {
+        const void *raw = take(c, sizeof(uint32_t));
+        if (raw == NULL) return -1;
+        uint32_t kind;
+        memcpy(&kind, raw, sizeof(kind));
+
+        uint32_t name_len;
+        const char *name = take_string(c, &name_len);
+        if (name == NULL) return -1;
+        if (kind == ENV_SET || kind == ENV_UNSET) {
+            if (name_len == 0 || strchr(name, '=') != NULL) return -1;
+        } else if (!valid_name(name, name_len)) {
+            return -1;
+        }
+
+        if (kind == VAR_SCALAR || kind == ENV_SET) {
+            uint32_t len;
+            const char *value = take_string(c, &len);
+            if (value == NULL) return -1;
+            if (apply && kind == VAR_SCALAR) set_var(name, value, len);
+            if (apply && kind == ENV_SET) setenv(name, value, 1);
+        } else if (kind == VAR_UNSET || kind == ENV_UNSET) {
+            if (apply && kind == VAR_UNSET) unset_var(name);
+            if (apply && kind == ENV_UNSET) unsetenv(name);
+        } else if (kind == VAR_ARRAY) {
+            const void *trim = take(c, sizeof(uint32_t));
+            const void *sizes = take(c, 2 * sizeof(uint64_t));
+            if (trim == NULL || sizes == NULL) return -1;
+            uint64_t count_len[2];
+            memcpy(count_len, sizes, sizeof(count_len));
+            if (count_len[0] > c->len / sizeof(uint64_t)) return -1;
+            const void *ends = take(c, count_len[0] * sizeof(uint64_t));
+            const char *data = take(c, count_len[1]);
+            if (ends == NULL || data == NULL) return -1;
+            if (!apply) continue;
+
+            struct array arr;
+            memset(&arr, 0, sizeof(arr));
+            memcpy(&arr.trim, trim, sizeof(uint32_t));
+            arr.count = count_len[0];
+            arr.len = count_len[1];
+            arr.ends = malloc(arr.count ? arr.count * sizeof(size_t) : 1);
+            arr.data = malloc(arr.len ? arr.len : 1);
+            if (arr.ends == NULL || arr.data == NULL) {
+                fprintf(stderr, "Error: Memory allocation failed while restoring '%s': %s\n", name, strerror(errno));
+                exit(1);
+            }
+            for (size_t j = 0; j < arr.count; j++) {
+                uint64_t end;
+                memcpy(&end, (const char *) ends + j * sizeof(uint64_t), sizeof(end));
+                arr.ends[j] = end <= arr.len ? end : arr.len;
+            }
+            memcpy(arr.data, data, arr.len);
+            set_array(name, &arr);
+        } else {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Steps over the count builtin records at the cursor, turning those
+ * builtins on or off if apply is set.
+ *
+ * Note: Returns 0 on success, -1 if the image is damaged
+ */
+static int load_builtins(struct cursor *c, uint32_t count, int apply) {
+    for (uint32_t i = 0; i < count; i++) {
+        const void *raw = take(c, sizeof(uint32_t));
+        uint32_t enabled, len;
+        const char *name = raw != NULL ? take_string(c, &len) : NULL;
+        if (name == NULL) return -1;
+        memcpy(&enabled, raw, sizeof(enabled));
+        if (apply) set_builtin_enabled(name, enabled);
+    }
+    return 0;
+}
+
+/**
+ * Adds path to rec's dependencies, as missing if it doesn't exist.
+ */
+static void add_dep(struct recorder *rec, const char *path) {
+    struct stat st;
+    struct snapshot_dep dep;
+    memset(&dep, 0, sizeof(dep));
+    if (stat(path, &st) == -1) {
+        dep.missing = 1;
+    } else {
+        dep.dev = st.st_dev;
+        dep.ino = st.st_ino;
+        dep.size = st.st_size;
+        dep.mtime_sec = st.st_mtim.tv_sec;
+        dep.mtime_nsec = st.st_mtim.tv_nsec;
+    }
+    dep.path_len = strlen(path);
+    buffer_append(&rec->deps, (const char *) &dep, sizeof(dep));
+    buffer_append(&rec->deps, path, dep.path_len + 1);
+    rec->count++;
+}
+
+/**
+ * for_each_var() callback, adds one variable's record to the records in
+ * ctx.
+ */
+static void save_var(const char *name, const char *value, const struct array *arr, void *ctx) {
+    struct records *records = ctx;
+    struct buffer *out = &records->buf;
+    records->count++;
+    put_u32(out, arr != NULL ? VAR_ARRAY : VAR_SCALAR);
+    put_string(out, name, strlen(name));
+    if (arr == NULL) {
+        put_string(out, value, strlen(value));
+        return;
+    }
+    put_u32(out, arr->trim);
+    put_u64(out, arr->count);
+    put_u64(out, arr->len);
+    for (size_t i = 0; i < arr->count; i++) put_u64(out, arr->ends[i]);
+    buffer_append(out, arr->data, arr->len);
+}
+
+/**
+ * for_each_disabled_builtin() callback, adds a record turning the builtin
+ * off to the records in ctx.
+ */
+static void save_builtin(const char *name, void *ctx) {
+    struct records *records = ctx;
+    records->count++;
+    put_u32(&records->buf, 0);
+    put_string(&records->buf, name, strlen(name));
+}
+
+/**
+ * for_each_var() callback, adds a variable to the picture in ctx, an
+ * env_delta.
+ */
+static void collect_var(const char *name, const char *value, const struct array *arr, void *ctx) {
+    struct env_delta *d = ctx;
+    struct records record = { .count = 0 };
+    buffer_init(&record.buf);
+    save_var(name, value, arr, &record);
+
+    if (d->var_count == d->var_cap) d->vars = grow(d->vars, &d->var_cap, sizeof(struct var_entry));
+    d->vars[d->var_count++] = (struct var_entry) { copy_string(name), hash_bytes(record.buf.data, record.buf.len), 0 };
+    buffer_free(&record.buf);
+}
+
+/**
+ * for_each_disabled_builtin() callback, adds a builtin to the picture in
+ * ctx, an env_delta.
+ */
+static void collect_builtin(const char *name, void *ctx) {
+    struct env_delta *d = ctx;
+    if (d->disabled_count == d->disabled_cap) d->disabled = grow(d->disabled, &d->disabled_cap, sizeof(char *));
+    d->disabled[d->disabled_count++] = copy_string(name);
+}
+
+/**
+ * for_each_var() callback, adds the variable's record to the delta unless
+ * it's unchanged since the picture. ctx is a var_diff.
+ */
+static void diff_var(const char *name, const char *value, const struct array *arr, void *ctx) {
+    struct var_diff *diff = ctx;
+    struct records record = { .count = 0 };
+    buffer_init(&record.buf);
+    save_var(name, value, arr, &record);
+
+    struct var_entry *before = find_entry(diff->d, name);
+    if (before != NULL) before->seen = 1;
+    if (before == NULL || before->hash != hash_bytes(record.buf.data, record.buf.len)) {
+        buffer_append(&diff->out->buf, record.buf.data, record.buf.len);
+        diff->out->count++;
+    }
+    buffer_free(&record.buf);
+}
+
+/**
+ * Adds the environment variables set, changed or unset since the picture
+ * to the delta.
+ */
+static void diff_env(struct env_delta *d, struct records *out) {
+    for (char **env = environ; *env != NULL; env++) {
+        char **before = bsearch(env, d->env, d->env_count, sizeof(char *), compare_strings);
+        if (before != NULL) {
+            d->env_seen[before - d->env] = 1;
+            continue;
+        }
+        const char *eq = strchr(*env, '=');
+        if (eq == NULL || eq == *env) continue;
+        put_u32(&out->buf, ENV_SET);
+        put_string(&out->buf, *env, eq - *env);
+        put_string(&out->buf, eq + 1, strlen(eq + 1));
+        out->count++;
+    }
+
+    for (size_t i = 0; i < d->env_count; i++) {
+        const char *eq = strchr(d->env[i], '=');
+        if (d->env_seen[i] || eq == NULL || eq == d->env[i]) continue;
+        char *name = strndup(d->env[i], eq - d->env[i]);
+        if (name == NULL) {
+            fprintf(stderr, "Error: Memory allocation failed for environment delta: %s\n", strerror(errno));
+            exit(1);
+        }
+        if (getenv(name) == NULL) {
+            put_u32(&out->buf, ENV_UNSET);
+            put_string(&out->buf, name, strlen(name));
+            out->count++;
+        }
+        free(name);
+    }
+}
+
+/**
+ * Adds the builtins turned on or off since the picture to the delta.
+ */
+static void diff_builtins(struct env_delta *d, struct records *out) {
+    struct env_delta after;
+    memset(&after, 0, sizeof(after));
+    for_each_disabled_builtin(collect_builtin, &after);
+
+    for (int pass = 0; pass < 2; pass++) {
+        // Disabled now but not before, then the other way round
+        char **from = pass == 0 ? after.disabled : d->disabled;
+        size_t from_count = pass == 0 ? after.disabled_count : d->disabled_count;
+        char **to = pass == 0 ? d->disabled : after.disabled;
+        size_t to_count = pass == 0 ? d->disabled_count : after.disabled_count;
+        for (size_t i = 0; i < from_count; i++) {
+            size_t j = 0;
+            while (j < to_count && strcmp(from[i], to[j]) != 0) j++;
+            if (j < to_count) continue;
+            put_u32(&out->buf, pass);
+            put_string(&out->buf, from[i], strlen(from[i]));
+            out->count++;
+        }
+    }
+
+    for (size_t i = 0; i < after.disabled_count; i++) free(after.disabled[i]);
+    free(after.disabled);
+}
+
+/**
+ * Finds a variable in the picture by name.
+ */
+static struct var_entry *find_entry(struct env_delta *d, const char *name) {
+    struct var_entry key = { (char *) name, 0, 0 };
+    return bsearch(&key, d->vars, d->var_count, sizeof(struct var_entry), compare_entries);
+}
+
+static int compare_entries(const void *a, const void *b) {
+    return strcmp(((const struct var_entry *) a)->name, ((const struct var_entry *) b)->name);
+}
+
+static int compare_strings(const void *a, const void *b) {
+    return strcmp(*(char *const *) a, *(char *const *) b);
+}
+
+/**
+ * Doubles the room in an array of size byte elements.
+ *
+ * Note: Calls exit(1) on allocation failure
+ */
+static void *grow(void *array, size_t *cap, size_t size) {
+    *cap = *cap ? *cap * 2 : 16;
+    void *temp = realloc(array, *cap * size);
+    if (temp == NULL) {
+        fprintf(stderr, "Error: Memory reallocation failed for environment delta: %s\n", strerror(errno));
+        exit(1);
+    }
+    return temp;
+}
+
+/**
+ * strdup() that exits on allocation failure.
+ */
+static char *copy_string(const char *s) {
+    char *copy = strdup(s);
+    if (copy == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed for environment delta: %s\n", strerror(errno));
+        exit(1);
+    }
+    return copy;
+}
+
+static void put_u32(struct buffer *out, uint32_t value) {
+    buffer_append(out, (const char *) &value, sizeof(value));
+}
+
+static void put_u64(struct buffer *out, uint64_t value) {
+    buffer_append(out, (const char *) &value, sizeof(value));
+}
+
+static void put_string(struct buffer *out, const char *s, size_t len) {
+    put_u32(out, len);
+    buffer_append(out, s, len);
+    buffer_append(out, "", 1);
+}
+
+/**
+ * Steps the cursor over len bytes.
+ *
+ * Note: Returns where they start, or NULL if fewer than len are left
+ */
+static const void *take(struct cursor *c, size_t len) {
+    if (c->len - c->pos < len) return NULL;
+    const void *p = c->data + c->pos;
+    c->pos += len;
+    return p;
+}
+
+/**
+ * Steps the cursor over a string, putting its length in *len.
+ *
+ * Note: Returns the NUL-terminated string, or NULL if it's damaged
+ */
+static const char *take_string(struct cursor *c, uint32_t *len) {
+    const void *raw = take(c, sizeof(uint32_t));
+    if (raw == NULL) return NULL;
+    memcpy(len, raw, sizeof(uint32_t));
+    const char *s = take(c, (size_t) *len + 1);
+    return s != NULL && s[*len] == '\0' ? s : NULL;
+}
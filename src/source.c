@@ -0,0 +1,218 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include "shell.h"
+
+#define SOURCE_MAX_DEPTH 100
+#define CACHED_SOURCE_MAX_INPUTS 64
+
+// Nesting of source runs, and the positional parameters outside them
+static int depth = 0;
+static char **outer_positional = NULL;
+static int outer_count = 0;
+
+static int run_sourced(const char *name, const char *path, char **args);
+static const char *find_sourced(const char *name, char *path, size_t size);
+static char *resolve(const char *path);
+
+/**
+ * Built-in: source file [args...]
+ * (also .)
+ *
+ * Runs file in the current shell, so the variables it sets stay set. A
+ * name without a slash is looked up in PATH first (the file only needs to
+ * be readable), then in the current directory. With args they become $1
+ * onwards while the file runs, $0 stays as it was.
+ *
+ * The file runs from parsed records kept for the session, see
+ * cache_open_sourced(), so sourcing an unchanged file again skips the
+ * lexer.
+ *
+ * Note: Returns the exit status of the file's last command, 1 if it
+ * couldn't be read, 2 on bad usage
+ */
+int builtin_source(char **argv) {
+    if (argv[1] == NULL) {
+        fprintf(stderr, "%s: usage: %s file [args...]\n", argv[0], argv[0]);
+        return 2;
+    }
+    char found[PATH_MAX];
+    return run_sourced(argv[0], find_sourced(argv[1], found, sizeof(found)), argv + 1);
+}
+
+/**
+ * Built-in: cached-source [-i input]... file [args...]
+ *
+ * Like source, but what the run changed (variables and arrays set or
+ * unset, environment variables, builtins turned on or off) is saved as a
+ * delta in the cache directory, keyed on the file's path and the args.
+ * Later calls apply the delta instead of running anything, until the
+ * file, any file it sourced or one of the declared inputs changes. An
+ * input that doesn't exist yet counts as changed once it does.
+ *
+ * For setup scripts whose result only depends on those files: anything
+ * else they look at (the current directory, the time, other programs'
+ * output) has to be declared with -i or it won't invalidate the delta.
+ * What the run printed isn't replayed, and a run that fails isn't saved.
+ *
+ * Note: Returns 0 when the delta was applied, otherwise like source
+ */
+int builtin_cached_source(char **argv) {
+    char *inputs[CACHED_SOURCE_MAX_INPUTS + 1];
+    int input_count = 0;
+    int i = 1;
+
+    for (; argv[i] != NULL && argv[i][0] == '-' && argv[i][1] != '\0'; i++) {
+        if (strcmp(argv[i], "--") == 0) {
+            i++;
+            break;
+        }
+        if (strcmp(argv[i], "-i") == 0 && argv[i + 1] != NULL && input_count < CACHED_SOURCE_MAX_INPUTS) {
+            inputs[input_count++] = argv[++i];
+        } else {
+            fprintf(stderr, "cached-source: usage: cached-source [-i input]... file [args...]\n");
+            return 2;
+        }
+    }
+    if (argv[i] == NULL) {
+        fprintf(stderr, "cached-source: usage: cached-source [-i input]... file [args...]\n");
+        return 2;
+    }
+
+    char found[PATH_MAX];
+    char real[PATH_MAX];
+    const char *path = find_sourced(argv[i], found, sizeof(found));
+    if (realpath(path, real) == NULL) {
+        fprintf(stderr, "cached-source: %s: %s\n", argv[i], strerror(errno));
+        return 1;
+    }
+
+    // Key: the counts, then the file, args and inputs, each NUL-terminated
+    struct buffer key;
+    buffer_init(&key);
+    int arg_count = 0;
+    while (argv[i + 1 + arg_count] != NULL) arg_count++;
+    char counts[64];
+    int len = snprintf(counts, sizeof(counts), "%d %d", arg_count, input_count);
+    buffer_append(&key, counts, len + 1);
+    buffer_append(&key, real, strlen(real) + 1);
+    for (int j = 0; j < arg_count; j++) buffer_append(&key, argv[i + 1 + j], strlen(argv[i + 1 + j]) + 1);
+    for (int j = 0; j < input_count; j++) {
+        inputs[j] = resolve(inputs[j]);
+        buffer_append(&key, inputs[j], strlen(inputs[j]) + 1);
+    }
+    inputs[input_count] = NULL;
+
+    int status = 0;
+    if (delta_replay(key.data, key.len) < 0) {
+        struct env_delta *delta = delta_begin();
+        status = run_sourced(argv[0], real, argv + i);
+        delta_end(delta, key.data, key.len, inputs, status == 0 && !exit_requested);
+    }
+    for (int j = 0; j < input_count; j++) free(inputs[j]);
+    buffer_free(&key);
+    return status;
+}
+
+/**
+ * Runs the file at path for source, args being the file as named and
+ * then the positional parameters to give it.
+ *
+ * Note: Returns the exit status of the file's last command, 1 w/ message
+ * if it couldn't be read
+ */
+static int run_sourced(const char *name, const char *path, char **args) {
+    if (depth >= SOURCE_MAX_DEPTH) {
+        fprintf(stderr, "%s: %s: sourced too deeply (%d levels)\n", name, args[0], SOURCE_MAX_DEPTH);
+        return 1;
+    }
+    struct input_source src;
+    if (cache_open_sourced(path, &src) < 0) {
+        fprintf(stderr, "%s: %s: %s\n", name, args[0], strerror(errno));
+        return 1;
+    }
+    snapshot_depend(path);
+
+    char **saved;
+    int saved_count = get_positional(&saved);
+    if (depth++ == 0) {
+        outer_positional = saved;
+        outer_count = saved_count;
+    }
+    // With args, the command's own array becomes the parameters, its
+    // file slot holding $0 until the run ends
+    char *file = args[0];
+    if (args[1] != NULL) {
+        int count = 1;
+        while (args[count] != NULL) count++;
+        args[0] = saved_count > 0 ? saved[0] : "bshell";
+        set_positional(count, args);
+    }
+
+    int status = run_source(&src, 0);
+    input_close(&src);
+    if (args[1] != NULL) {
+        args[0] = file;
+        set_positional(saved_count, saved);
+    }
+    depth--;
+    return status;
+}
+
+/**
+ * Undoes what source runs cut short by Ctrl-C had changed: the input
+ * stack, positional parameters and recordings. Their sources are leaked, the frames
+ * holding them are gone.
+ */
+void source_reset(void) {
+    input_reset();
+    snapshot_reset();
+    if (depth > 0) set_positional(outer_count, outer_positional);
+    depth = 0;
+}
+
+/**
+ * Finds the file source means by name: name itself if it has a slash,
+ * otherwise the first readable regular file of that name in PATH, or
+ * name in the current directory if there's none.
+ *
+ * Note: Returns name or path, which holds a PATH match
+ */
+static const char *find_sourced(const char *name, char *path, size_t size) {
+    if (strchr(name, '/') != NULL) return name;
+
+    const char *dirs = getenv("PATH");
+    while (dirs != NULL && *dirs != '\0') {
+        const char *end = strchrnul(dirs, ':');
+        int len = end > dirs ? snprintf(path, size, "%.*s/%s", (int) (end - dirs), dirs, name)
+                             : snprintf(path, size, "./%s", name);
+        struct stat st;
+        if (len > 0 && (size_t) len < size && stat(path, &st) == 0 && S_ISREG(st.st_mode) &&
+            access(path, R_OK) == 0) {
+            return path;
+        }
+        dirs = *end == ':' ? end + 1 : end;
+    }
+    return name;
+}
+
+/**
+ * Returns a malloc'd absolute form of path, or a copy of it as is if it
+ * doesn't exist (yet).
+ *
+ * Note: Calls exit(1) on allocation failure
+ */
+static char *resolve(const char *path) {
+    char *real = realpath(path, NULL);
+    if (real == NULL) real = strdup(path);
+    if (real == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed for '%s': %s\n", path, strerror(errno));
+        exit(1);
+    }
+    return real;
+}
@@ -0,0 +1,803 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+#include "shell.h"
+
+#define TEXT_BUF_SIZE (256 * 1024)
+#define TEXT_OUT_SIZE 65536
+
+/*
+ * Streaming wc, head, tail and grep -F. They are flagged BUILTIN_FORKED, so
+ * they only ever run as the child of a pipeline stage: no exec, but still
+ * their own process, free to block, exit early or die of SIGPIPE. Options
+ * they don't implement exec the real program instead, so behaviour never
+ * changes, only speed. `enable -n wc` turns one off entirely.
+ */
+
+// Output is batched by hand, stdio would add a copy for every line
+static char out_buf[TEXT_OUT_SIZE];
+static size_t out_len = 0;
+
+static void print_header(const char *name, int first);
+static void out_write(const char *data, size_t len);
+static int out_flush(void);
+static void exec_fallback(char **argv) __attribute__((noreturn));
+static int open_input(const char *cmd, const char *name);
+static ssize_t read_some(int fd, char *buf, size_t len);
+static int parse_count(const char *arg, long *value);
+static const char *find_fixed(const char *hay, size_t len, const char *needle, size_t m);
+static size_t count_words(const char *p, size_t len, int *in_word);
+static size_t tail_start(const char *buf, size_t len, long n);
+static int head_fd(int fd, long n);
+static int tail_fd(int fd, long n, int from_start);
+
+#if defined(__x86_64__)
+/**
+ * AVX2 newline count: 32 bytes per compare, per-lane byte counters folded
+ * into 64-bit sums every 255 rounds before they could overflow.
+ */
+__attribute__((target("avx2")))
+static size_t count_newlines_avx2(const char *p, size_t len) {
+    const __m256i nl = _mm256_set1_epi8('\n');
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i total = zero;
+    size_t i = 0;
+
+    while (len - i >= 32) {
+        __m256i acc = zero;
+        for (int round = 0; round < 255 && len - i >= 32; round++, i += 32) {
+            __m256i v = _mm256_loadu_si256((const __m256i *) (p + i));
+            // Matching lanes are 0xff, i.e. -1, so subtracting counts them
+            acc = _mm256_sub_epi8(acc, _mm256_cmpeq_epi8(v, nl));
+        }
+        total = _mm256_add_epi64(total, _mm256_sad_epu8(acc, zero));
+    }
+
+    size_t count = (size_t) _mm256_extract_epi64(total, 0) + (size_t) _mm256_extract_epi64(total, 1) +
+                   (size_t) _mm256_extract_epi64(total, 2) + (size_t) _mm256_extract_epi64(total, 3);
+    for (; i < len; i++) {
+        count += p[i] == '\n';
+    }
+    return count;
+}
+
+/**
+ * AVX2 substring search: compares the needle's first and last bytes against
+ * 32 positions at once and only memcmp()s the candidates both agree on.
+ * Needs m >= 2.
+ */
+__attribute__((target("avx2")))
+static const char *find_fixed_avx2(const char *hay, size_t len, const char *needle, size_t m) {
+    const __m256i first = _mm256_set1_epi8(needle[0]);
+    const __m256i last = _mm256_set1_epi8(needle[m - 1]);
+    size_t i = 0;
+
+    for (; i + m - 1 + 32 <= len; i += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i *) (hay + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *) (hay + i + m - 1));
+        unsigned int mask = (unsigned int) _mm256_movemask_epi8(
+            _mm256_and_si256(_mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, last)));
+        while (mask != 0) {
+            size_t at = i + __builtin_ctz(mask);
+            if (memcmp(hay + at + 1, needle + 1, m - 2) == 0) return hay + at;
+            mask &= mask - 1;
+        }
+    }
+    return i < len ? memmem(hay + i, len - i, needle, m) : NULL;
+}
+
+/**
+ * AVX2 delimiter scan: one compare and movemask per 32 bytes, then the set
+ * bits are peeled off lowest first.
+ */
+__attribute__((target("avx2")))
+static size_t find_delims_avx2(const char *p, size_t len, char delim, size_t *offsets, size_t max) {
+    const __m256i d = _mm256_set1_epi8(delim);
+    size_t found = 0;
+    size_t i = 0;
+
+    for (; len - i >= 32 && found < max; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (p + i));
+        unsigned int mask = (unsigned int) _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, d));
+        while (mask != 0 && found < max) {
+            offsets[found++] = i + __builtin_ctz(mask);
+            mask &= mask - 1;
+        }
+        if (found == max) return found;
+    }
+    for (; i < len && found < max; i++) {
+        if (p[i] == delim) offsets[found++] = i;
+    }
+    return found;
+}
+
+static int have_avx2(void) {
+    static int cached = -1;
+    if (cached == -1) {
+        __builtin_cpu_init();
+        cached = __builtin_cpu_supports("avx2") ? 1 : 0;
+    }
+    return cached;
+}
+#endif
+
+/**
+ * Counts '\n' bytes in p[0..len), with AVX2 when the CPU has it and
+ * memchr() hops (SSE2 inside glibc) otherwise.
+ */
+size_t count_newlines(const char *p, size_t len) {
+#if defined(__x86_64__)
+    if (have_avx2()) return count_newlines_avx2(p, len);
+#endif
+    size_t count = 0;
+    const char *end = p + len;
+    while ((p = memchr(p, '\n', end - p)) != NULL) {
+        count++;
+        p++;
+    }
+    return count;
+}
+
+/**
+ * Records the offsets of the first max delim bytes in p[0..len), in order,
+ * with AVX2 when the CPU has it and memchr() hops otherwise.
+ *
+ * Note: Returns how many were found, max if there may be more
+ */
+size_t find_delims(const char *p, size_t len, char delim, size_t *offsets, size_t max) {
+#if defined(__x86_64__)
+    if (have_avx2()) return find_delims_avx2(p, len, delim, offsets, max);
+#endif
+    size_t found = 0;
+    const char *at = p;
+    const char *end = p + len;
+    while (found < max && (at = memchr(at, delim, end - at)) != NULL) {
+        offsets[found++] = at - p;
+        at++;
+    }
+    return found;
+}
+
+/**
+ * Built-in: wc [-lwc] [files...]
+ *
+ * Output is laid out like GNU wc. Other options (-m, -L, long ones) run the
+ * real wc.
+ */
+int builtin_wc(char **argv) {
+    int lines = 0, words = 0, bytes = 0;
+    int i = 1;
+
+    for (; argv[i] != NULL && argv[i][0] == '-' && argv[i][1] != '\0'; i++) {
+        if (strcmp(argv[i], "--") == 0) {
+            i++;
+            break;
+        }
+        for (const char *f = argv[i] + 1; *f; f++) {
+            if (*f == 'l') lines = 1;
+            else if (*f == 'w') words = 1;
+            else if (*f == 'c') bytes = 1;
+            else exec_fallback(argv);
+        }
+    }
+    for (int j = i; argv[j] != NULL; j++) {
+        if (argv[j][0] == '-' && argv[j][1] != '\0') exec_fallback(argv);
+    }
+    if (!lines && !words && !bytes) lines = words = bytes = 1;
+
+    char **files = argv + i;
+    int nfiles = 0;
+    while (files[nfiles] != NULL) nfiles++;
+
+    // Column width: 1 for a lone number, else wide enough for the total
+    // size, and at least 7 when some input's size isn't known up front
+    int width = 1;
+    if (lines + words + bytes > 1 || nfiles > 1) {
+        off_t total = 0;
+        int unknown = 0;
+        for (int j = 0; j < (nfiles ? nfiles : 1); j++) {
+            struct stat st;
+            int ok = (nfiles == 0 || strcmp(files[j], "-") == 0) ? fstat(STDIN_FILENO, &st) : stat(files[j], &st);
+            if (ok == 0 && S_ISREG(st.st_mode)) total += st.st_size;
+            else unknown = 1;
+        }
+        for (; total >= 10; total /= 10) width++;
+        if (unknown && width < 7) width = 7;
+    }
+
+    char *buf = malloc(TEXT_BUF_SIZE);
+    if (buf == NULL) {
+        fprintf(stderr, "wc: %s\n", strerror(errno));
+        return 1;
+    }
+
+    int status = 0;
+    size_t totals[3] = { 0, 0, 0 };
+    for (int j = 0; j < (nfiles ? nfiles : 1); j++) {
+        const char *name = nfiles ? files[j] : NULL;
+        int fd = open_input("wc", name);
+        if (fd == -1) {
+            status = 1;
+            continue;
+        }
+
+        size_t counts[3] = { 0, 0, 0 };
+        struct stat st;
+        if (bytes && !lines && !words && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+            // Byte count alone needs no reading
+            off_t at = lseek(fd, 0, SEEK_CUR);
+            counts[2] = st.st_size - (at > 0 ? at : 0);
+        } else {
+            int in_word = 0;
+            ssize_t n;
+            while ((n = read_some(fd, buf, TEXT_BUF_SIZE)) > 0) {
+                counts[2] += n;
+                if (lines) counts[0] += count_newlines(buf, n);
+                if (words) counts[1] += count_words(buf, n, &in_word);
+            }
+            if (n < 0) {
+                fprintf(stderr, "wc: %s: %s\n", name ? name : "standard input", strerror(errno));
+                status = 1;
+            }
+        }
+        if (fd != STDIN_FILENO) close(fd);
+
+        char line[128];
+        int len = 0;
+        int want[3] = { lines, words, bytes };
+        for (int k = 0; k < 3; k++) {
+            totals[k] += counts[k];
+            if (want[k]) len += snprintf(line + len, sizeof(line) - len, "%s%*zu", len ? " " : "", width, counts[k]);
+        }
+        out_write(line, len);
+        if (name != NULL) {
+            out_write(" ", 1);
+            out_write(name, strlen(name));
+        }
+        out_write("\n", 1);
+    }
+
+    if (nfiles > 1) {
+        char line[128];
+        int len = 0;
+        int want[3] = { lines, words, bytes };
+        for (int k = 0; k < 3; k++) {
+            if (want[k]) len += snprintf(line + len, sizeof(line) - len, "%s%*zu", len ? " " : "", width, totals[k]);
+        }
+        out_write(line, len);
+        out_write(" total\n", 7);
+    }
+
+    free(buf);
+    return out_flush() < 0 ? 1 : status;
+}
+
+/**
+ * Built-in: head [-n N | -N] [files...]
+ *
+ * Stops reading as soon as N lines are out, and hands unread bytes back to
+ * a seekable input so a following command sees them. Byte counts, negative
+ * counts and size suffixes run the real head.
+ */
+int builtin_head(char **argv) {
+    long n = 10;
+    int i = 1;
+
+    for (; argv[i] != NULL && argv[i][0] == '-' && argv[i][1] != '\0'; i++) {
+        if (strcmp(argv[i], "--") == 0) {
+            i++;
+            break;
+        }
+        if (strcmp(argv[i], "-n") == 0 && argv[i + 1] != NULL) {
+            if (parse_count(argv[++i], &n) < 0) exec_fallback(argv);
+        } else if (strncmp(argv[i], "-n", 2) == 0) {
+            if (parse_count(argv[i] + 2, &n) < 0) exec_fallback(argv);
+        } else if (parse_count(argv[i] + 1, &n) < 0) {
+            exec_fallback(argv);
+        }
+    }
+    for (int j = i; argv[j] != NULL; j++) {
+        if (argv[j][0] == '-' && argv[j][1] != '\0') exec_fallback(argv);
+    }
+
+    char **files = argv + i;
+    int nfiles = 0;
+    while (files[nfiles] != NULL) nfiles++;
+
+    int status = 0;
+    for (int j = 0; j < (nfiles ? nfiles : 1); j++) {
+        const char *name = nfiles ? files[j] : NULL;
+        int fd = open_input("head", name);
+        if (fd == -1) {
+            status = 1;
+            continue;
+        }
+        if (nfiles > 1) print_header(name, j == 0);
+        if (head_fd(fd, n) < 0) {
+            fprintf(stderr, "head: %s: %s\n", name ? name : "standard input", strerror(errno));
+            status = 1;
+        }
+        if (fd != STDIN_FILENO) close(fd);
+    }
+    return out_flush() < 0 ? 1 : status;
+}
+
+/**
+ * Built-in: tail [-n [+]N | -N] [files...]
+ *
+ * Regular files are scanned backwards from the end and the wanted tail is
+ * copied with copy_fd(), pipes keep only the last N lines in memory.
+ * Byte counts, follow mode and other options run the real tail.
+ */
+int builtin_tail(char **argv) {
+    long n = 10;
+    int from_start = 0;
+    int i = 1;
+
+    for (; argv[i] != NULL && argv[i][0] == '-' && argv[i][1] != '\0'; i++) {
+        if (strcmp(argv[i], "--") == 0) {
+            i++;
+            break;
+        }
+        const char *count = NULL;
+        if (strcmp(argv[i], "-n") == 0 && argv[i + 1] != NULL) count = argv[++i];
+        else if (strncmp(argv[i], "-n", 2) == 0) count = argv[i] + 2;
+        else count = argv[i] + 1;
+
+        from_start = (*count == '+');
+        if (parse_count(count + from_start, &n) < 0) exec_fallback(argv);
+    }
+    for (int j = i; argv[j] != NULL; j++) {
+        if (argv[j][0] == '-' && argv[j][1] != '\0') exec_fallback(argv);
+    }
+
+    char **files = argv + i;
+    int nfiles = 0;
+    while (files[nfiles] != NULL) nfiles++;
+
+    int status = 0;
+    for (int j = 0; j < (nfiles ? nfiles : 1); j++) {
+        const char *name = nfiles ? files[j] : NULL;
+        int fd = open_input("tail", name);
+        if (fd == -1) {
+            status = 1;
+            continue;
+        }
+        if (nfiles > 1) print_header(name, j == 0);
+        if (tail_fd(fd, n, from_start) < 0) {
+            fprintf(stderr, "tail: %s: %s\n", name ? name : "standard input", strerror(errno));
+            status = 1;
+        }
+        if (fd != STDIN_FILENO) close(fd);
+    }
+    return out_flush() < 0 ? 1 : status;
+}
+
+/**
+ * Built-in: grep -F [-vcqn] pattern [files...]
+ *
+ * A single fixed string, found with the AVX2 search over whole buffers
+ * rather than line by line. Patterns without regex metacharacters are
+ * fixed strings already, so plain `grep word` is handled too. Anything
+ * else (regexes, -i, -e, -r, ...) runs the real grep.
+ *
+ * Note: Returns 0 if a line was selected, 1 if none, 2 on error
+ */
+int builtin_grep(char **argv) {
+    int fixed = 0, invert = 0, count_only = 0, quiet = 0, numbers = 0;
+    int i = 1;
+
+    for (; argv[i] != NULL && argv[i][0] == '-' && argv[i][1] != '\0'; i++) {
+        if (strcmp(argv[i], "--") == 0) {
+            i++;
+            break;
+        }
+        for (const char *f = argv[i] + 1; *f; f++) {
+            if (*f == 'F') fixed = 1;
+            else if (*f == 'v') invert = 1;
+            else if (*f == 'c') count_only = 1;
+            else if (*f == 'q') quiet = 1;
+            else if (*f == 'n') numbers = 1;
+            else exec_fallback(argv);
+        }
+    }
+    const char *pattern = argv[i];
+    if (pattern == NULL || strchr(pattern, '\n') != NULL) exec_fallback(argv);
+    if (!fixed && strpbrk(pattern, ".[]*^$\\") != NULL) exec_fallback(argv);
+    for (int j = i + 1; argv[j] != NULL; j++) {
+        if (argv[j][0] == '-' && argv[j][1] != '\0') exec_fallback(argv);
+    }
+
+    char **files = argv + i + 1;
+    int nfiles = 0;
+    while (files[nfiles] != NULL) nfiles++;
+    size_t m = strlen(pattern);
+
+    struct buffer buf;
+    buffer_init(&buf);
+    buffer_reserve(&buf, TEXT_BUF_SIZE);
+
+    int matched = 0, failed = 0;
+    for (int j = 0; j < (nfiles ? nfiles : 1); j++) {
+        const char *name = nfiles ? files[j] : NULL;
+        int fd = open_input("grep", name);
+        if (fd == -1) {
+            failed = 1;
+            continue;
+        }
+        const char *shown = (name == NULL || strcmp(name, "-") == 0) ? "(standard input)" : name;
+        size_t shown_len = strlen(shown);
+
+        size_t selected = 0, lineno = 1;
+        int eof = 0;
+        buf.len = 0;
+        while (!eof && !(quiet && selected > 0)) {
+            if (buf.cap - buf.len - 1 < TEXT_BUF_SIZE / 2) buffer_reserve(&buf, TEXT_BUF_SIZE);
+            ssize_t got = read_some(fd, buf.data + buf.len, buf.cap - buf.len - 1);
+            if (got < 0) {
+                fprintf(stderr, "grep: %s: %s\n", shown, strerror(errno));
+                failed = 1;
+                break;
+            }
+            buf.len += got;
+            eof = (got == 0);
+
+            // Only complete lines are searched, a partial one waits for more
+            size_t usable = buf.len;
+            if (!eof) {
+                const char *nl = memrchr(buf.data, '\n', buf.len);
+                if (nl == NULL) continue;
+                usable = nl - buf.data + 1;
+            }
+
+            const char *pos = buf.data, *end = buf.data + usable;
+            while (pos < end && !(quiet && selected > 0)) {
+                const char *hit = find_fixed(pos, end - pos, pattern, m);
+                const char *line = end, *next = end;
+                if (hit != NULL) {
+                    const char *nl = memrchr(pos, '\n', hit - pos);
+                    line = nl ? nl + 1 : pos;
+                    nl = memchr(hit, '\n', end - hit);
+                    next = nl ? nl + 1 : end;
+                }
+
+                // Selected run: the unmatched lines before the hit for -v,
+                // the hit's own line otherwise
+                const char *from = invert ? pos : line;
+                const char *to = invert ? line : next;
+                if (to > from) {
+                    selected += count_newlines(from, to - from) + (to[-1] != '\n');
+                    if (count_only || quiet) {
+                        // Nothing to print
+                    } else if (!numbers && nfiles <= 1) {
+                        out_write(from, to - from);
+                        if (to[-1] != '\n') out_write("\n", 1);
+                    } else {
+                        size_t ln = lineno + (numbers ? count_newlines(pos, from - pos) : 0);
+                        for (const char *l = from; l < to; ln++) {
+                            const char *nl = memchr(l, '\n', to - l);
+                            const char *stop = nl ? nl + 1 : to;
+                            if (nfiles > 1) {
+                                out_write(shown, shown_len);
+                                out_write(":", 1);
+                            }
+                            if (numbers) {
+                                char prefix[32];
+                                out_write(prefix, snprintf(prefix, sizeof(prefix), "%zu:", ln));
+                            }
+                            out_write(l, stop - l);
+                            if (nl == NULL) out_write("\n", 1);
+                            l = stop;
+                        }
+                    }
+                }
+                if (numbers) lineno += count_newlines(pos, next - pos);
+                pos = next;
+            }
+
+            memmove(buf.data, buf.data + usable, buf.len - usable);
+            buf.len -= usable;
+        }
+        if (fd != STDIN_FILENO) close(fd);
+
+        if (count_only && !quiet) {
+            char line[32];
+            if (nfiles > 1) {
+                out_write(shown, shown_len);
+                out_write(":", 1);
+            }
+            out_write(line, snprintf(line, sizeof(line), "%zu\n", selected));
+        }
+        if (selected > 0) {
+            matched = 1;
+            if (quiet) break;
+        }
+    }
+
+    buffer_free(&buf);
+    if (out_flush() < 0) failed = 1;
+    if (quiet && matched) return 0;
+    return failed ? 2 : (matched ? 0 : 1);
+}
+
+/**
+ * Prints the first n lines of fd. When the input is seekable, whatever was
+ * read past them is given back with lseek().
+ *
+ * Note: Returns 0 on success, -1 w/ errno set on read failure
+ */
+static int head_fd(int fd, long n) {
+    static char buf[TEXT_BUF_SIZE];
+    if (n == 0) return 0;
+
+    ssize_t got;
+    while ((got = read_some(fd, buf, sizeof(buf))) > 0) {
+        size_t lines = count_newlines(buf, got);
+        if ((long) lines < n) {
+            out_write(buf, got);
+            n -= lines;
+            continue;
+        }
+
+        const char *p = buf;
+        while (1) {
+            p = memchr(p, '\n', buf + got - p) + 1;
+            if (--n == 0) break;
+        }
+        out_write(buf, p - buf);
+        lseek(fd, p - (buf + got), SEEK_CUR);
+        return 0;
+    }
+    return got < 0 ? -1 : 0;
+}
+
+/**
+ * Prints the last n lines of fd, or everything from line n on when
+ * from_start is set (tail -n +N).
+ *
+ * Note: Returns 0 on success, -1 w/ errno set on read failure
+ */
+static int tail_fd(int fd, long n, int from_start) {
+    struct stat st;
+    off_t base = lseek(fd, 0, SEEK_CUR);
+
+    if (from_start) {
+        // Skip n - 1 lines, then copy the rest without looking at it
+        static char buf[TEXT_BUF_SIZE];
+        long skip = n > 0 ? n - 1 : 0;
+        ssize_t got = 0;
+        while (skip > 0 && (got = read_some(fd, buf, sizeof(buf))) > 0) {
+            size_t lines = count_newlines(buf, got);
+            if ((long) lines < skip) {
+                skip -= lines;
+                continue;
+            }
+            const char *p = buf;
+            while (skip-- > 0) {
+                p = memchr(p, '\n', buf + got - p) + 1;
+            }
+            out_write(p, buf + got - p);
+        }
+        if (got < 0) return -1;
+        if (out_flush() < 0) return 0;
+        return copy_fd(fd, NULL, STDOUT_FILENO) < 0 && errno != EPIPE ? -1 : 0;
+    }
+
+    if (base != -1 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        // Walk back from the end a block at a time until n newlines are seen
+        static char buf[TEXT_BUF_SIZE];
+        off_t pos = st.st_size;
+        off_t start = base;
+        long want = n;
+        int at_end = 1;
+
+        if (want == 0) start = st.st_size;
+        while (want > 0 && pos > base) {
+            size_t chunk = pos - base < TEXT_BUF_SIZE ? (size_t) (pos - base) : TEXT_BUF_SIZE;
+            pos -= chunk;
+            if (pread(fd, buf, chunk, pos) != (ssize_t) chunk) return -1;
+
+            size_t p = chunk;
+            if (at_end && p > 0 && buf[p - 1] == '\n') p--;
+            at_end = 0;
+            const char *nl;
+            while (p > 0 && (nl = memrchr(buf, '\n', p)) != NULL) {
+                if (--want == 0) {
+                    start = pos + (nl - buf) + 1;
+                    break;
+                }
+                p = nl - buf;
+            }
+        }
+
+        if (out_flush() < 0) return 0;
+        return copy_fd(fd, &start, STDOUT_FILENO) < 0 && errno != EPIPE ? -1 : 0;
+    }
+
+    // Pipe: keep a window holding at least the last n lines, compacting
+    // it whenever it fills and growing it only when n lines don't fit
+    struct buffer buf;
+    buffer_init(&buf);
+    buffer_reserve(&buf, TEXT_BUF_SIZE);
+
+    ssize_t got;
+    while (1) {
+        if (buf.cap - buf.len - 1 < TEXT_BUF_SIZE / 4) {
+            size_t keep = tail_start(buf.data, buf.len, n);
+            memmove(buf.data, buf.data + keep, buf.len - keep);
+            buf.len -= keep;
+            if (buf.len > buf.cap / 4) buffer_reserve(&buf, buf.cap);
+        }
+        got = read_some(fd, buf.data + buf.len, buf.cap - buf.len - 1);
+        if (got <= 0) break;
+        buf.len += got;
+    }
+
+    size_t start = tail_start(buf.data, buf.len, n);
+    out_write(buf.data + start, buf.len - start);
+    buffer_free(&buf);
+    return got < 0 ? -1 : 0;
+}
+
+/**
+ * Finds where the last n lines of buf begin. A final line without a
+ * newline still counts as a line.
+ *
+ * Note: Returns 0 if buf holds fewer than n lines.
+ */
+static size_t tail_start(const char *buf, size_t len, long n) {
+    if (n == 0) return len;
+
+    size_t p = len;
+    if (p > 0 && buf[p - 1] == '\n') p--;
+    const char *nl;
+    while (p > 0 && (nl = memrchr(buf, '\n', p)) != NULL) {
+        if (--n == 0) return nl - buf + 1;
+        p = nl - buf;
+    }
+    return 0;
+}
+
+/**
+ * Finds the first occurrence of needle (m bytes) in hay, like memmem().
+ */
+static const char *find_fixed(const char *hay, size_t len, const char *needle, size_t m) {
+    if (m == 0) return hay;
+    if (m == 1) return memchr(hay, needle[0], len);
+    if (m > len) return NULL;
+#if defined(__x86_64__)
+    if (have_avx2()) return find_fixed_avx2(hay, len, needle, m);
+#endif
+    return memmem(hay, len, needle, m);
+}
+
+/**
+ * Counts words (runs of non-whitespace) in p[0..len). in_word carries the
+ * state across buffers so a word split between reads counts once.
+ */
+static size_t count_words(const char *p, size_t len, int *in_word) {
+    static const unsigned char space[256] = {
+        [' '] = 1, ['\t'] = 1, ['\n'] = 1, ['\v'] = 1, ['\f'] = 1, ['\r'] = 1,
+    };
+    size_t words = 0;
+    int in = *in_word;
+    for (size_t i = 0; i < len; i++) {
+        int is_space = space[(unsigned char) p[i]];
+        words += in == 0 && !is_space;
+        in = !is_space;
+    }
+    *in_word = in;
+    return words;
+}
+
+/**
+ * Prints head/tail's "==> name <==" line shown between several files.
+ */
+static void print_header(const char *name, int first) {
+    if (strcmp(name, "-") == 0) name = "standard input";
+    if (!first) out_write("\n", 1);
+    out_write("==> ", 4);
+    out_write(name, strlen(name));
+    out_write(" <==\n", 5);
+}
+
+/**
+ * Queues output, writing straight through for chunks bigger than the
+ * queue. Write failures (a closed pipe without SIGPIPE) drop the output.
+ */
+static void out_write(const char *data, size_t len) {
+    if (out_len + len > sizeof(out_buf)) {
+        out_flush();
+        if (len >= sizeof(out_buf)) {
+            for (size_t off = 0; off < len; ) {
+                ssize_t w = write(STDOUT_FILENO, data + off, len - off);
+                if (w < 0 && errno == EINTR) continue;
+                if (w < 0) return;
+                off += w;
+            }
+            return;
+        }
+    }
+    memcpy(out_buf + out_len, data, len);
+    out_len += len;
+}
+
+/**
+ * Writes out everything out_write() queued.
+ *
+ * Note: Returns 0 on success, -1 w/ message on write failure
+ */
+static int out_flush(void) {
+    size_t off = 0;
+    while (off < out_len) {
+        ssize_t w = write(STDOUT_FILENO, out_buf + off, out_len - off);
+        if (w < 0 && errno == EINTR) continue;
+        if (w < 0) {
+            if (errno != EPIPE) fprintf(stderr, "Error: Failed to write output: %s\n", strerror(errno));
+            out_len = 0;
+            return -1;
+        }
+        off += w;
+    }
+    out_len = 0;
+    return 0;
+}
+
+/**
+ * Hands the command to the real program for options the builtin lacks.
+ * Safe because these builtins only run in a forked stage.
+ */
+static void exec_fallback(char **argv) {
+    execvp(argv[0], argv);
+    fprintf(stderr, "Error: Command not found or failed to execute '%s': %s\n", argv[0], strerror(errno));
+    exit(127);
+}
+
+/**
+ * Opens a file operand, with NULL or "-" meaning stdin.
+ *
+ * Note: Returns the fd, -1 w/ message on failure
+ */
+static int open_input(const char *cmd, const char *name) {
+    if (name == NULL || strcmp(name, "-") == 0) return STDIN_FILENO;
+
+    int fd = open(name, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        fprintf(stderr, "%s: %s: %s\n", cmd, name, strerror(errno));
+    }
+    return fd;
+}
+
+/**
+ * read() that retries on EINTR.
+ */
+static ssize_t read_some(int fd, char *buf, size_t len) {
+    ssize_t n;
+    do {
+        n = read(fd, buf, len);
+    } while (n < 0 && errno == EINTR);
+    return n;
+}
+
+/**
+ * Parses a plain non-negative line count.
+ *
+ * Note: Returns 0 on success, -1 if arg isn't just digits
+ */
+static int parse_count(const char *arg, long *value) {
+    if (*arg < '0' || *arg > '9') return -1;
+    char *end;
+    errno = 0;
+    long n = strtol(arg, &end, 10);
+    if (*end != '\0' || errno != 0) return -1;
+    *value = n;
+    return 0;
+}
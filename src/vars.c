@@ -0,0 +1,398 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+#include "shell.h"
+
+struct var {
+    char *name;
+    char *value;            // Scalar value, NULL for an array
+    struct array *array;    // Array value, NULL for a scalar
+    struct var *next;       // Next in the same hash chain
+};
+
+// A parsed $name, ${name}, ${#name}, ${name[i]}, ${name[@]} or ${#name[@]}
+struct var_ref {
+    char special;       // '?', '#', '@' or '*' for those parameters, else 0
+    long positional;    // $0, $1, ${10}..., -1 if not positional
+    const char *name;
+    size_t len;
+    int length;         // Leading '#', expands to a length
+    int all;            // [@] or [*]
+    int indexed;        // Any [...] subscript
+    const char *index;  // Subscript text, a number or $name
+    size_t index_len;
+};
+
+static struct var *vars[VAR_BUCKETS];
+static char **positional = NULL;    // $0 onwards, owned by the caller
+static int positional_count = 0;
+
+static size_t parse_ref(const char *p, struct var_ref *ref);
+static int parse_index(const struct var_ref *ref, long *index);
+static const char *array_item(struct array *arr, size_t i);
+static void item_span(const struct array *arr, size_t i, size_t *start, size_t *end);
+static struct var *find_var(const char *name, size_t len, uint64_t hash);
+static struct var *new_var(const char *name, uint64_t hash);
+
+/**
+ * Returns whether the first len bytes of name form a valid variable name:
+ * a letter or underscore followed by letters, digits and underscores.
+ */
+int valid_name(const char *name, size_t len) {
+    if (len == 0 || !(isalpha((unsigned char) name[0]) || name[0] == '_')) return 0;
+    for (size_t i = 1; i < len; i++) {
+        if (!(isalnum((unsigned char) name[i]) || name[i] == '_')) return 0;
+    }
+    return 1;
+}
+
+/**
+ * Looks up the variable named by the first len bytes of name. Shell
+ * variables shadow the environment, which is the fallback. An array gives
+ * its first item, like in bash.
+ *
+ * Note: Returns NULL if it's unset, the result is valid until it's set
+ * again
+ */
+const char *get_var(const char *name, size_t len) {
+    struct var *v = find_var(name, len, hash_bytes(name, len));
+    if (v != NULL) return v->array ? array_item(v->array, 0) : v->value;
+
+    char key[256];
+    if (len >= sizeof(key)) return NULL;
+    memcpy(key, name, len);
+    key[len] = '\0';
+    return getenv(key);
+}
+
+/**
+ * Sets a shell variable, replacing its old value (an array included). The
+ * environment isn't touched, so children don't see it.
+ *
+ * Note: Calls exit(1) on allocation failure
+ */
+void set_var(const char *name, const char *value, size_t value_len) {
+    size_t len = strlen(name);
+    uint64_t hash = hash_bytes(name, len);
+    char *copy = strndup(value, value_len);
+    if (copy == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed while setting '%s': %s\n", name, strerror(errno));
+        exit(1);
+    }
+
+    struct var *v = find_var(name, len, hash);
+    if (v == NULL) v = new_var(name, hash);
+    free(v->value);
+    free_array(v->array);
+    v->value = copy;
+    v->array = NULL;
+}
+
+/**
+ * Makes name an array holding arr's items, replacing its old value. The
+ * variable takes over arr's storage, arr itself can be discarded.
+ *
+ * Note: Calls exit(1) on allocation failure
+ */
+void set_array(const char *name, struct array *arr) {
+    size_t len = strlen(name);
+    uint64_t hash = hash_bytes(name, len);
+    struct array *copy = malloc(sizeof(struct array));
+    if (copy == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed while setting '%s': %s\n", name, strerror(errno));
+        exit(1);
+    }
+    *copy = *arr;
+
+    struct var *v = find_var(name, len, hash);
+    if (v == NULL) v = new_var(name, hash);
+    free(v->value);
+    free_array(v->array);
+    v->value = NULL;
+    v->array = copy;
+}
+
+/**
+ * Removes a shell variable, uncovering any environment variable of the
+ * same name. Unsetting one that isn't set does nothing.
+ */
+void unset_var(const char *name) {
+    size_t len = strlen(name);
+    struct var **link = &vars[hash_bytes(name, len) % VAR_BUCKETS];
+    while (*link != NULL && strcmp((*link)->name, name) != 0) link = &(*link)->next;
+    if (*link == NULL) return;
+
+    struct var *v = *link;
+    *link = v->next;
+    free(v->name);
+    free(v->value);
+    free_array(v->array);
+    free(v);
+}
+
+/**
+ * Sets the positional parameters: argv[0] becomes $0 and the rest $1 to
+ * $argc-1. The strings aren't copied, they must outlive their use.
+ */
+void set_positional(int argc, char **argv) {
+    positional = argv;
+    positional_count = argc;
+}
+
+/**
+ * Puts the positional parameters, $0 onwards, in *argv.
+ *
+ * Note: Returns how many there are, $0 included
+ */
+int get_positional(char ***argv) {
+    *argv = positional;
+    return positional_count;
+}
+
+/**
+ * Calls fn for every shell variable, not the environment, with value NULL
+ * for an array and arr NULL for a scalar.
+ */
+void for_each_var(void (*fn)(const char *name, const char *value, const struct array *arr, void *ctx), void *ctx) {
+    for (int i = 0; i < VAR_BUCKETS; i++) {
+        for (struct var *v = vars[i]; v != NULL; v = v->next) {
+            fn(v->name, v->value, v->array, ctx);
+        }
+    }
+}
+
+/**
+ * Frees an array from set_array(). Safe to call with NULL.
+ */
+void free_array(struct array *arr) {
+    if (arr == NULL) return;
+    if (arr->items != NULL) {
+        for (size_t i = 0; i < arr->count; i++) free(arr->items[i]);
+        free(arr->items);
+    }
+    free(arr->data);
+    free(arr->ends);
+    free(arr);
+}
+
+/**
+ * Returns the length of the variable reference ($name, $?, $#, $@, $*,
+ * $0..$9, or ${...} with an optional leading '#' and [index], [@] or [*]
+ * subscript, or a positional number) starting at p, or 0 if p doesn't
+ * start one. A lone '$' is literal.
+ */
+size_t var_ref_length(const char *p) {
+    struct var_ref ref;
+    return parse_ref(p, &ref);
+}
+
+/**
+ * Appends the value of the var_ref_length() bytes long reference at p to
+ * out. Unset variables and items out of range expand to nothing. ${a[@]}
+ * joins the items with spaces straight from the array's data, so listing
+ * an array never copies its items out one by one.
+ */
+void expand_var_ref(const char *p, size_t ref_len, struct buffer *out) {
+    (void) ref_len;
+    char number[32];
+    struct var_ref ref;
+    parse_ref(p, &ref);
+
+    if (ref.special == '?' || ref.special == '#') {
+        int len = snprintf(number, sizeof(number), "%d",
+                           ref.special == '?' ? last_status : (positional_count > 0 ? positional_count - 1 : 0));
+        buffer_append(out, number, len);
+        return;
+    }
+    if (ref.special != 0) {
+        for (int i = 1; i < positional_count; i++) {
+            if (i > 1) buffer_append(out, " ", 1);
+            buffer_append(out, positional[i], strlen(positional[i]));
+        }
+        return;
+    }
+    if (ref.positional >= 0) {
+        if (ref.positional < positional_count) {
+            const char *value = positional[ref.positional];
+            buffer_append(out, value, strlen(value));
+        }
+        return;
+    }
+    struct var *v = find_var(ref.name, ref.len, hash_bytes(ref.name, ref.len));
+    struct array *arr = v != NULL ? v->array : NULL;
+
+    if (ref.length && ref.all) {
+        size_t count = arr ? arr->count : get_var(ref.name, ref.len) != NULL;
+        int len = snprintf(number, sizeof(number), "%zu", count);
+        buffer_append(out, number, len);
+        return;
+    }
+    if (ref.all && arr != NULL) {
+        for (size_t i = 0; i < arr->count; i++) {
+            size_t start, end;
+            item_span(arr, i, &start, &end);
+            if (i > 0) buffer_append(out, " ", 1);
+            buffer_append(out, arr->data + start, end - start);
+        }
+        return;
+    }
+
+    const char *value;
+    long index = 0;
+    if (ref.indexed && !ref.all && parse_index(&ref, &index) < 0) return;
+    if (arr != NULL) {
+        if (index < 0) index += (long) arr->count;
+        value = index >= 0 && (size_t) index < arr->count ? array_item(arr, index) : NULL;
+    } else {
+        value = index == 0 ? get_var(ref.name, ref.len) : NULL;
+    }
+
+    if (ref.length) {
+        int len = snprintf(number, sizeof(number), "%zu", value ? strlen(value) : 0);
+        buffer_append(out, number, len);
+    } else if (value != NULL) {
+        buffer_append(out, value, strlen(value));
+    }
+}
+
+/**
+ * Parses the variable reference at p into ref.
+ *
+ * Note: Returns its length, 0 if p doesn't start one
+ */
+static size_t parse_ref(const char *p, struct var_ref *ref) {
+    memset(ref, 0, sizeof(struct var_ref));
+    ref->positional = -1;
+    if (p[0] != '$') return 0;
+    if (p[1] != '\0' && strchr("?#@*", p[1]) != NULL) {
+        ref->special = p[1];
+        return 2;
+    }
+    if (isdigit((unsigned char) p[1])) {
+        ref->positional = p[1] - '0';
+        return 2;
+    }
+
+    if (p[1] == '{' && isdigit((unsigned char) p[2])) {
+        char *end;
+        ref->positional = strtol(p + 2, &end, 10);
+        return *end == '}' ? (size_t) (end - p + 1) : 0;
+    }
+    if (p[1] != '{') {
+        size_t len = 1;
+        if (!(isalpha((unsigned char) p[1]) || p[1] == '_')) return 0;
+        while (isalnum((unsigned char) p[len]) || p[len] == '_') len++;
+        ref->name = p + 1;
+        ref->len = len - 1;
+        return len;
+    }
+
+    const char *q = p + 2;
+    if (*q == '#') {
+        ref->length = 1;
+        q++;
+    }
+    ref->name = q;
+    while (isalnum((unsigned char) *q) || *q == '_') q++;
+    ref->len = q - ref->name;
+    if (!valid_name(ref->name, ref->len)) return 0;
+
+    if (*q == '[') {
+        const char *close = strchr(q + 1, ']');
+        if (close == NULL || close == q + 1) return 0;
+        ref->indexed = 1;
+        ref->index = q + 1;
+        ref->index_len = close - q - 1;
+        ref->all = ref->index_len == 1 && (*ref->index == '@' || *ref->index == '*');
+        q = close + 1;
+    }
+    return *q == '}' ? (size_t) (q - p + 1) : 0;
+}
+
+/**
+ * Evaluates a subscript: a possibly negative integer or $name holding one.
+ *
+ * Note: Returns 0 on success, -1 if it isn't a number
+ */
+static int parse_index(const struct var_ref *ref, long *index) {
+    char text[32];
+    const char *value = text;
+    if (ref->index[0] == '$') {
+        value = get_var(ref->index + 1, ref->index_len - 1);
+        if (value == NULL) return -1;
+    } else {
+        if (ref->index_len >= sizeof(text)) return -1;
+        memcpy(text, ref->index, ref->index_len);
+        text[ref->index_len] = '\0';
+    }
+
+    char *end;
+    errno = 0;
+    *index = strtol(value, &end, 10);
+    return end == value || *end != '\0' || errno == ERANGE ? -1 : 0;
+}
+
+/**
+ * Returns item i of arr as a string, copying it out of the array's data
+ * the first time it's asked for.
+ *
+ * Note: Calls exit(1) on allocation failure
+ */
+static const char *array_item(struct array *arr, size_t i) {
+    if (i >= arr->count) return NULL;
+    if (arr->items == NULL) {
+        arr->items = calloc(arr->count, sizeof(char *));
+        if (arr->items == NULL) {
+            fprintf(stderr, "Error: Memory allocation failed for array items: %s\n", strerror(errno));
+            exit(1);
+        }
+    }
+    if (arr->items[i] == NULL) {
+        size_t start, end;
+        item_span(arr, i, &start, &end);
+        arr->items[i] = strndup(arr->data + start, end - start);
+        if (arr->items[i] == NULL) {
+            fprintf(stderr, "Error: Memory allocation failed for array items: %s\n", strerror(errno));
+            exit(1);
+        }
+    }
+    return arr->items[i];
+}
+
+/**
+ * Finds where item i lies in the array's data, its delimiter included
+ * unless the array was trimmed.
+ */
+static void item_span(const struct array *arr, size_t i, size_t *start, size_t *end) {
+    *start = i > 0 ? arr->ends[i - 1] + 1 : 0;
+    *end = arr->ends[i] + (!arr->trim && arr->ends[i] < arr->len);
+}
+
+/**
+ * Finds a shell variable by name in its hash chain.
+ */
+static struct var *find_var(const char *name, size_t len, uint64_t hash) {
+    for (struct var *v = vars[hash % VAR_BUCKETS]; v != NULL; v = v->next) {
+        if (strncmp(v->name, name, len) == 0 && v->name[len] == '\0') return v;
+    }
+    return NULL;
+}
+
+/**
+ * Adds an empty variable to the front of its hash chain.
+ *
+ * Note: Calls exit(1) on allocation failure
+ */
+static struct var *new_var(const char *name, uint64_t hash) {
+    struct var *v = calloc(1, sizeof(struct var));
+    if (v == NULL || (v->name = strdup(name)) == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed while setting '%s': %s\n", name, strerror(errno));
+        exit(1);
+    }
+    v->next = vars[hash % VAR_BUCKETS];
+    vars[hash % VAR_BUCKETS] = v;
+    return v;
+}
+